@@ -5,6 +5,7 @@
 
 static const std::string DEFAULT_SESSION_PATH = "default.session";
 static const std::string SYSTEM_CONFIG_PATH = "system.cfg";
+static const std::string IMAGE_CACHE_PATH = "image_cache";
 static const std::string TRANCE_EXE_PATH = "trance.exe";
 static const std::size_t MAXIMUM_STACK = 256;
 static const uint32_t DEFAULT_BORDER = 2;
@@ -14,6 +15,11 @@ inline std::string get_system_config_path(const std::string& directory)
   return (std::tr2::sys::path{directory} / SYSTEM_CONFIG_PATH).string();
 }
 
+inline std::string get_image_cache_path(const std::string& directory)
+{
+  return (std::tr2::sys::path{directory} / IMAGE_CACHE_PATH).string();
+}
+
 inline std::string get_trance_exe_path(const std::string& directory)
 {
   return (std::tr2::sys::path{directory} / TRANCE_EXE_PATH).string();
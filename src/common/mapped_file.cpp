@@ -0,0 +1,97 @@
+#include <common/mapped_file.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& path)
+: _data{nullptr}, _size{0}, _file{INVALID_HANDLE_VALUE}, _mapping{nullptr}
+{
+  _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (_file == INVALID_HANDLE_VALUE) {
+    return;
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(_file, &size) || !size.QuadPart) {
+    return;
+  }
+  _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!_mapping) {
+    return;
+  }
+  _data = static_cast<const uint8_t*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+  _size = _data ? std::size_t(size.QuadPart) : 0;
+}
+
+MappedFile::~MappedFile()
+{
+  if (_data) {
+    UnmapViewOfFile(_data);
+  }
+  if (_mapping) {
+    CloseHandle(_mapping);
+  }
+  if (_file != INVALID_HANDLE_VALUE) {
+    CloseHandle(_file);
+  }
+}
+
+void MappedFile::advise_sequential() const
+{
+}
+#else
+MappedFile::MappedFile(const std::string& path) : _data{nullptr}, _size{0}
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat st;
+  if (!fstat(fd, &st) && st.st_size > 0) {
+    void* data = mmap(nullptr, std::size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      _data = static_cast<const uint8_t*>(data);
+      _size = std::size_t(st.st_size);
+    }
+  }
+  close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+  if (_data) {
+    munmap(const_cast<uint8_t*>(_data), _size);
+  }
+}
+
+void MappedFile::advise_sequential() const
+{
+  if (_data) {
+    madvise(const_cast<uint8_t*>(_data), _size, MADV_SEQUENTIAL);
+  }
+}
+#endif
+
+MappedFile::operator bool() const
+{
+  return _data != nullptr;
+}
+
+const uint8_t* MappedFile::data() const
+{
+  return _data;
+}
+
+std::size_t MappedFile::size() const
+{
+  return _size;
+}
@@ -0,0 +1,33 @@
+#ifndef TRANCE_SRC_COMMON_MAPPED_FILE_H
+#define TRANCE_SRC_COMMON_MAPPED_FILE_H
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of an entire file. The mapping is released when
+// the object is destroyed.
+class MappedFile
+{
+public:
+  MappedFile(const std::string& path);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  explicit operator bool() const;
+  const uint8_t* data() const;
+  std::size_t size() const;
+  // Hints that the file will be read through from start to end, so that pages
+  // are read ahead more eagerly and dropped sooner. No-op on Windows.
+  void advise_sequential() const;
+
+private:
+  const uint8_t* _data;
+  std::size_t _size;
+#ifdef _WIN32
+  void* _file;
+  void* _mapping;
+#endif
+};
+
+#endif
@@ -0,0 +1,264 @@
+#include <common/media/colour.h>
+#include <algorithm>
+#include <cstring>
+
+// SSE2 and AVX2 kernels are used on x86 when CPUID reports support for them.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || \
+    (defined(__i386__) && defined(__SSE2__))
+#define TRANCE_COLOUR_SIMD 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TRANCE_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define TRANCE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace
+{
+  // Writes Y for pixels [begin, width) of one or two rows, and U and V for the 2x2 blocks they
+  // cover. row1 is the same as row0 (and y1 null) on the last row of an odd-height image; the
+  // last column of an odd-width image is likewise paired with itself.
+  void pack_i420_scalar(const uint8_t* row0, const uint8_t* row1, uint32_t begin,
+                        uint32_t width, uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v)
+  {
+    for (uint32_t x = begin; x < width; ++x) {
+      y0[x] = row0[4 * x];
+      if (y1) {
+        y1[x] = row1[4 * x];
+      }
+    }
+    for (uint32_t x = begin; x < width; x += 2) {
+      auto c0 = 4 * x;
+      auto c1 = 4 * std::min(x + 1, width - 1);
+      u[x / 2] = uint8_t((row0[1 + c0] + row0[1 + c1] + row1[1 + c0] + row1[1 + c1]) / 4);
+      v[x / 2] = uint8_t((row0[2 + c0] + row0[2 + c1] + row1[2 + c0] + row1[2 + c1]) / 4);
+    }
+  }
+
+#ifdef TRANCE_COLOUR_SIMD
+  enum class SimdLevel {
+    NONE,
+    SSE2,
+    AVX2,
+  };
+
+  void cpuid(int info[4], int leaf)
+  {
+#ifdef _MSC_VER
+    __cpuidex(info, leaf, 0);
+#else
+    __cpuid_count(leaf, 0, info[0], info[1], info[2], info[3]);
+#endif
+  }
+
+  SimdLevel detect_simd_level()
+  {
+    int info[4];
+    cpuid(info, 0);
+    auto max_leaf = info[0];
+    cpuid(info, 1);
+    if (!(info[3] & (1 << 26))) {
+      return SimdLevel::NONE;
+    }
+    // AVX2 also needs the OS to save the upper halves of the YMM registers.
+    bool osxsave = (info[2] & (1 << 27)) && (info[2] & (1 << 28));
+    if (!osxsave || max_leaf < 7) {
+      return SimdLevel::SSE2;
+    }
+#ifdef _MSC_VER
+    auto xcr0 = _xgetbv(0);
+#else
+    uint32_t xcr0;
+    uint32_t xcr0_high;
+    __asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_high) : "c"(0));
+#endif
+    if ((xcr0 & 6) != 6) {
+      return SimdLevel::SSE2;
+    }
+    cpuid(info, 7);
+    return info[1] & (1 << 5) ? SimdLevel::AVX2 : SimdLevel::SSE2;
+  }
+
+  const SimdLevel detected_simd_level = detect_simd_level();
+  SimdLevel simd_level = detected_simd_level;
+
+  // Handles as many whole blocks of 8 pixels as fit, returning the number of pixels done.
+  uint32_t pack_i420_sse2(const uint8_t* row0, const uint8_t* row1, uint32_t width, uint8_t* y0,
+                          uint8_t* y1, uint8_t* u, uint8_t* v)
+  {
+    const __m128i low_byte = _mm_set1_epi32(0xff);
+    const __m128i ones = _mm_set1_epi16(1);
+    uint32_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+      auto a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 4 * x));
+      auto a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 4 * x + 16));
+      auto b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 4 * x));
+      auto b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 4 * x + 16));
+
+      auto ya = _mm_packs_epi32(_mm_and_si128(a0, low_byte), _mm_and_si128(a1, low_byte));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(y0 + x), _mm_packus_epi16(ya, ya));
+      if (y1) {
+        auto yb = _mm_packs_epi32(_mm_and_si128(b0, low_byte), _mm_and_si128(b1, low_byte));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(y1 + x), _mm_packus_epi16(yb, yb));
+      }
+
+      // Sums each column of the block in 32-bit lanes, then adjacent columns with madd.
+      auto block_average = [&](int shift) {
+        auto c0 = _mm_add_epi32(_mm_and_si128(_mm_srli_epi32(a0, shift), low_byte),
+                                _mm_and_si128(_mm_srli_epi32(b0, shift), low_byte));
+        auto c1 = _mm_add_epi32(_mm_and_si128(_mm_srli_epi32(a1, shift), low_byte),
+                                _mm_and_si128(_mm_srli_epi32(b1, shift), low_byte));
+        return _mm_srli_epi32(_mm_madd_epi16(_mm_packs_epi32(c0, c1), ones), 2);
+      };
+      auto uv = _mm_packs_epi32(block_average(8), block_average(16));
+      uv = _mm_packus_epi16(uv, uv);
+      auto u_bytes = _mm_cvtsi128_si32(uv);
+      auto v_bytes = _mm_cvtsi128_si32(_mm_srli_si128(uv, 4));
+      memcpy(u + x / 2, &u_bytes, 4);
+      memcpy(v + x / 2, &v_bytes, 4);
+    }
+    return x;
+  }
+
+  // Reorders the result of a 256-bit pack, which interleaves the 128-bit lanes of its inputs,
+  // so that all of the first input comes before the second.
+  TRANCE_TARGET_AVX2 inline __m256i in_order_avx2(__m256i packed)
+  {
+    return _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+  }
+
+  // Sums each 2x2 block of the byte at the given shift in each of 16 pixels across two rows,
+  // as 8 32-bit lanes.
+  TRANCE_TARGET_AVX2 inline __m256i block_sums_avx2(__m256i a0, __m256i a1, __m256i b0,
+                                                    __m256i b1, int shift)
+  {
+    const __m256i low_byte = _mm256_set1_epi32(0xff);
+    auto c0 = _mm256_add_epi32(_mm256_and_si256(_mm256_srli_epi32(a0, shift), low_byte),
+                               _mm256_and_si256(_mm256_srli_epi32(b0, shift), low_byte));
+    auto c1 = _mm256_add_epi32(_mm256_and_si256(_mm256_srli_epi32(a1, shift), low_byte),
+                               _mm256_and_si256(_mm256_srli_epi32(b1, shift), low_byte));
+    return _mm256_madd_epi16(in_order_avx2(_mm256_packs_epi32(c0, c1)), _mm256_set1_epi16(1));
+  }
+
+  // As pack_i420_sse2, in blocks of 16 pixels.
+  TRANCE_TARGET_AVX2 uint32_t pack_i420_avx2(const uint8_t* row0, const uint8_t* row1,
+                                             uint32_t width, uint8_t* y0, uint8_t* y1, uint8_t* u,
+                                             uint8_t* v)
+  {
+    const __m256i low_byte = _mm256_set1_epi32(0xff);
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+      auto a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + 4 * x));
+      auto a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + 4 * x + 32));
+      auto b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + 4 * x));
+      auto b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + 4 * x + 32));
+
+      auto ya = in_order_avx2(
+          _mm256_packs_epi32(_mm256_and_si256(a0, low_byte), _mm256_and_si256(a1, low_byte)));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(y0 + x),
+                       _mm_packus_epi16(_mm256_castsi256_si128(ya),
+                                        _mm256_extracti128_si256(ya, 1)));
+      if (y1) {
+        auto yb = in_order_avx2(
+            _mm256_packs_epi32(_mm256_and_si256(b0, low_byte), _mm256_and_si256(b1, low_byte)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y1 + x),
+                         _mm_packus_epi16(_mm256_castsi256_si128(yb),
+                                          _mm256_extracti128_si256(yb, 1)));
+      }
+
+      auto u_sums = _mm256_srli_epi32(block_sums_avx2(a0, a1, b0, b1, 8), 2);
+      auto v_sums = _mm256_srli_epi32(block_sums_avx2(a0, a1, b0, b1, 16), 2);
+      auto uv = in_order_avx2(_mm256_packs_epi32(u_sums, v_sums));
+      auto uv_bytes =
+          _mm_packus_epi16(_mm256_castsi256_si128(uv), _mm256_extracti128_si256(uv, 1));
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(u + x / 2), uv_bytes);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(v + x / 2), _mm_srli_si128(uv_bytes, 8));
+    }
+    return x;
+  }
+#endif
+}
+
+YuvToRgb yuv_to_rgb(const YuvColourSpace& colour_space)
+{
+  auto kr = colour_space.matrix == YuvMatrix::BT709 ? .2126f : .299f;
+  auto kb = colour_space.matrix == YuvMatrix::BT709 ? .0722f : .114f;
+  auto kg = 1.f - kr - kb;
+  bool limited = colour_space.range == YuvRange::LIMITED;
+  auto ys = limited ? 255.f / 219 : 1.f;
+  auto cs = limited ? 255.f / 224 : 1.f;
+
+  return {{ys, ys, ys, 0.f, -cs * 2 * kb * (1 - kb) / kg, cs * 2 * (1 - kb),
+           cs * 2 * (1 - kr), -cs * 2 * kr * (1 - kr) / kg, 0.f},
+          {limited ? 16.f / 255 : 0.f, 128.f / 255, 128.f / 255}};
+}
+
+void i420_to_rgb(const YuvColourSpace& colour_space, uint32_t width, uint32_t height,
+                 const uint8_t* y, std::size_t y_stride, const uint8_t* u, std::size_t u_stride,
+                 const uint8_t* v, std::size_t v_stride, uint8_t* rgb)
+{
+  auto c = yuv_to_rgb(colour_space);
+  auto cl = [](float f) { return uint8_t(std::max(0.f, std::min(255.f, f + .5f))); };
+  for (uint32_t j = 0; j < height; ++j) {
+    for (uint32_t i = 0; i < width; ++i) {
+      auto Y = y[i + j * y_stride] - 255.f * c.offset[0];
+      auto U = u[i / 2 + (j / 2) * u_stride] - 255.f * c.offset[1];
+      auto V = v[i / 2 + (j / 2) * v_stride] - 255.f * c.offset[2];
+      *rgb++ = cl(c.matrix[0] * Y + c.matrix[3] * U + c.matrix[6] * V);
+      *rgb++ = cl(c.matrix[1] * Y + c.matrix[4] * U + c.matrix[7] * V);
+      *rgb++ = cl(c.matrix[2] * Y + c.matrix[5] * U + c.matrix[8] * V);
+    }
+  }
+}
+
+void pack_i420(const uint8_t* yuvx, uint32_t width, uint32_t height, uint8_t* y,
+               std::size_t y_stride, uint8_t* u, std::size_t u_stride, uint8_t* v,
+               std::size_t v_stride, uint32_t chroma_width, uint32_t chroma_height)
+{
+  // Only pixels under the chroma planes go through the kernels; any left over
+  // just have their Y copied.
+  auto paired_width = std::min(width, 2 * chroma_width);
+  for (uint32_t j = 0; j < height; j += 2) {
+    auto row0 = yuvx + 4 * std::size_t(width) * j;
+    bool pair = j + 1 < height;
+    auto row1 = pair ? row0 + 4 * std::size_t(width) : row0;
+    auto y0 = y + j * y_stride;
+    auto y1 = pair ? y0 + y_stride : nullptr;
+
+    uint32_t done = 0;
+    if (j / 2 < chroma_height) {
+      auto u_row = u + (j / 2) * u_stride;
+      auto v_row = v + (j / 2) * v_stride;
+#ifdef TRANCE_COLOUR_SIMD
+      if (simd_level >= SimdLevel::AVX2) {
+        done = pack_i420_avx2(row0, row1, paired_width, y0, y1, u_row, v_row);
+      }
+      if (simd_level >= SimdLevel::SSE2) {
+        done += pack_i420_sse2(row0 + 4 * done, row1 + 4 * done, paired_width - done, y0 + done,
+                               y1 ? y1 + done : nullptr, u_row + done / 2, v_row + done / 2);
+      }
+#endif
+      pack_i420_scalar(row0, row1, done, paired_width, y0, y1, u_row, v_row);
+      done = paired_width;
+    }
+    for (uint32_t x = done; x < width; ++x) {
+      y0[x] = row0[4 * x];
+      if (y1) {
+        y1[x] = row1[4 * x];
+      }
+    }
+  }
+}
+
+void set_max_colour_simd_level(int level)
+{
+#ifdef TRANCE_COLOUR_SIMD
+  simd_level =
+      SimdLevel(std::min(std::max(level, int(SimdLevel::NONE)), int(detected_simd_level)));
+#else
+  (void) level;
+#endif
+}
@@ -0,0 +1,53 @@
+#ifndef TRANCE_SRC_COMMON_MEDIA_COLOUR_H
+#define TRANCE_SRC_COMMON_MEDIA_COLOUR_H
+#include <cstddef>
+#include <cstdint>
+
+enum class YuvMatrix {
+  BT601,
+  BT709,
+};
+
+enum class YuvRange {
+  // Y in [16, 235], U and V in [16, 240].
+  LIMITED,
+  FULL,
+};
+
+struct YuvColourSpace {
+  YuvMatrix matrix;
+  YuvRange range;
+};
+
+// Conversion from YUV to RGB, with all values in [0, 1]: rgb = matrix * (yuv - offset). The
+// matrix is column-major, as OpenGL expects.
+struct YuvToRgb {
+  float matrix[9];
+  float offset[3];
+};
+
+YuvToRgb yuv_to_rgb(const YuvColourSpace& colour_space);
+
+// Converts I420 planes (with chroma at half resolution in each direction) to packed 3-byte
+// RGB pixels. A plain per-pixel reference, with no SIMD: frames being played are converted by
+// the shader as they're drawn, so this is only for one-off conversions (such as previews in the
+// creator) and for tests.
+void i420_to_rgb(const YuvColourSpace& colour_space, uint32_t width, uint32_t height,
+                 const uint8_t* y, std::size_t y_stride, const uint8_t* u, std::size_t u_stride,
+                 const uint8_t* v, std::size_t v_stride, uint8_t* rgb);
+
+// Splits 4-byte pixels holding Y, U and V in their first three bytes (as rendered by the
+// export shader) into I420 planes, averaging each 2x2 block for U and V. The U and V planes
+// are chroma_width x chroma_height: usually half the frame size rounded up, so that an odd last
+// row or column is averaged with itself, but encoders that round down (as x264 does) leave it
+// out of the chroma altogether. Uses SSE2 or AVX2 where the CPU has them.
+void pack_i420(const uint8_t* yuvx, uint32_t width, uint32_t height, uint8_t* y,
+               std::size_t y_stride, uint8_t* u, std::size_t u_stride, uint8_t* v,
+               std::size_t v_stride, uint32_t chroma_width, uint32_t chroma_height);
+
+// Limits the SIMD kernels used to those up to the given level (0 for none, 1 for SSE2, 2 for
+// SSE2 and AVX2), so that tests can compare them with the scalar code. Levels the CPU doesn't
+// support are never used. Not thread-safe: call only while nothing is being converted.
+void set_max_colour_simd_level(int level);
+
+#endif
@@ -0,0 +1,65 @@
+#include <common/media/frame_pool.h>
+
+FramePool::FramePool(std::size_t max_free) : _shared{new Shared}
+{
+  _shared->max_free = max_free;
+  _shared->hits = 0;
+  _shared->allocations = 0;
+  _shared->texture_bytes = 0;
+}
+
+std::shared_ptr<std::vector<uint8_t>> FramePool::get(std::size_t bytes)
+{
+  std::unique_ptr<std::vector<uint8_t>> buffer;
+  {
+    std::lock_guard<std::mutex> lock{_shared->mutex};
+    ++_shared->allocations;
+    for (auto it = _shared->free.begin(); it != _shared->free.end(); ++it) {
+      if ((*it)->size() == bytes) {
+        buffer = std::move(*it);
+        _shared->free.erase(it);
+        ++_shared->hits;
+        break;
+      }
+    }
+  }
+  if (!buffer) {
+    buffer.reset(new std::vector<uint8_t>(bytes));
+  }
+
+  std::weak_ptr<Shared> weak = _shared;
+  return {buffer.release(), [weak](std::vector<uint8_t>* buffer) {
+            std::unique_ptr<std::vector<uint8_t>> owned{buffer};
+            auto shared = weak.lock();
+            if (!shared || !shared->max_free) {
+              return;
+            }
+            std::lock_guard<std::mutex> lock{shared->mutex};
+            if (shared->free.size() >= shared->max_free) {
+              shared->free.pop_front();
+            }
+            shared->free.push_back(std::move(owned));
+          }};
+}
+
+uint64_t FramePool::hits() const
+{
+  std::lock_guard<std::mutex> lock{_shared->mutex};
+  return _shared->hits;
+}
+
+uint64_t FramePool::allocations() const
+{
+  std::lock_guard<std::mutex> lock{_shared->mutex};
+  return _shared->allocations;
+}
+
+uint64_t FramePool::texture_bytes() const
+{
+  return _shared->texture_bytes;
+}
+
+std::shared_ptr<std::atomic<uint64_t>> FramePool::texture_bytes_counter() const
+{
+  return {_shared, &_shared->texture_bytes};
+}
@@ -0,0 +1,47 @@
+#ifndef TRANCE_SRC_COMMON_MEDIA_FRAME_POOL_H
+#define TRANCE_SRC_COMMON_MEDIA_FRAME_POOL_H
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Recycles pixel buffers for a stream of images, such as the frames of an
+// animation. A buffer goes back to the pool when the last reference to it is
+// dropped, from whichever thread that happens on, even after the pool itself
+// is gone. At most max_free buffers are kept waiting for reuse. Safe to use
+// from multiple threads.
+class FramePool
+{
+public:
+  FramePool(std::size_t max_free);
+
+  // Returns a buffer of the given size, reusing a free one of the same size if
+  // there is one. The contents are undefined.
+  std::shared_ptr<std::vector<uint8_t>> get(std::size_t bytes);
+
+  // Number of buffers served from the pool, and in total.
+  uint64_t hits() const;
+  uint64_t allocations() const;
+
+  // Size of the textures of the images decoded into this pool's buffers, for
+  // as long as those images last. Image keeps the count through the counter.
+  uint64_t texture_bytes() const;
+  std::shared_ptr<std::atomic<uint64_t>> texture_bytes_counter() const;
+
+private:
+  struct Shared {
+    std::mutex mutex;
+    std::size_t max_free;
+    // Least recently freed first.
+    std::deque<std::unique_ptr<std::vector<uint8_t>>> free;
+    uint64_t hits;
+    uint64_t allocations;
+    std::atomic<uint64_t> texture_bytes;
+  };
+  std::shared_ptr<Shared> _shared;
+};
+
+#endif
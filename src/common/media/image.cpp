@@ -1,33 +1,127 @@
 #include <common/media/image.h>
+#include <common/media/frame_pool.h>
 #include <common/util.h>
+#include <cstring>
 #include <iostream>
 
 #define VPX_CODEC_DISABLE_COMPAT 1
 #pragma warning(push, 0)
 #include <SFML/Graphics.hpp>
 #include <SFML/OpenGL.hpp>
+#include <libvpx/vpx_image.h>
 #include "jpgd/jpgd.h"
 #pragma warning(pop)
 
-std::vector<GLuint> Image::textures_to_delete;
+std::vector<Image::texture_size> Image::textures_to_delete;
 std::mutex Image::textures_to_delete_mutex;
+TextureAllocator* Image::texture_allocator = nullptr;
+std::atomic<uint64_t> Image::total_memory_bytes{0};
+std::atomic<uint64_t> Image::total_video_memory_bytes{0};
 
-Image::Image() : _width{0}, _height{0}, _texture{0}
+namespace
+{
+  std::shared_ptr<std::vector<uint8_t>> new_pixels(FramePool* pool, uint64_t bytes)
+  {
+    return pool ? pool->get(std::size_t(bytes))
+                : std::make_shared<std::vector<uint8_t>>(std::size_t(bytes));
+  }
+}
+
+Image::Image()
+: _width{0}
+, _height{0}
+, _format{PixelFormat::RGBA}
+, _colour_space{YuvMatrix::BT601, YuvRange::LIMITED}
 {
 }
 
 Image::Image(uint32_t width, uint32_t height, unsigned char* data)
-: _width{width}, _height{height}, _texture{0}, _sf_image{new sf::Image}
+: _width{width}
+, _height{height}
+, _format{PixelFormat::RGBA}
+, _colour_space{YuvMatrix::BT601, YuvRange::LIMITED}
+, _deleter{new texture_deleter{0, width, height, _format}}
 {
-  _sf_image->create(width, height, data);
+  std::unique_ptr<sf::Image> image{new sf::Image};
+  image->create(width, height, data);
+  set_sf_image(image.release());
 }
 
 Image::Image(const sf::Image& image)
 : _width{image.getSize().x}
 , _height{image.getSize().y}
-, _texture{0}
-, _sf_image{new sf::Image{image}}
+, _format{PixelFormat::RGBA}
+, _colour_space{YuvMatrix::BT601, YuvRange::LIMITED}
+, _deleter{new texture_deleter{0, _width, _height, _format}}
+{
+  set_sf_image(new sf::Image{image});
+}
+
+Image::Image(uint32_t width, uint32_t height, const unsigned char* data, FramePool* pool)
+: _width{width}
+, _height{height}
+, _format{PixelFormat::RGBA}
+, _colour_space{YuvMatrix::BT601, YuvRange::LIMITED}
+, _deleter{new texture_deleter{0, width, height, _format}}
+{
+  if (pool) {
+    _deleter->pool_texture_bytes = pool->texture_bytes_counter();
+  }
+  auto pixels = new_pixels(pool, byte_size());
+  memcpy(pixels->data(), data, pixels->size());
+  set_pixels(pixels);
+}
+
+Image::Image(const vpx_image& image, FramePool* pool)
+: _width{image.d_w}
+, _height{image.d_h}
+, _format{PixelFormat::I420}
+, _colour_space{image.cs == VPX_CS_BT_709 ? YuvMatrix::BT709 : YuvMatrix::BT601,
+                image.range == VPX_CR_FULL_RANGE ? YuvRange::FULL : YuvRange::LIMITED}
+, _deleter{new texture_deleter{0, texture_width(), texture_height(), _format}}
+{
+  // Y rows, then U and V rows side by side.
+  auto chroma_width = (_width + 1) / 2;
+  auto chroma_height = (_height + 1) / 2;
+  auto row = texture_width();
+  if (pool) {
+    _deleter->pool_texture_bytes = pool->texture_bytes_counter();
+  }
+  auto planes = new_pixels(pool, byte_size());
+  auto data = planes->data();
+  for (uint32_t y = 0; y < _height; ++y) {
+    memcpy(data + y * row, image.planes[VPX_PLANE_Y] + y * image.stride[VPX_PLANE_Y], _width);
+  }
+  data += _height * row;
+  for (uint32_t y = 0; y < chroma_height; ++y) {
+    memcpy(data + y * row, image.planes[VPX_PLANE_U] + y * image.stride[VPX_PLANE_U],
+           chroma_width);
+    memcpy(data + y * row + chroma_width,
+           image.planes[VPX_PLANE_V] + y * image.stride[VPX_PLANE_V], chroma_width);
+  }
+  set_pixels(planes);
+}
+
+Image::Image(uint32_t width, uint32_t height, const uint8_t* indices, const uint32_t* palette,
+             FramePool* pool)
+: _width{width}
+, _height{height}
+, _format{PixelFormat::INDEXED}
+, _colour_space{YuvMatrix::BT601, YuvRange::LIMITED}
+, _deleter{new texture_deleter{0, texture_width(), texture_height(), _format}}
 {
+  // Index rows padded to whole texels, then the palette.
+  auto row = 4 * texture_width();
+  if (pool) {
+    _deleter->pool_texture_bytes = pool->texture_bytes_counter();
+  }
+  auto pixels = new_pixels(pool, byte_size());
+  auto data = pixels->data();
+  for (uint32_t y = 0; y < _height; ++y) {
+    memcpy(data + y * row, indices + y * _width, _width);
+  }
+  memcpy(data + _height * row, palette, 256 * sizeof(uint32_t));
+  set_pixels(pixels);
 }
 
 Image::operator bool() const
@@ -45,66 +139,248 @@ uint32_t Image::height() const
   return _height;
 }
 
+PixelFormat Image::format() const
+{
+  return _format;
+}
+
+const YuvColourSpace& Image::colour_space() const
+{
+  return _colour_space;
+}
+
+uint32_t Image::texture_width() const
+{
+  return _format == PixelFormat::I420 ? 2 * ((_width + 1) / 2)
+      : _format == PixelFormat::INDEXED ? (_width + 3) / 4
+                                        : _width;
+}
+
+uint32_t Image::texture_height() const
+{
+  if (_format == PixelFormat::INDEXED) {
+    auto row = texture_width();
+    return _height + (256 + row - 1) / row;
+  }
+  return _format == PixelFormat::I420 ? _height + (_height + 1) / 2 : _height;
+}
+
+uint64_t Image::byte_size() const
+{
+  return texture_bytes(texture_width(), texture_height(), _format);
+}
+
 uint32_t Image::texture() const
 {
-  return _texture;
+  return _deleter ? _deleter->texture : 0;
 }
 
 bool Image::ensure_texture_uploaded() const
 {
-  if (_texture || !(*this)) {
+  // The texture may already have been uploaded through another copy (or by
+  // TextureUploader) while this copy still holds on to the pixels, in which
+  // case they can be purged all the same.
+  if (!(*this) || !get_pixels()) {
     return false;
   }
+  if (_deleter->texture) {
+    return true;
+  }
 
-  // Upload the texture to video memory and set its texture_deleter so that
-  // it's cleaned up when there are no more Image objects referencing it.
-  glGenTextures(1, &_texture);
-  _deleter.reset(new texture_deleter{_texture});
+  // Upload the texture to video memory. The texture_deleter cleans it up when
+  // there are no more Image objects referencing it.
+  _deleter->set(create_texture(texture_width(), texture_height(), _format));
 
   // Could be split out to a separate call so that Theme doesn't have to hold on
   // to mutex while uploading. This probably doesn't actually block though so no
   // worries.
-  glBindTexture(GL_TEXTURE_2D, _texture);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, _width, _height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
-               _sf_image->getPixelsPtr());
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glBindTexture(GL_TEXTURE_2D, _deleter->texture);
+  fill_texture(get_pixels());
 
   // Return true for purging on the async thread.
   std::cout << ":";
   return true;
 }
 
+void Image::set_texture(uint32_t texture) const
+{
+  if (_deleter && !_deleter->texture) {
+    _deleter->set(texture);
+  } else {
+    release_texture({texture, texture_width(), texture_height(), _format});
+  }
+}
+
+void Image::cancel_upload() const
+{
+  if (_deleter) {
+    _deleter->cancelled = true;
+  }
+}
+
+bool Image::upload_cancelled() const
+{
+  return _deleter && _deleter->cancelled;
+}
+
+void Image::fill_texture(const uint8_t* pixels) const
+{
+  // Single-channel rows needn't be 4-byte aligned.
+  bool i420 = _format == PixelFormat::I420;
+  if (i420) {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  }
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture_width(), texture_height(), gl_format(_format),
+                  GL_UNSIGNED_BYTE, pixels);
+  if (i420) {
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  }
+}
+
+const uint8_t* Image::get_pixels() const
+{
+  return _sf_image ? _sf_image->getPixelsPtr() : _pixels ? _pixels->data() : nullptr;
+}
+
+std::shared_ptr<const void> Image::get_pixel_data() const
+{
+  if (_sf_image) {
+    return _sf_image;
+  }
+  return _pixels;
+}
+
 const std::shared_ptr<sf::Image>& Image::get_sf_image() const
 {
   return _sf_image;
 }
 
-void Image::clear_sf_image() const
+void Image::clear_pixels() const
 {
   _sf_image.reset();
+  _pixels.reset();
 }
 
 void Image::delete_textures()
 {
   textures_to_delete_mutex.lock();
-  for (const auto& texture : textures_to_delete) {
-    glDeleteTextures(1, &texture);
+  for (const auto& t : textures_to_delete) {
+    release_texture(t);
   }
   textures_to_delete.clear();
   textures_to_delete_mutex.unlock();
 }
 
+void Image::set_texture_allocator(TextureAllocator* allocator)
+{
+  texture_allocator = allocator;
+}
+
+uint32_t Image::create_texture(uint32_t width, uint32_t height, PixelFormat format)
+{
+  if (texture_allocator) {
+    return texture_allocator->allocate(width, height, format);
+  }
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, gl_format(format), width, height, 0, gl_format(format),
+               GL_UNSIGNED_BYTE, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, gl_filter(format));
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, gl_filter(format));
+  return texture;
+}
+
+void Image::release_texture(uint32_t texture, uint32_t width, uint32_t height,
+                            PixelFormat format)
+{
+  release_texture({texture, width, height, format});
+}
+
+uint32_t Image::gl_format(PixelFormat format)
+{
+  return format == PixelFormat::I420 ? GL_LUMINANCE : GL_RGBA;
+}
+
+int32_t Image::gl_filter(PixelFormat format)
+{
+  // Neighbouring indices can't be blended; the shader filters the colours
+  // they look up instead.
+  return format == PixelFormat::INDEXED ? GL_NEAREST : GL_LINEAR;
+}
+
+uint64_t Image::memory_bytes()
+{
+  return total_memory_bytes;
+}
+
+uint64_t Image::video_memory_bytes()
+{
+  return total_video_memory_bytes;
+}
+
+void Image::set_sf_image(sf::Image* image)
+{
+  // Account for the pixels until the last copy lets go of them.
+  auto bytes = byte_size();
+  total_memory_bytes += bytes;
+  _sf_image.reset(image, [bytes](sf::Image* image) {
+    total_memory_bytes -= bytes;
+    delete image;
+  });
+}
+
+void Image::set_pixels(const std::shared_ptr<std::vector<uint8_t>>& pixels)
+{
+  // The buffer itself goes back to its pool (if any) once the last copy lets go.
+  auto bytes = byte_size();
+  total_memory_bytes += bytes;
+  _pixels.reset(pixels.get(),
+                [bytes, pixels](std::vector<uint8_t>*) { total_memory_bytes -= bytes; });
+}
+
+void Image::release_texture(const texture_size& texture)
+{
+  if (texture_allocator) {
+    texture_allocator->release(texture.texture, texture.width, texture.height, texture.format);
+  } else {
+    glDeleteTextures(1, &texture.texture);
+  }
+}
+
+uint64_t Image::texture_bytes(uint32_t width, uint32_t height, PixelFormat format)
+{
+  return uint64_t(width) * height * (format == PixelFormat::I420 ? 1 : 4);
+}
+
+void Image::texture_deleter::set(uint32_t t)
+{
+  texture = t;
+  auto bytes = texture_bytes(width, height, format);
+  total_video_memory_bytes += bytes;
+  if (pool_texture_bytes) {
+    *pool_texture_bytes += bytes;
+  }
+}
+
 Image::texture_deleter::~texture_deleter()
 {
+  if (!texture) {
+    return;
+  }
+  auto bytes = texture_bytes(width, height, format);
+  total_video_memory_bytes -= bytes;
+  if (pool_texture_bytes) {
+    *pool_texture_bytes -= bytes;
+  }
   textures_to_delete_mutex.lock();
-  textures_to_delete.push_back(texture);
+  textures_to_delete.push_back({texture, width, height, format});
   textures_to_delete_mutex.unlock();
 }
 
-Image load_image(const std::string& path)
+Image load_image(const std::string& path, uint32_t fit_width, uint32_t fit_height)
 {
   // Load JPEGs with the jpgd library since SFML does not support progressive
   // JPEGs.
@@ -113,7 +389,8 @@ Image load_image(const std::string& path)
     int height = 0;
     int reqs = 0;
     unsigned char* data =
-        jpgd::decompress_jpeg_image_from_file(path.c_str(), &width, &height, &reqs, 4);
+        jpgd::decompress_jpeg_image_from_file(path.c_str(), &width, &height, &reqs, 4,
+                                              int(fit_width), int(fit_height));
     if (!data) {
       std::cerr << "\ncouldn't load " << path << std::endl;
       return {};
@@ -1,5 +1,7 @@
 #ifndef TRANCE_SRC_COMMON_MEDIA_IMAGE_H
 #define TRANCE_SRC_COMMON_MEDIA_IMAGE_H
+#include <common/media/colour.h>
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <vector>
@@ -9,49 +11,163 @@ namespace sf
   class Image;
 }
 struct vpx_image;
+class FramePool;
+
+// Layout of an image's pixels, which its texture shares.
+enum class PixelFormat {
+  // Four bytes per pixel.
+  RGBA,
+  // Planar YUV as decoded from video: the full-size Y plane, with the
+  // half-size U and V planes side by side beneath it, one byte per sample.
+  // Converted to RGB by the shader when drawn.
+  I420,
+  // One palette index per pixel, four to a texel, with the 256-entry palette
+  // of RGBA colours in the rows beneath. Looked up (and filtered) by the
+  // shader when drawn.
+  INDEXED,
+};
+
+// Source of textures for Image, so that they can be recycled rather than
+// created and deleted for every image. Only used from the OpenGL context
+// thread.
+class TextureAllocator
+{
+public:
+  virtual ~TextureAllocator() = default;
+  // Returns a texture with storage for width x height texels of the format.
+  virtual uint32_t allocate(uint32_t width, uint32_t height, PixelFormat format) = 0;
+  virtual void release(uint32_t texture, uint32_t width, uint32_t height,
+                       PixelFormat format) = 0;
+};
 
 // In-memory image with load-on-request OpenGL texture which is ref-counted
-// and automatically unloaded once no longer used.
+// and automatically unloaded once no longer used. The texture is shared by all
+// copies of the image, whichever copy uploaded it.
 class Image
 {
 public:
   Image();
   Image(uint32_t width, uint32_t height, unsigned char* data);
   Image(const sf::Image& image);
+  // Copies RGBA pixels into a buffer from the pool, if given.
+  Image(uint32_t width, uint32_t height, const unsigned char* data, FramePool* pool);
+  // Keeps the frame's planes as they are, in I420 format, in a buffer from the
+  // pool if given.
+  Image(const vpx_image& image, FramePool* pool = nullptr);
+  // Copies one index per pixel and a palette of 256 RGBA colours into a
+  // buffer from the pool, if given, in INDEXED format.
+  Image(uint32_t width, uint32_t height, const uint8_t* indices, const uint32_t* palette,
+        FramePool* pool);
   explicit operator bool() const;
 
   uint32_t width() const;
   uint32_t height() const;
+  PixelFormat format() const;
+  // As signalled by the video, for I420 images.
+  const YuvColourSpace& colour_space() const;
+  // Size of the texture in texels; for I420 it holds all three planes, and for
+  // INDEXED the palette too.
+  uint32_t texture_width() const;
+  uint32_t texture_height() const;
+  // Size of the pixels (and of the texture), whether or not they're held.
+  uint64_t byte_size() const;
   uint32_t texture() const;
 
   // Call from OpenGL context thread only!
   bool ensure_texture_uploaded() const;
+  // Takes ownership of a texture already filled with this image's pixels (see
+  // TextureUploader).
+  void set_texture(uint32_t texture) const;
+  // Marks the image, and all copies of it, as no longer wanted by whatever
+  // loaded it, so that TextureUploader drops it if it's still queued. Safe to
+  // call from any thread.
+  void cancel_upload() const;
+  bool upload_cancelled() const;
+  // Call from OpenGL context thread only! Fills the bound texture with pixels
+  // in this image's layout, or from the bound pixel buffer if pixels is null.
+  void fill_texture(const uint8_t* pixels) const;
+  // The pixels in the layout of the texture, or null once cleared.
+  const uint8_t* get_pixels() const;
+  // Owner of the pixels, so that the last reference can be dropped elsewhere.
+  std::shared_ptr<const void> get_pixel_data() const;
+  // Only set for RGBA images.
   const std::shared_ptr<sf::Image>& get_sf_image() const;
-  void clear_sf_image() const;
+  void clear_pixels() const;
   static void delete_textures();
 
-private:
-  // In order to ensure textures are deleted from the rendering thread, we
-  // use a separate set.
-  static std::vector<uint32_t> textures_to_delete;
-  static std::mutex textures_to_delete_mutex;
+  // Call from OpenGL context thread only! Textures are taken from and given
+  // back to the allocator, if set, rather than created and deleted.
+  static void set_texture_allocator(TextureAllocator* allocator);
+  // Returns a texture with storage for width x height texels of the format
+  // and no contents yet.
+  static uint32_t create_texture(uint32_t width, uint32_t height, PixelFormat format);
+  // Gives back a texture from create_texture that no image took.
+  static void release_texture(uint32_t texture, uint32_t width, uint32_t height,
+                              PixelFormat format);
+  // OpenGL pixel format and filtering for textures of the format.
+  static uint32_t gl_format(PixelFormat format);
+  static int32_t gl_filter(PixelFormat format);
+
+  // Total size of the pixels held in RAM, and of the textures held in video
+  // memory, by all images. Safe to call from any thread.
+  static uint64_t memory_bytes();
+  static uint64_t video_memory_bytes();
 
+private:
+  // Created along with the pixels and shared between copies; the texture is
+  // zero until uploaded.
   struct texture_deleter {
-    texture_deleter(uint32_t texture) : texture{texture}
+    texture_deleter(uint32_t texture, uint32_t width, uint32_t height, PixelFormat format)
+    : texture{texture}, width{width}, height{height}, format{format}, cancelled{false}
     {
     }
     ~texture_deleter();
+    void set(uint32_t texture);
     uint32_t texture;
+    uint32_t width;
+    uint32_t height;
+    PixelFormat format;
+    // Texture bytes of the FramePool the pixels came from, if any.
+    std::shared_ptr<std::atomic<uint64_t>> pool_texture_bytes;
+    // Set by cancel_upload().
+    std::atomic<bool> cancelled;
   };
 
+  struct texture_size {
+    uint32_t texture;
+    uint32_t width;
+    uint32_t height;
+    PixelFormat format;
+  };
+
+  static void release_texture(const texture_size& texture);
+  static uint64_t texture_bytes(uint32_t width, uint32_t height, PixelFormat format);
+
+  // In order to ensure textures are deleted from the rendering thread, we
+  // use a separate set.
+  static std::vector<texture_size> textures_to_delete;
+  static std::mutex textures_to_delete_mutex;
+  static TextureAllocator* texture_allocator;
+  static std::atomic<uint64_t> total_memory_bytes;
+  static std::atomic<uint64_t> total_video_memory_bytes;
+
+  void set_sf_image(sf::Image* image);
+  void set_pixels(const std::shared_ptr<std::vector<uint8_t>>& pixels);
+
   uint32_t _width;
   uint32_t _height;
+  PixelFormat _format;
+  YuvColourSpace _colour_space;
 
-  mutable uint32_t _texture;
   mutable std::shared_ptr<sf::Image> _sf_image;
-  mutable std::shared_ptr<texture_deleter> _deleter;
+  // Pixels in the layout of the texture, when not held by an sf::Image.
+  mutable std::shared_ptr<std::vector<uint8_t>> _pixels;
+  std::shared_ptr<texture_deleter> _deleter;
 };
 
-Image load_image(const std::string& path);
+// If fit_width and fit_height are given, JPEGs are decoded at the smallest
+// power-of-two reduction that still covers the area the image would occupy
+// when scaled to fit inside fit_width x fit_height.
+Image load_image(const std::string& path, uint32_t fit_width = 0, uint32_t fit_height = 0);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,149 @@
+#include <common/media/scale.h>
+#include <algorithm>
+
+// SSE2 is always there on x64, and MSVC targets it by default on x86 too.
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define TRANCE_SCALE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+#ifdef TRANCE_SCALE_SSE2
+  bool use_sse2 = true;
+#endif
+
+  // Writes output samples [begin, (width + 1) / 2) of one row halved from two, each sample
+  // being N bytes. row1 is the same as row0 on the last row of an odd-height plane.
+  template <uint32_t N>
+  void halve_row_scalar(const uint8_t* row0, const uint8_t* row1, uint32_t begin,
+                        uint32_t width, uint8_t* out)
+  {
+    for (uint32_t x = begin; x < (width + 1) / 2; ++x) {
+      auto c0 = N * 2 * x;
+      auto c1 = N * std::min(2 * x + 1, width - 1);
+      for (uint32_t c = 0; c < N; ++c) {
+        out[N * x + c] =
+            uint8_t((row0[c0 + c] + row0[c1 + c] + row1[c0 + c] + row1[c1 + c] + 2) / 4);
+      }
+    }
+  }
+
+#ifdef TRANCE_SCALE_SSE2
+  // Handles as many whole blocks of 16 samples as fit, returning the number of output samples
+  // done. Each block is loaded before its output is stored, so out may be row0.
+  uint32_t halve_plane_row_sse2(const uint8_t* row0, const uint8_t* row1, uint32_t width,
+                                uint8_t* out)
+  {
+    const __m128i low_byte = _mm_set1_epi16(0xff);
+    const __m128i two = _mm_set1_epi16(2);
+    uint32_t x = 0;
+    for (; 2 * x + 16 <= width; x += 8) {
+      auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 2 * x));
+      auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 2 * x));
+      auto sum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, low_byte), _mm_srli_epi16(a, 8)),
+                               _mm_add_epi16(_mm_and_si128(b, low_byte), _mm_srli_epi16(b, 8)));
+      sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(sum, sum));
+    }
+    return x;
+  }
+
+  // As above, for blocks of 8 4-byte pixels.
+  uint32_t halve_pixel_row_sse2(const uint8_t* row0, const uint8_t* row1, uint32_t width,
+                                uint8_t* out)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    // Widens two pixels from each row to 16 bits per byte, then adds the pixel pairs.
+    auto halve = [&](__m128i a, __m128i b) {
+      auto lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+      auto hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+      auto sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+      return _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+    };
+    uint32_t x = 0;
+    for (; 2 * x + 8 <= width; x += 4) {
+      auto a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * x));
+      auto a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * x + 16));
+      auto b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * x));
+      auto b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * x + 16));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * x),
+                       _mm_packus_epi16(halve(a0, b0), halve(a1, b1)));
+    }
+    return x;
+  }
+#endif
+
+  // Rows are written in order and each is read before it's written over, so dst may be src as
+  // long as dst_stride is no more than src_stride.
+  template <uint32_t N>
+  void halve(const uint8_t* src, std::size_t src_stride, uint32_t width, uint32_t height,
+             uint8_t* dst, std::size_t dst_stride)
+  {
+    for (uint32_t y = 0; y < (height + 1) / 2; ++y) {
+      auto row0 = src + 2 * y * src_stride;
+      auto row1 = 2 * y + 1 < height ? row0 + src_stride : row0;
+      auto out = dst + y * dst_stride;
+
+      uint32_t done = 0;
+#ifdef TRANCE_SCALE_SSE2
+      if (use_sse2) {
+        done = N == 1 ? halve_plane_row_sse2(row0, row1, width, out)
+                      : halve_pixel_row_sse2(row0, row1, width, out);
+      }
+#endif
+      halve_row_scalar<N>(row0, row1, done, width, out);
+    }
+  }
+
+  template <uint32_t N>
+  void downscale(const uint8_t* src, std::size_t src_stride, uint32_t width, uint32_t height,
+                 uint32_t shift, uint8_t* dst)
+  {
+    for (uint32_t i = 0; i < shift; ++i) {
+      auto w = halved(width, i);
+      halve<N>(i ? dst : src, i ? N * w : src_stride, w, halved(height, i), dst,
+               N * halved(w, 1));
+    }
+  }
+}
+
+uint32_t scale_shift(uint32_t width, uint32_t height, uint32_t fit_width, uint32_t fit_height)
+{
+  uint32_t shift = 0;
+  if (!fit_width || !fit_height) {
+    return shift;
+  }
+  while (shift < 16 &&
+         (halved(width, shift + 1) >= fit_width || halved(height, shift + 1) >= fit_height)) {
+    ++shift;
+  }
+  return shift;
+}
+
+uint32_t halved(uint32_t size, uint32_t shift)
+{
+  return uint32_t((uint64_t(size) + (uint64_t(1) << shift) - 1) >> shift);
+}
+
+void downscale_plane(const uint8_t* src, std::size_t src_stride, uint32_t width,
+                     uint32_t height, uint32_t shift, uint8_t* dst)
+{
+  downscale<1>(src, src_stride, width, height, shift, dst);
+}
+
+void downscale_pixels(const uint8_t* src, std::size_t src_stride, uint32_t width,
+                      uint32_t height, uint32_t shift, uint8_t* dst)
+{
+  downscale<4>(src, src_stride, width, height, shift, dst);
+}
+
+void set_max_scale_simd_level(int level)
+{
+#ifdef TRANCE_SCALE_SSE2
+  use_sse2 = level >= 1;
+#else
+  (void) level;
+#endif
+}
@@ -0,0 +1,30 @@
+#ifndef TRANCE_SRC_COMMON_MEDIA_SCALE_H
+#define TRANCE_SRC_COMMON_MEDIA_SCALE_H
+#include <cstddef>
+#include <cstdint>
+
+// Number of times an image can be halved while still covering the area it would occupy when
+// scaled to fit inside fit_width x fit_height, as for JPEGs in load_image. Zero if either is.
+uint32_t scale_shift(uint32_t width, uint32_t height, uint32_t fit_width, uint32_t fit_height);
+
+// Size of a plane halved shift times, rounding up.
+uint32_t halved(uint32_t size, uint32_t shift);
+
+// Shrinks a plane of one-byte samples by 2^shift in each direction, halving it shift times and
+// averaging each 2x2 block each time (the last row or column of an odd-sized plane is averaged
+// with itself). The result is written to dst without padding between rows, but dst must have
+// room for the plane halved once, since the steps in between use it too. Uses SSE2 where the
+// target has it.
+void downscale_plane(const uint8_t* src, std::size_t src_stride, uint32_t width,
+                     uint32_t height, uint32_t shift, uint8_t* dst);
+
+// The same for 4-byte pixels, averaging each byte separately.
+void downscale_pixels(const uint8_t* src, std::size_t src_stride, uint32_t width,
+                      uint32_t height, uint32_t shift, uint8_t* dst);
+
+// Limits the SIMD kernels used to those up to the given level (0 for none, 1 for SSE2), so that
+// tests can compare them with the scalar code. Not thread-safe: call only while nothing is being
+// downscaled.
+void set_max_scale_simd_level(int level);
+
+#endif
@@ -1,37 +1,56 @@
 #include <common/media/streamer.h>
 #include <common/media/image.h>
+#include <common/media/scale.h>
 #include <common/util.h>
 #include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <iterator>
 
 #pragma warning(push, 0)
 #include <giflib/gif_lib.h>
 #pragma warning(pop)
 
-GifStreamer::GifStreamer(const std::string& path) : _path{path}
+void Streamer::set_frame_pool(FramePool* pool)
 {
-  int error_code = 0;
-  _gif = DGifOpenFileName(path.c_str(), &error_code);
-  if (!_gif) {
-    std::cerr << "couldn't load " << path << ": " << GifErrorString(error_code) << std::endl;
-    return;
-  }
-  if (DGifSlurp(_gif) != GIF_OK) {
-    std::cerr << "couldn't slurp " << path << ": " << GifErrorString(_gif->Error) << std::endl;
-    return;
-  }
-  _pixels.reset(new uint32_t[_gif->SWidth * _gif->SHeight]);
-  _success = true;
+  _frame_pool = pool;
 }
 
-GifStreamer::~GifStreamer()
+void Streamer::set_fit_size(uint32_t width, uint32_t height)
 {
-  if (_gif) {
-    int error_code = 0;
-    if (DGifCloseFile(_gif, &error_code) != GIF_OK) {
-      std::cerr << "couldn't close " << _path << ": " << GifErrorString(error_code) << std::endl;
+  _fit_width = width;
+  _fit_height = height;
+}
+
+uint32_t Streamer::scale_shift(uint32_t width, uint32_t height) const
+{
+  return ::scale_shift(width, height, _fit_width, _fit_height);
+}
+
+bool Streamer::seek(std::size_t frame)
+{
+  reset();
+  for (std::size_t i = 0; i < frame; ++i) {
+    if (!skip_frame()) {
+      return false;
     }
   }
+  return true;
+}
+
+std::size_t Streamer::keyframe(std::size_t) const
+{
+  return 0;
+}
+
+GifStreamer::GifStreamer(const std::string& path) : _path{path}
+{
+  _success = open();
+}
+
+GifStreamer::~GifStreamer()
+{
+  close();
 }
 
 bool GifStreamer::success() const
@@ -41,71 +60,400 @@ bool GifStreamer::success() const
 
 void GifStreamer::reset()
 {
-  _index = 0;
+  // There's no seeking back in a GIF stream, so start reading it over.
+  close();
+  _success = open();
 }
 
 Image GifStreamer::next_frame()
 {
-  if (!success() || _gif->ImageCount < 0 || _index >= (size_t) _gif->ImageCount) {
+  if (!decode_frame()) {
     return {};
   }
-  if (!_index) {
-    for (int i = 0; i < _gif->SWidth * _gif->SHeight; ++i) {
-      _pixels[i] = _gif->SBackGroundColor;
+  std::cout << ";";
+  auto sw = uint32_t(_gif->SWidth);
+  auto sh = uint32_t(_gif->SHeight);
+  if (auto shift = scale_shift(sw, sh)) {
+    // Palette indices can't be averaged, so downscaled frames are RGBA.
+    const uint32_t* colours = _pixels.data();
+    if (_indexed) {
+      auto palette = _palette;
+      if (_clear_index >= 0) {
+        palette[_clear_index] = 0;
+      }
+      _colours.resize(_indices.size());
+      for (std::size_t i = 0; i < _indices.size(); ++i) {
+        _colours[i] = palette[_indices[i]];
+      }
+      colours = _colours.data();
     }
+    _scaled.resize(std::size_t(halved(sw, 1)) * halved(sh, 1));
+    downscale_pixels((const uint8_t*) colours, 4 * sw, sw, sh, shift, (uint8_t*) _scaled.data());
+    return {halved(sw, shift), halved(sh, shift), (const unsigned char*) _scaled.data(),
+            _frame_pool};
+  }
+  if (!_indexed) {
+    return {sw, sh, (const unsigned char*) _pixels.data(), _frame_pool};
   }
+  auto palette = _palette;
+  if (_clear_index >= 0) {
+    palette[_clear_index] = 0;
+  }
+  return {sw, sh, _indices.data(), palette.data(), _frame_pool};
+}
 
-  const auto& frame = _gif->SavedImages[_index];
-  bool transparency = false;
-  uint8_t transparency_byte = 0;
-  // Delay time in hundredths of a second. Ignore it; it messes with the
-  // rhythm.
-  int delay_time = 1;
-  for (int j = 0; j < frame.ExtensionBlockCount; ++j) {
-    const auto& block = frame.ExtensionBlocks[j];
-    if (block.Function != GRAPHICS_EXT_FUNC_CODE) {
+bool GifStreamer::skip_frame()
+{
+  return decode_frame();
+}
+
+bool GifStreamer::decode_frame()
+{
+  if (!success()) {
+    return false;
+  }
+
+  GraphicsControlBlock gcb{DISPOSAL_UNSPECIFIED, false, 0, NO_TRANSPARENT_COLOR};
+  while (true) {
+    GifRecordType type = UNDEFINED_RECORD_TYPE;
+    if (DGifGetRecordType(_gif, &type) != GIF_OK) {
+      gif_error("couldn't read record");
+      return false;
+    }
+    if (type == TERMINATE_RECORD_TYPE) {
+      return false;
+    }
+    if (type == EXTENSION_RECORD_TYPE) {
+      int code = 0;
+      GifByteType* extension = nullptr;
+      if (DGifGetExtension(_gif, &code, &extension) != GIF_OK) {
+        gif_error("couldn't read extension");
+        return false;
+      }
+      // Delay time is ignored; it messes with the rhythm.
+      if (code == GRAPHICS_EXT_FUNC_CODE && extension) {
+        DGifExtensionToGCB(extension[0], extension + 1, &gcb);
+      }
+      while (extension) {
+        if (DGifGetExtensionNext(_gif, &extension) != GIF_OK) {
+          gif_error("couldn't read extension");
+          return false;
+        }
+      }
+      continue;
+    }
+    if (type != IMAGE_DESC_RECORD_TYPE) {
       continue;
     }
 
-    char dispose = (block.Bytes[0] >> 2) & 7;
-    transparency = block.Bytes[0] & 1;
-    delay_time = block.Bytes[1] + (block.Bytes[2] << 8);
-    transparency_byte = block.Bytes[3];
+    if (DGifGetImageDesc(_gif) != GIF_OK) {
+      gif_error("couldn't read image descriptor");
+      return false;
+    }
+    // The low-level API still keeps a record of every image; drop it so that
+    // memory use doesn't grow with the length of the file.
+    GifFreeSavedImages(_gif);
+    _gif->ImageCount = 0;
+    break;
+  }
+
+  const auto& desc = _gif->Image;
+  auto map = desc.ColorMap ? desc.ColorMap : _gif->SColorMap;
+  auto fw = desc.Width;
+  auto fh = desc.Height;
+  auto fl = desc.Left;
+  auto ft = desc.Top;
+  if (fw <= 0 || fh <= 0 || !map) {
+    gif_error("bad image descriptor");
+    return false;
+  }
+
+  // Interlaced images store every 8th row from 0, every 8th from 4, every 4th
+  // from 2, and then every 2nd from 1.
+  static const int offsets[] = {0, 4, 2, 1};
+  static const int steps[] = {8, 8, 4, 2};
+  _frame.resize(std::size_t(fw) * fh);
+  for (int pass = 0; pass < (desc.Interlace ? 4 : 1); ++pass) {
+    auto first = desc.Interlace ? offsets[pass] : 0;
+    auto step = desc.Interlace ? steps[pass] : 1;
+    for (int y = first; y < fh; y += step) {
+      if (DGifGetLine(_gif, _frame.data() + std::size_t(y) * fw, fw) != GIF_OK) {
+        gif_error("couldn't decode image");
+        return false;
+      }
+    }
+  }
 
-    if (dispose == 2) {
-      for (int k = 0; k < _gif->SWidth * _gif->SHeight; ++k) {
-        _pixels[k] = _gif->SBackGroundColor;
+  // Only the part of the canvas under the frame is touched from here on.
+  auto sw = _gif->SWidth;
+  auto sh = _gif->SHeight;
+  Rect rect{std::max(0, fl), std::max(0, ft), 0, 0};
+  rect.width = std::max(0, std::min(sw, fl + fw) - rect.left);
+  rect.height = std::max(0, std::min(sh, ft + fh) - rect.top);
+  auto colour_count = std::min(256, map->ColorCount);
+  std::array<uint32_t, 256> colours{};
+  for (int i = 0; i < colour_count; ++i) {
+    const auto& c = map->Colors[i];
+    colours[i] = c.Red | (c.Green << 8) | (c.Blue << 16) | (0xff << 24);
+  }
+  bool used[256] = {};
+  std::size_t drawn = 0;
+  for (int y = rect.top; y < rect.top + rect.height; ++y) {
+    auto row = _frame.data() + std::size_t(y - ft) * fw - fl;
+    for (int x = rect.left; x < rect.left + rect.width; ++x) {
+      if (row[x] != gcb.TransparentColor && row[x] < colour_count) {
+        used[row[x]] = true;
+        ++drawn;
       }
     }
   }
-  auto map = frame.ImageDesc.ColorMap ? frame.ImageDesc.ColorMap : _gif->SColorMap;
 
-  auto fw = frame.ImageDesc.Width;
-  auto fh = frame.ImageDesc.Height;
-  auto fl = frame.ImageDesc.Left;
-  auto ft = frame.ImageDesc.Top;
+  if (_dispose == DISPOSE_BACKGROUND) {
+    clear(_dispose_rect, used);
+  } else if (_dispose == DISPOSE_PREVIOUS) {
+    restore();
+  }
 
-  for (int y = 0; y < std::min(_gif->SHeight, fh); ++y) {
-    for (int x = 0; x < std::min(_gif->SWidth, fw); ++x) {
-      uint8_t byte = frame.RasterBits[x + y * fw];
-      if (transparency && byte == transparency_byte) {
+  // A frame that covers the whole canvas can bring a palette of its own (and go
+  // back to indices after RGBA), unless what's underneath has to be kept for
+  // later.
+  bool keep = gcb.DisposalMode == DISPOSE_PREVIOUS;
+  if (drawn == std::size_t(sw) * sh && !keep) {
+    _indexed = true;
+    _indices.resize(drawn);
+    _pixels = {};
+    _clear_index = -1;
+    _palette = colours;
+  } else if (_indexed) {
+    if (_clear_index >= 0 && used[_clear_index]) {
+      move_clear_index(free_index(used));
+    }
+    // Otherwise, colours can only change where the canvas doesn't show them.
+    std::array<std::size_t, 256> counts{};
+    bool counted = false;
+    for (int i = 0; _indexed && i < colour_count; ++i) {
+      if (!used[i] || _palette[i] == colours[i]) {
         continue;
       }
-      const auto& c = map->Colors[byte];
-      _pixels[fl + x + (ft + y) * _gif->SWidth] =
-          c.Red | (c.Green << 8) | (c.Blue << 16) | (0xff << 24);
+      if (!counted) {
+        counts = count_indices();
+        counted = true;
+      }
+      if (counts[i]) {
+        to_rgba();
+      } else {
+        _palette[i] = colours[i];
+      }
     }
   }
+  if (keep) {
+    save(rect);
+  }
 
-  _index = (_index + 1);
-  std::cout << ";";
-  return {static_cast<std::uint32_t>(_gif->SWidth), static_cast<std::uint32_t>(_gif->SHeight),
-          (unsigned char*) _pixels.get()};
+  for (int y = rect.top; y < rect.top + rect.height; ++y) {
+    auto row = _frame.data() + std::size_t(y - ft) * fw - fl;
+    auto canvas = std::size_t(y) * sw;
+    for (int x = rect.left; x < rect.left + rect.width; ++x) {
+      auto byte = row[x];
+      if (byte == gcb.TransparentColor || byte >= colour_count) {
+        continue;
+      }
+      if (_indexed) {
+        _indices[canvas + x] = byte;
+      } else {
+        _pixels[canvas + x] = colours[byte];
+      }
+    }
+  }
+  _dispose = gcb.DisposalMode;
+  _dispose_rect = rect;
+  return true;
+}
+
+bool GifStreamer::open()
+{
+  int error_code = 0;
+  _gif = DGifOpenFileName(_path.c_str(), &error_code);
+  if (!_gif) {
+    std::cerr << "couldn't load " << _path << ": " << GifErrorString(error_code) << std::endl;
+    return false;
+  }
+  if (_gif->SWidth <= 0 || _gif->SHeight <= 0) {
+    std::cerr << "couldn't load " << _path << ": bad screen size" << std::endl;
+    return false;
+  }
+
+  // Nothing has been drawn yet.
+  _indexed = true;
+  _indices.assign(std::size_t(_gif->SWidth) * _gif->SHeight, 0);
+  _palette.fill(0);
+  _clear_index = 0;
+  _pixels.clear();
+  _dispose = DISPOSAL_UNSPECIFIED;
+  return true;
+}
+
+void GifStreamer::close()
+{
+  if (_gif) {
+    int error_code = 0;
+    if (DGifCloseFile(_gif, &error_code) != GIF_OK) {
+      std::cerr << "couldn't close " << _path << ": " << GifErrorString(error_code) << std::endl;
+    }
+    _gif = nullptr;
+  }
+}
+
+void GifStreamer::gif_error(const std::string& error)
+{
+  std::cerr << "couldn't load " << _path << ": " << error << ": " << GifErrorString(_gif->Error)
+            << std::endl;
+  _success = false;
+}
+
+std::array<std::size_t, 256> GifStreamer::count_indices() const
+{
+  std::array<std::size_t, 256> counts{};
+  for (auto index : _indices) {
+    ++counts[index];
+  }
+  return counts;
+}
+
+int GifStreamer::free_index(const bool* used) const
+{
+  auto counts = count_indices();
+  // Colours are usually numbered from zero, so look from the top.
+  for (int i = 255; i >= 0; --i) {
+    if (!counts[i] && !used[i]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void GifStreamer::move_clear_index(int index)
+{
+  if (index < 0) {
+    to_rgba();
+    return;
+  }
+  for (auto& i : _indices) {
+    if (i == _clear_index) {
+      i = uint8_t(index);
+    }
+  }
+  _clear_index = index;
+}
+
+void GifStreamer::to_rgba()
+{
+  auto colour = [&](uint8_t index) { return index == _clear_index ? 0 : _palette[index]; };
+  _pixels.resize(_indices.size());
+  std::transform(_indices.begin(), _indices.end(), _pixels.begin(), colour);
+  _saved_pixels.resize(_saved_indices.size());
+  std::transform(_saved_indices.begin(), _saved_indices.end(), _saved_pixels.begin(), colour);
+  _indexed = false;
+  _indices = {};
+  _saved_indices = {};
+}
+
+void GifStreamer::clear(const Rect& rect, const bool* used)
+{
+  if (_indexed && _clear_index < 0) {
+    _clear_index = free_index(used);
+    if (_clear_index < 0) {
+      to_rgba();
+    }
+  }
+  for (int y = rect.top; y < rect.top + rect.height; ++y) {
+    auto begin = std::size_t(y) * _gif->SWidth + rect.left;
+    if (_indexed) {
+      std::fill_n(_indices.begin() + begin, rect.width, uint8_t(_clear_index));
+    } else {
+      std::fill_n(_pixels.begin() + begin, rect.width, 0);
+    }
+  }
+}
+
+void GifStreamer::save(const Rect& rect)
+{
+  _saved_indices.clear();
+  _saved_pixels.clear();
+  for (int y = rect.top; y < rect.top + rect.height; ++y) {
+    auto begin = std::size_t(y) * _gif->SWidth + rect.left;
+    if (_indexed) {
+      _saved_indices.insert(_saved_indices.end(), _indices.begin() + begin,
+                            _indices.begin() + begin + rect.width);
+    } else {
+      _saved_pixels.insert(_saved_pixels.end(), _pixels.begin() + begin,
+                           _pixels.begin() + begin + rect.width);
+    }
+  }
+}
+
+void GifStreamer::restore()
+{
+  const auto& rect = _dispose_rect;
+  for (int y = rect.top; y < rect.top + rect.height; ++y) {
+    auto begin = std::size_t(y) * _gif->SWidth + rect.left;
+    auto saved = std::size_t(y - rect.top) * rect.width;
+    if (_indexed) {
+      std::copy_n(_saved_indices.begin() + saved, rect.width, _indices.begin() + begin);
+    } else {
+      std::copy_n(_saved_pixels.begin() + saved, rect.width, _pixels.begin() + begin);
+    }
+  }
+  _saved_indices.clear();
+  _saved_pixels.clear();
+}
+
+MappedMkvReader::MappedMkvReader(const std::string& path) : _file{path}
+{
+  _file.advise_sequential();
+}
+
+MappedMkvReader::operator bool() const
+{
+  return bool(_file);
 }
 
-WebmStreamer::WebmStreamer(const std::string& path) : _path{path}, _codec{}
+int MappedMkvReader::Read(long long pos, long len, unsigned char* buf)
 {
-  if (_reader.Open(path.c_str())) {
+  auto source = data(pos, len);
+  if (!source) {
+    return -1;
+  }
+  memcpy(buf, source, std::size_t(len));
+  return 0;
+}
+
+int MappedMkvReader::Length(long long* total, long long* available)
+{
+  if (!_file) {
+    return -1;
+  }
+  if (total) {
+    *total = (long long) _file.size();
+  }
+  if (available) {
+    *available = (long long) _file.size();
+  }
+  return 0;
+}
+
+const uint8_t* MappedMkvReader::data(long long pos, long len) const
+{
+  if (!_file || pos < 0 || len < 0 || uint64_t(pos) + uint64_t(len) > _file.size()) {
+    return nullptr;
+  }
+  return _file.data() + pos;
+}
+
+WebmStreamer::WebmStreamer(const std::string& path, uint32_t threads, bool frame_parallel)
+: _path{path}, _reader{path}, _codec{}
+{
+  if (!_reader) {
     std::cerr << "couldn't open " << path << std::endl;
     return;
   }
@@ -148,7 +496,15 @@ WebmStreamer::WebmStreamer(const std::string& path) : _path{path}, _codec{}
     return;
   }
 
-  if (vpx_codec_dec_init(&_codec, vp9 ? vpx_codec_vp9_dx() : vpx_codec_vp8_dx(), nullptr, 0)) {
+  auto iface = vp9 ? vpx_codec_vp9_dx() : vpx_codec_vp8_dx();
+  vpx_codec_dec_cfg_t config{};
+  config.threads = std::max(1u, threads);
+  vpx_codec_flags_t flags = 0;
+  if (frame_parallel && (vpx_codec_get_caps(iface) & VPX_CODEC_CAP_FRAME_THREADING)) {
+    flags |= VPX_CODEC_USE_FRAME_THREADING;
+    _frame_parallel = true;
+  }
+  if (vpx_codec_dec_init(&_codec, iface, &config, flags)) {
     codec_error("initialising codec");
     return;
   }
@@ -171,15 +527,85 @@ bool WebmStreamer::success() const
 
 void WebmStreamer::reset()
 {
-  _cluster = nullptr;
-  _cluster_eos = false;
+  restart(nullptr);
+  _frames = 0;
 }
 
 Image WebmStreamer::next_frame()
 {
-  if (!_success) {
+  if (!decode_frame()) {
     return {};
   }
+  // Frames are kept in I420 (YUV with NxN Y-plane and (N/2)x(N/2) U- and V-planes) and only
+  // converted to RGB when drawn.
+  Image image;
+  if (auto shift = scale_shift(_image->d_w, _image->d_h)) {
+    // Each plane is downscaled separately, and the result passed off as the frame.
+    vpx_image_t scaled = *_image;
+    uint32_t widths[] = {_image->d_w, (_image->d_w + 1) / 2, (_image->d_w + 1) / 2};
+    uint32_t heights[] = {_image->d_h, (_image->d_h + 1) / 2, (_image->d_h + 1) / 2};
+    std::size_t offsets[4] = {0};
+    for (int i = 0; i < 3; ++i) {
+      offsets[i + 1] = offsets[i] + std::size_t(halved(widths[i], 1)) * halved(heights[i], 1);
+    }
+    _scaled.resize(offsets[3]);
+    for (int i = 0; i < 3; ++i) {
+      downscale_plane(_image->planes[i], _image->stride[i], widths[i], heights[i], shift,
+                      _scaled.data() + offsets[i]);
+      scaled.planes[i] = _scaled.data() + offsets[i];
+      scaled.stride[i] = int(halved(widths[i], shift));
+    }
+    scaled.d_w = halved(_image->d_w, shift);
+    scaled.d_h = halved(_image->d_h, shift);
+    image = Image{scaled, _frame_pool};
+  } else {
+    image = Image{*_image, _frame_pool};
+  }
+  _image = vpx_codec_get_frame(&_codec, &_it);
+  std::cout << ";";
+  return image;
+}
+
+bool WebmStreamer::skip_frame()
+{
+  if (!decode_frame()) {
+    return false;
+  }
+  _image = vpx_codec_get_frame(&_codec, &_it);
+  return true;
+}
+
+bool WebmStreamer::seek(std::size_t frame)
+{
+  if (!_success) {
+    return false;
+  }
+  auto keyframe = find_keyframe(frame);
+  auto start = keyframe ? keyframe->frame : 0;
+  // Carries on from the current frame if there's no keyframe in between.
+  if (_frames < start || _frames > frame) {
+    restart(keyframe ? keyframe->block : nullptr);
+    _frames = start;
+  }
+  while (_frames < frame) {
+    if (!skip_frame()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::size_t WebmStreamer::keyframe(std::size_t frame) const
+{
+  auto keyframe = find_keyframe(frame);
+  return keyframe ? keyframe->frame : 0;
+}
+
+bool WebmStreamer::decode_frame()
+{
+  if (!_success) {
+    return false;
+  }
   if (!_cluster_eos && !_cluster) {
     _cluster = _segment->GetFirst();
   }
@@ -187,7 +613,24 @@ Image WebmStreamer::next_frame()
   bool block_eos = false;
   while (true) {
     if (_cluster_eos || _cluster->EOS()) {
-      return {};
+      if (!_frame_parallel) {
+        return false;
+      }
+      // Frames still being decoded in parallel only come out after a flush.
+      if (!_flushed) {
+        _flushed = true;
+        if (vpx_codec_decode(&_codec, nullptr, 0, nullptr, 0)) {
+          codec_error("flushing codec");
+          _success = false;
+          return false;
+        }
+        _it = nullptr;
+        _image = vpx_codec_get_frame(&_codec, &_it);
+      }
+      if (!_image) {
+        return false;
+      }
+      break;
     }
 
     if (!block_eos && !_block) {
@@ -195,7 +638,7 @@ Image WebmStreamer::next_frame()
         std::cerr << "couldn't load " << _path << ": couldn't parse first block of cluster"
                   << std::endl;
         _success = false;
-        return {};
+        return false;
       }
       _block_index = -1;
     }
@@ -220,7 +663,7 @@ Image WebmStreamer::next_frame()
         std::cerr << "couldn't load " << _path << ": couldn't parse next block of cluster"
                   << std::endl;
         _success = false;
-        return {};
+        return false;
       }
       if (!_block) {
         block_eos = true;
@@ -230,14 +673,23 @@ Image WebmStreamer::next_frame()
     }
 
     if (!_iterating) {
+      // Decoded straight from the mapping, which outlives the codec.
       auto& frame = _block->GetBlock()->GetFrame(_block_index);
-      _data.reset(new uint8_t[frame.len]);
-      _reader.Read(frame.pos, frame.len, _data.get());
-
-      if (vpx_codec_decode(&_codec, _data.get(), frame.len, nullptr, 0)) {
+      auto data = _reader.data(frame.pos, frame.len);
+      if (!data) {
+        std::cerr << "couldn't load " << _path << ": block out of range" << std::endl;
+        _success = false;
+        return false;
+      }
+      // Keyframe blocks tag their frames, so that they can be indexed once
+      // decoded.
+      void* user_priv = _block_index == 0 && _block->GetBlock()->IsKey()
+          ? const_cast<mkvparser::BlockEntry*>(_block)
+          : nullptr;
+      if (vpx_codec_decode(&_codec, data, frame.len, user_priv, 0)) {
         codec_error("decoding frame");
         _success = false;
-        return {};
+        return false;
       }
       _iterating = true;
       _image = vpx_codec_get_frame(&_codec, &_it);
@@ -252,27 +704,40 @@ Image WebmStreamer::next_frame()
     break;
   }
 
-  // Convert I420 (YUV with NxN Y-plane and (N/2)x(N/2) U- and V-planes) to RGB.
-  std::unique_ptr<uint32_t[]> pixels(new uint32_t[_image->d_w * _image->d_h]);
-  auto w = _image->d_w;
-  auto h = _image->d_h;
-  for (uint32_t y = 0; y < h; ++y) {
-    for (uint32_t x = 0; x < w; ++x) {
-      uint8_t Y = _image->planes[VPX_PLANE_Y][x + y * _image->stride[VPX_PLANE_Y]];
-      uint8_t U = _image->planes[VPX_PLANE_U][x / 2 + (y / 2) * _image->stride[VPX_PLANE_U]];
-      uint8_t V = _image->planes[VPX_PLANE_V][x / 2 + (y / 2) * _image->stride[VPX_PLANE_V]];
+  if (_image->user_priv && (_keyframes.empty() || _keyframes.back().frame < _frames)) {
+    _keyframes.push_back({_frames, static_cast<const mkvparser::BlockEntry*>(_image->user_priv)});
+  }
+  ++_frames;
+  return true;
+}
 
-      auto cl = [](float f) { return (uint8_t) std::max(0, std::min(255, (int) f)); };
-      auto R = cl(1.164f * (Y - 16.f) + 1.596f * (V - 128.f));
-      auto G = cl(1.164f * (Y - 16.f) - 0.391f * (U - 128.f) - 0.813f * (V - 128.f));
-      auto B = cl(1.164f * (Y - 16.f) + 2.017f * (U - 128.f));
-      pixels[x + y * w] = R | (G << 8) | (B << 16) | (0xff << 24);
+const WebmStreamer::Keyframe* WebmStreamer::find_keyframe(std::size_t frame) const
+{
+  auto it = std::upper_bound(
+      _keyframes.begin(), _keyframes.end(), frame,
+      [](std::size_t frame, const Keyframe& keyframe) { return frame < keyframe.frame; });
+  return it == _keyframes.begin() ? nullptr : &*std::prev(it);
+}
+
+void WebmStreamer::restart(const mkvparser::BlockEntry* block)
+{
+  if (_frame_parallel && !_flushed && _cluster) {
+    if (vpx_codec_decode(&_codec, nullptr, 0, nullptr, 0)) {
+      codec_error("flushing codec");
+      _success = false;
+    }
+    _it = nullptr;
+    while (vpx_codec_get_frame(&_codec, &_it)) {
     }
   }
-
-  _image = vpx_codec_get_frame(&_codec, &_it);
-  std::cout << ";";
-  return {w, h, (uint8_t*) pixels.get()};
+  _cluster = block ? block->GetCluster() : nullptr;
+  _cluster_eos = false;
+  _block = block;
+  _block_index = -1;
+  _iterating = false;
+  _it = nullptr;
+  _image = nullptr;
+  _flushed = false;
 }
 
 void WebmStreamer::codec_error(const std::string& error)
@@ -285,33 +750,71 @@ void WebmStreamer::codec_error(const std::string& error)
   std::cerr << std::endl;
 };
 
-bool is_gif_animated(const std::string& path)
+std::size_t count_gif_frames(const std::string& path, std::size_t limit)
 {
   int error_code = 0;
   GifFileType* gif = DGifOpenFileName(path.c_str(), &error_code);
   if (!gif) {
     std::cerr << "couldn't load " << path << ": " << GifErrorString(error_code) << std::endl;
-    return false;
+    return 0;
   }
-  int frames = 0;
-  if (DGifSlurp(gif) != GIF_OK) {
-    std::cerr << "couldn't slurp " << path << ": " << GifErrorString(gif->Error) << std::endl;
-  } else {
-    frames = gif->ImageCount;
+
+  // Skips over extensions and compressed image data without decoding them.
+  std::size_t frames = 0;
+  bool done = false;
+  while (!done && (!limit || frames < limit)) {
+    GifRecordType type = UNDEFINED_RECORD_TYPE;
+    int code = 0;
+    GifByteType* block = nullptr;
+    if (DGifGetRecordType(gif, &type) != GIF_OK) {
+      break;
+    }
+    if (type == IMAGE_DESC_RECORD_TYPE) {
+      if (DGifGetImageDesc(gif) != GIF_OK || DGifGetCode(gif, &code, &block) != GIF_OK) {
+        break;
+      }
+      GifFreeSavedImages(gif);
+      gif->ImageCount = 0;
+      ++frames;
+    } else if (type == EXTENSION_RECORD_TYPE) {
+      if (DGifGetExtension(gif, &code, &block) != GIF_OK) {
+        break;
+      }
+    } else if (type == TERMINATE_RECORD_TYPE) {
+      done = true;
+    }
+    while (block) {
+      if ((type == IMAGE_DESC_RECORD_TYPE ? DGifGetCodeNext(gif, &block)
+                                          : DGifGetExtensionNext(gif, &block)) != GIF_OK) {
+        done = true;
+        break;
+      }
+    }
   }
+
   if (DGifCloseFile(gif, &error_code) != GIF_OK) {
     std::cerr << "couldn't close " << path << ": " << GifErrorString(error_code) << std::endl;
   }
-  return frames > 0;
+  return frames;
+}
+
+bool is_gif_animated(const std::string& path)
+{
+  return count_gif_frames(path, 2) > 1;
 }
 
-std::unique_ptr<Streamer> load_animation(const std::string& path)
+std::unique_ptr<Streamer> load_animation(const std::string& path, uint32_t decode_threads,
+                                         bool frame_parallel, uint32_t fit_width,
+                                         uint32_t fit_height)
 {
+  std::unique_ptr<Streamer> streamer;
   if (ext_is(path, "gif")) {
-    return std::unique_ptr<Streamer>{new GifStreamer(path)};
+    streamer.reset(new GifStreamer(path));
+  } else if (ext_is(path, "webm")) {
+    streamer.reset(new WebmStreamer(path, decode_threads, frame_parallel));
   }
-  if (ext_is(path, "webm")) {
-    return std::unique_ptr<Streamer>{new WebmStreamer(path)};
+  if (streamer) {
+    streamer->set_fit_size(fit_width, fit_height);
   }
-  return {};
+  return streamer;
 }
\ No newline at end of file
@@ -1,18 +1,22 @@
 #ifndef TRANCE_SRC_COMMON_MEDIA_STREAMER_H
 #define TRANCE_SRC_COMMON_MEDIA_STREAMER_H
+#include <common/mapped_file.h>
+#include <array>
 #include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 #define VPX_CODEC_DISABLE_COMPAT 1
 #pragma warning(push, 0)
 #include <libvpx/vp8dx.h>
 #include <libvpx/vpx_decoder.h>
 #include <libwebm/mkvparser.hpp>
-#include <libwebm/mkvreader.hpp>
 #pragma warning(pop)
 
+class FramePool;
 class Image;
 struct GifFileType;
 
@@ -23,8 +27,38 @@ public:
   virtual bool success() const = 0;
   virtual void reset() = 0;
   virtual Image next_frame() = 0;
+  // Decodes the next frame as far as later frames need it, without making an
+  // image of it, for frames that won't be shown. Returns false at the end.
+  virtual bool skip_frame() = 0;
+  // Positions the streamer so that the next frame given out is the given one,
+  // counting from zero. Returns false if there aren't that many. By default
+  // this starts over and skips the frames before it.
+  virtual bool seek(std::size_t frame);
+  // The last frame at or before the given one that decoding can start afresh
+  // from, so that seeking to it skips no frames.
+  virtual std::size_t keyframe(std::size_t frame) const;
+
+  // Frames are decoded into buffers from the pool, if set, rather than each
+  // being allocated separately. The pool must outlive the streamer.
+  void set_frame_pool(FramePool* pool);
+  // If set, frames are given out halved in size as many times as they can be
+  // while still covering the area they'd occupy scaled to fit inside
+  // width x height.
+  void set_fit_size(uint32_t width, uint32_t height);
+
+protected:
+  // Number of times to halve frames of the given size.
+  uint32_t scale_shift(uint32_t width, uint32_t height) const;
+
+  FramePool* _frame_pool = nullptr;
+  uint32_t _fit_width = 0;
+  uint32_t _fit_height = 0;
 };
 
+// Decodes one frame at a time straight from the file, so that only the
+// current frame is ever held in memory. Frames are given out as palette
+// indices for as long as the whole canvas fits one palette, and as RGBA once it
+// doesn't.
 class GifStreamer : public Streamer
 {
 public:
@@ -34,34 +68,121 @@ public:
   bool success() const override;
   void reset() override;
   Image next_frame() override;
+  bool skip_frame() override;
 
 private:
+  // Part of the canvas covered by a frame.
+  struct Rect {
+    int left;
+    int top;
+    int width;
+    int height;
+  };
+
+  bool open();
+  void close();
+  void gif_error(const std::string& error);
+  // Draws the next frame onto the canvas. Returns false at the end.
+  bool decode_frame();
+
+  // Number of pixels of the canvas with each index.
+  std::array<std::size_t, 256> count_indices() const;
+  // Returns a palette index used neither by the canvas nor by the frame about
+  // to be drawn, or -1 if there are none left.
+  int free_index(const bool* used) const;
+  // Changes the index marking undrawn pixels, or converts the canvas to RGBA
+  // if there's none free.
+  void move_clear_index(int index);
+  // Converts the canvas to RGBA, until a frame covers all of it.
+  void to_rgba();
+  void clear(const Rect& rect, const bool* used);
+  void save(const Rect& rect);
+  void restore();
+
   const std::string _path;
   bool _success = false;
   GifFileType* _gif = nullptr;
-  std::size_t _index = 0;
-  std::unique_ptr<uint32_t[]> _pixels;
+  std::vector<uint8_t> _frame;
+
+  bool _indexed = true;
+  std::vector<uint8_t> _indices;
+  std::array<uint32_t, 256> _palette;
+  // Pixels of the canvas that haven't been drawn (and are transparent) have
+  // this index, or it's -1 if there are none.
+  int _clear_index = -1;
+  std::vector<uint32_t> _pixels;
+
+  // How to dispose of the last frame before drawing the next one.
+  int _dispose = 0;
+  Rect _dispose_rect;
+  std::vector<uint8_t> _saved_indices;
+  std::vector<uint32_t> _saved_pixels;
+
+  // Scratch space for downscaling the canvas.
+  std::vector<uint32_t> _colours;
+  std::vector<uint32_t> _scaled;
+};
+
+// Reads a WebM file through a memory mapping, so that blocks can be decoded
+// straight from the mapped pages without being copied out first.
+class MappedMkvReader : public mkvparser::IMkvReader
+{
+public:
+  MappedMkvReader(const std::string& path);
+
+  explicit operator bool() const;
+  int Read(long long pos, long len, unsigned char* buf) override;
+  int Length(long long* total, long long* available) override;
+  // Pointer to len bytes at pos, or null if they're not all in the file.
+  const uint8_t* data(long long pos, long len) const;
+
+private:
+  MappedFile _file;
 };
 
 class WebmStreamer : public Streamer
 {
 public:
-  WebmStreamer(const std::string& path);
+  // The codec decodes with up to the given number of threads. Frame-parallel
+  // decoding is only used if the codec supports it, and delays each frame by a
+  // few, so that the last ones come out once the whole file has been read.
+  WebmStreamer(const std::string& path, uint32_t threads = 1, bool frame_parallel = false);
   ~WebmStreamer() override;
 
   bool success() const override;
   void reset() override;
   Image next_frame() override;
+  bool skip_frame() override;
+  // Seeking starts from the nearest keyframe that has already been decoded
+  // once.
+  bool seek(std::size_t frame) override;
+  std::size_t keyframe(std::size_t frame) const override;
 
 private:
+  // A block starting with a keyframe, and the number of the frame it decodes
+  // to.
+  struct Keyframe {
+    std::size_t frame;
+    const mkvparser::BlockEntry* block;
+  };
+
   void codec_error(const std::string& error);
+  // Decodes the next frame into the codec. Returns false at the end.
+  bool decode_frame();
+  // The last keyframe at or before the given frame, if any.
+  const Keyframe* find_keyframe(std::size_t frame) const;
+  // Drops any frames in flight and carries on decoding from the given block,
+  // or from the start if null.
+  void restart(const mkvparser::BlockEntry* block);
 
   const std::string _path;
   std::atomic<bool> _success = false;
 
-  mkvparser::MkvReader _reader;
+  MappedMkvReader _reader;
   std::unique_ptr<mkvparser::Segment> _segment;
   vpx_codec_ctx_t _codec;
+  bool _frame_parallel = false;
+  bool _flushed = false;
 
   const mkvparser::VideoTrack* _video_track = nullptr;
   const mkvparser::Cluster* _cluster = nullptr;
@@ -72,10 +193,24 @@ private:
   bool _iterating = false;
   vpx_codec_iter_t _it = nullptr;
   const vpx_image_t* _image = nullptr;
-  std::unique_ptr<uint8_t[]> _data;
+  // Scratch space for downscaling frames.
+  std::vector<uint8_t> _scaled;
+
+  // Number of the frame decoded next. Keyframes are indexed as they come out
+  // of the codec, in order, since only then is their frame number known.
+  std::size_t _frames = 0;
+  std::vector<Keyframe> _keyframes;
 };
 
+// Counts the frames in a GIF without decoding them, stopping once there are at
+// least limit frames (if nonzero).
+std::size_t count_gif_frames(const std::string& path, std::size_t limit = 0);
+// True if the GIF has more than one frame.
 bool is_gif_animated(const std::string& path);
-std::unique_ptr<Streamer> load_animation(const std::string& path);
+// Frames are downscaled to fit_width x fit_height, if given, as by
+// Streamer::set_fit_size.
+std::unique_ptr<Streamer> load_animation(const std::string& path, uint32_t decode_threads = 1,
+                                         bool frame_parallel = false, uint32_t fit_width = 0,
+                                         uint32_t fit_height = 0);
 
 #endif
\ No newline at end of file
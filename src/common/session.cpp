@@ -1,4 +1,5 @@
 #include <common/session.h>
+#include <common/media/streamer.h>
 #include <common/util.h>
 #include <algorithm>
 #include <filesystem>
@@ -259,6 +260,13 @@ namespace
     return result;
   }
 
+  // Single-frame GIFs are loaded as images. Only the GIF headers are read, so
+  // this is quick even for large files.
+  bool is_still_gif(const std::string& path)
+  {
+    return ext_is(path, "gif") && !is_gif_animated(path);
+  }
+
 } // anonymous namespace
 
 std::string make_relative(const std::string& from, const std::string& to)
@@ -273,7 +281,6 @@ bool is_image(const std::string& path)
 
 bool is_animation(const std::string& path)
 {
-  // Should really check is_gif_animated(), but it takes far too long.
   return ext_is(path, "webm") || ext_is(path, "gif");
 }
 
@@ -337,10 +344,10 @@ void search_resources(trance_pb::Session& session, const std::string& root)
           }
           themes[theme_name].add_text_line(split_text_line(line));
         }
+      } else if (is_image(rel_str) || is_still_gif(it->path().string())) {
+        themes[theme_name].add_image_path(rel_str);
       } else if (is_animation(rel_str)) {
         themes[theme_name].add_animation_path(rel_str);
-      } else if (is_image(rel_str)) {
-        themes[theme_name].add_image_path(rel_str);
       }
     }
   }
@@ -392,10 +399,10 @@ void search_resources(trance_pb::Theme& theme, const std::string& root)
       auto rel_str = relative_path.string();
       if (is_font(rel_str)) {
         theme.add_font_path(rel_str);
+      } else if (is_image(rel_str) || is_still_gif(it->path().string())) {
+        theme.add_image_path(rel_str);
       } else if (is_animation(rel_str)) {
         theme.add_animation_path(rel_str);
-      } else if (is_image(rel_str)) {
-        theme.add_image_path(rel_str);
       }
     }
   }
@@ -439,8 +446,16 @@ trance_pb::System get_default_system()
   system.set_renderer(trance_pb::System::MONITOR);
   system.mutable_draw_depth()->set_draw_depth(.5f);
   system.mutable_eye_spacing()->set_eye_spacing(1.f / 16);
-  system.set_image_cache_size(64);
+  system.set_image_memory_budget(2048);
+  system.set_video_memory_budget(1024);
   system.set_animation_buffer_size(32);
+  system.set_animation_decode_threads(0);
+  system.set_animation_frame_parallel(true);
+  system.set_image_decode_threads(0);
+  system.set_image_disk_cache_size(4096);
+  system.set_image_upload_budget(16);
+  system.set_image_upload_thread(false);
+  system.set_progressive_start(false);
   system.set_font_cache_size(8);
 
   auto& export_settings = *system.mutable_last_export_settings();
@@ -466,8 +481,26 @@ void validate_system(trance_pb::System& system)
   }
   system.mutable_eye_spacing()->set_eye_spacing(
       std::max(-1.f, std::min(1.f, system.eye_spacing().eye_spacing())));
-  system.set_image_cache_size(std::max(16u, system.image_cache_size()));
+  // Replaced by the memory budgets, which older system files won't have.
+  system.clear_image_cache_size();
+  if (!system.image_memory_budget()) {
+    system.set_image_memory_budget(2048);
+  }
+  if (!system.video_memory_budget()) {
+    system.set_video_memory_budget(1024);
+  }
+  if (!system.image_disk_cache_size()) {
+    system.set_image_disk_cache_size(4096);
+  }
+  if (!system.image_upload_budget()) {
+    system.set_image_upload_budget(16);
+  }
+  system.set_image_memory_budget(std::max(256u, system.image_memory_budget()));
+  system.set_video_memory_budget(std::max(128u, system.video_memory_budget()));
   system.set_animation_buffer_size(std::max(8u, system.animation_buffer_size()));
+  system.set_animation_decode_threads(std::min(64u, system.animation_decode_threads()));
+  system.set_image_decode_threads(std::min(64u, system.image_decode_threads()));
+  system.set_image_disk_cache_size(std::max(256u, system.image_disk_cache_size()));
   system.set_font_cache_size(std::max(2u, system.font_cache_size()));
 }
 
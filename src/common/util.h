@@ -1,10 +1,13 @@
 #ifndef TRANCE_SRC_COMMON_UTIL_H
 #define TRANCE_SRC_COMMON_UTIL_H
+#include <algorithm>
 #include <cstdint>
 #include <map>
 #include <random>
 #include <string>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 inline bool ext_is(const std::string& path, const std::string& ext)
@@ -43,70 +46,271 @@ inline bool random_chance()
   return random_chance(2);
 }
 
+// Returns the position and length of each line of the text, or each word if
+// split_words is set, leaving out empty ones. Text with none gives one empty
+// part.
+inline std::vector<std::pair<std::size_t, std::size_t>> split_text(const std::string& text,
+                                                                   bool split_words)
+{
+  std::vector<std::pair<std::size_t, std::size_t>> result;
+  auto of = split_words ? " \t\r\n" : "\r\n";
+  std::size_t p = 0;
+  while (p < text.size()) {
+    auto q = std::min(text.find_first_of(of, p), text.size());
+    if (q > p) {
+      result.emplace_back(p, q - p);
+    }
+    p = 1 + q;
+  }
+  if (result.empty()) {
+    result.emplace_back(0, 0);
+  }
+  return result;
+}
+
+// Stores each distinct string once, back to back in a single buffer, and
+// refers to them by ID. The empty string is always ID 0.
+class TextArena
+{
+public:
+  TextArena() : _ids{{std::string{}, 0}}, _offsets{0, 0}
+  {
+  }
+
+  // Returns the ID of the string, storing it if it's new.
+  uint32_t intern(const std::string& text)
+  {
+    auto it = _ids.emplace(text, uint32_t(_ids.size())).first;
+    if (it->second + 1 == _offsets.size()) {
+      _text += text;
+      _offsets.push_back(_text.size());
+    }
+    return it->second;
+  }
+
+  // Frees what's only needed for interning, once every string is in.
+  void finish()
+  {
+    std::unordered_map<std::string, uint32_t>{}.swap(_ids);
+    _text.shrink_to_fit();
+    _offsets.shrink_to_fit();
+  }
+
+  std::string get(uint32_t id) const
+  {
+    return _text.substr(_offsets[id], _offsets[id + 1] - _offsets[id]);
+  }
+
+private:
+  std::unordered_map<std::string, uint32_t> _ids;
+  std::string _text;
+  // Offset of each string by ID, and of the end.
+  std::vector<std::size_t> _offsets;
+};
+
 // Chooses randomly from elements. Elements start with 0 priority, which can
 // be increased or decreased; calling next() gets a random element among all
 // those with the highest priority.
+//
+// Only elements whose priority isn't 0 are stored, in a set for each priority,
+// so that a shuffler over the few members of a large collection stays small.
+// Elements left at 0 are found by trying random ones while at least half are
+// at 0, or through a Fenwick tree counting the stored ones when most are
+// stored. Each call takes at most logarithmic time, give or take the rebuild of
+// that tree once most elements become stored.
 class Shuffler
 {
 public:
   Shuffler(std::size_t size) : _size{size}
   {
-    _enabled_count[-1] = size;
-    for (std::size_t i = 0; i < size; ++i) {
-      _enabled.push_back(0);
-    }
   }
 
   void increase(std::size_t index)
   {
-    auto& v = _enabled[index];
-    if (!_enabled_count.count(v)) {
-      _enabled_count[v] = 0;
-    }
-    ++_enabled_count[v];
-    ++v;
+    set(index, priority(index) + 1);
   }
 
   void decrease(std::size_t index)
   {
-    auto& v = _enabled[index];
-    --v;
-    if (!_enabled_count.count(v)) {
-      _enabled_count[v] = _size;
-    }
-    --_enabled_count[v];
+    set(index, priority(index) - 1);
   }
 
   void modify(std::size_t index, int32_t amount)
   {
-    for (; amount > 0; --amount) {
-      increase(index);
-    }
-    for (; amount < 0; ++amount) {
-      decrease(index);
-    }
+    set(index, priority(index) + amount);
   }
 
   std::size_t next() const
   {
-    for (auto it = _enabled_count.rbegin(); it != _enabled_count.rend(); ++it) {
-      auto r = random(it->second);
-      std::size_t t = 0;
-      for (std::size_t i = 0; i < _size; ++i) {
-        t += _enabled[i] > it->first;
-        if (r < t) {
-          return i;
+    return next({});
+  }
+
+  // As next(), but passes over the elements in avoid unless all of those with
+  // the highest priority are in it. Takes time linear in the size of avoid, so
+  // that recently-chosen elements can be kept out without changing priorities.
+  std::size_t next(const std::vector<std::size_t>& avoid) const
+  {
+    std::vector<std::size_t> skipped;
+    if (!_levels.empty() && (_levels.rbegin()->first > 0 || _entries.size() == _size)) {
+      const auto& level = *_levels.rbegin();
+      for (auto index : avoid) {
+        auto it = _entries.find(index);
+        if (it != _entries.end() && it->second.priority == level.first) {
+          skipped.push_back(it->second.position);
         }
       }
+      sort_unique(skipped);
+      if (skipped.size() == level.second.size()) {
+        skipped.clear();
+      }
+      return level.second[skip_past(random(level.second.size() - skipped.size()), skipped)];
     }
-    return _size ? random(_size) : -1;
+    if (!_size) {
+      return -1;
+    }
+
+    auto defaults = _size - _entries.size();
+    for (auto index : avoid) {
+      if (index < _size && !_entries.count(index)) {
+        skipped.push_back(index);
+      }
+    }
+    sort_unique(skipped);
+    if (skipped.size() == defaults) {
+      skipped.clear();
+    }
+    if (_tree.empty()) {
+      // At least half are at 0, so this takes two tries at most on average
+      // when few are avoided.
+      while (true) {
+        auto index = random(_size);
+        if (!_entries.count(index) &&
+            !std::binary_search(skipped.begin(), skipped.end(), index)) {
+          return index;
+        }
+      }
+    }
+    // Skip by rank among the elements at 0, which keeps them in order.
+    for (auto& index : skipped) {
+      index -= stored_before(index);
+    }
+    return nth_default(skip_past(random(defaults - skipped.size()), skipped));
   }
 
 private:
+  struct Entry {
+    int32_t priority;
+    // Position in _levels[priority].
+    std::size_t position;
+  };
+
+  int32_t priority(std::size_t index) const
+  {
+    auto it = _entries.find(index);
+    return it == _entries.end() ? 0 : it->second.priority;
+  }
+
+  void set(std::size_t index, int32_t priority)
+  {
+    auto it = _entries.find(index);
+    if (it != _entries.end()) {
+      auto level = _levels.find(it->second.priority);
+      auto moved = level->second.back();
+      level->second[it->second.position] = moved;
+      _entries.find(moved)->second.position = it->second.position;
+      level->second.pop_back();
+      if (level->second.empty()) {
+        _levels.erase(level);
+      }
+      if (!priority) {
+        _entries.erase(it);
+        update_tree(index, -1);
+        return;
+      }
+    } else if (priority) {
+      it = _entries.emplace(index, Entry{}).first;
+      update_tree(index, 1);
+    } else {
+      return;
+    }
+    auto& level = _levels[priority];
+    it->second = {priority, level.size()};
+    level.push_back(index);
+  }
+
+  void update_tree(std::size_t index, int32_t delta)
+  {
+    if (_tree.empty() && 2 * _entries.size() > _size) {
+      _tree.assign(_size + 1, 0);
+      for (const auto& pair : _entries) {
+        _tree[pair.first + 1] = 1;
+      }
+      for (std::size_t i = 1; i <= _size; ++i) {
+        auto parent = i + (i & (0 - i));
+        if (parent <= _size) {
+          _tree[parent] += _tree[i];
+        }
+      }
+    } else if (!_tree.empty() && 4 * _entries.size() < _size) {
+      std::vector<uint32_t>{}.swap(_tree);
+    } else if (!_tree.empty()) {
+      for (auto i = index + 1; i <= _size; i += i & (0 - i)) {
+        _tree[i] += delta;
+      }
+    }
+  }
+
+  // Number of elements before index with priority other than 0; needs the tree.
+  std::size_t stored_before(std::size_t index) const
+  {
+    std::size_t count = 0;
+    for (auto i = index; i; i -= i & (0 - i)) {
+      count += _tree[i];
+    }
+    return count;
+  }
+
+  // The element at the given rank among those at 0; needs the tree. Walks down
+  // it to the longest prefix with no more than rank elements at 0, which the
+  // element is just after.
+  std::size_t nth_default(std::size_t rank) const
+  {
+    std::size_t step = 1;
+    while (2 * step <= _size) {
+      step *= 2;
+    }
+    std::size_t index = 0;
+    for (; step; step /= 2) {
+      if (index + step <= _size && step - _tree[index + step] <= rank) {
+        index += step;
+        rank -= step - _tree[index];
+      }
+    }
+    return index;
+  }
+
+  static void sort_unique(std::vector<std::size_t>& v)
+  {
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+  }
+
+  // Turns a rank among the elements not skipped into one among all of them,
+  // given the sorted ranks of those skipped.
+  static std::size_t skip_past(std::size_t rank, const std::vector<std::size_t>& skipped)
+  {
+    for (auto r : skipped) {
+      rank += r <= rank;
+    }
+    return rank;
+  }
+
   std::size_t _size;
-  // _enabled_count[n] == | k s.t. _enabled[k] > n |.
-  std::map<int32_t, std::size_t> _enabled_count;
-  std::vector<int32_t> _enabled;
+  std::unordered_map<std::size_t, Entry> _entries;
+  std::map<int32_t, std::vector<std::size_t>> _levels;
+  // Fenwick tree over all elements counting those in _entries, from 1. Only
+  // kept while many elements are stored.
+  std::vector<uint32_t> _tree;
 };
 
 #endif
\ No newline at end of file
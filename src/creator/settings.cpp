@@ -30,20 +30,58 @@ namespace
       "Turn on VSync to eliminate tearing. This can cause frame rate to "
       "stutter if the video card can't keep up.";
 
-  const std::string IMAGE_CACHE_SIZE_TOOLTIP =
-      "Number of images to load into memory at once. Increases variation, but "
-      "uses up both RAM and video memory. Images will be swapped in and out "
-      "of the cache periodically.";
+  const std::string IMAGE_MEMORY_BUDGET_TOOLTIP =
+      "Maximum RAM in megabytes used by images waiting to be sent to the video "
+      "card. Increases variation, but too large a value can run out of memory.";
+
+  const std::string VIDEO_MEMORY_BUDGET_TOOLTIP =
+      "Maximum video memory in megabytes used by images and animations. More "
+      "images are kept loaded at once when they're smaller. Images will be "
+      "swapped in and out periodically.";
 
   const std::string ANIMATION_BUFFER_SIZE_TOOLTIP =
       "Number of frames to buffer into memory for each loaded animation. Uses up "
       "both RAM and video memory.";
 
+  const std::string ANIMATION_DECODE_THREADS_TOOLTIP =
+      "Number of threads used to decode each animation. More threads keep "
+      "large animations playing smoothly on multi-core machines. Set to 0 to "
+      "share the CPU cores between the animations playing at once.";
+
+  const std::string ANIMATION_FRAME_PARALLEL_TOOLTIP =
+      "Decode several frames of an animation at once, where the video codec "
+      "supports it. Speeds up decoding of large animations on multi-core "
+      "machines.";
+
   const std::string FONT_CACHE_SIZE_TOOLTIP =
       "Number of fonts to load into memory at once. Increasing the font cache "
       "size prevents pauses when loading fonts, but uses up both RAM and video "
       "memory.";
 
+  const std::string IMAGE_DECODE_THREADS_TOOLTIP =
+      "Number of background threads used to load images. More threads make "
+      "theme changes faster on multi-core machines. Set to 0 to use one thread "
+      "per CPU core.";
+
+  const std::string IMAGE_DISK_CACHE_SIZE_TOOLTIP =
+      "Maximum disk space in megabytes used to keep already-loaded images, so "
+      "that they load much faster next time. The least recently used images "
+      "are removed when the cache is full.";
+
+  const std::string IMAGE_UPLOAD_BUDGET_TOOLTIP =
+      "Maximum amount of image data in megabytes sent to the video card in the "
+      "background each frame. Lower values make frame rate smoother on slower "
+      "video cards, but new images take longer to become available.";
+
+  const std::string IMAGE_UPLOAD_THREAD_TOOLTIP =
+      "Send images to the video card on a separate thread as soon as they're "
+      "loaded. This prevents stutter when themes change, but may not work "
+      "with all video card drivers.";
+
+  const std::string PROGRESSIVE_START_TOOLTIP =
+      "Start the session as soon as an image from each theme is loaded, and "
+      "load the rest while it plays. Starts much faster with large themes.";
+
   const std::string MONITOR_TOOLTIP = "Render fullscreen 2D to primary monitor.";
 
   const std::string OCULUS_TOOLTIP = "Render to the Oculus rift using LibOVR.";
@@ -84,9 +122,18 @@ SettingsFrame::SettingsFrame(CreatorFrame* parent, trance_pb::System& system)
   _openvr = new wxRadioButton{panel, wxID_ANY, "SteamVR"};
 
   _enable_vsync = new wxCheckBox{panel, wxID_ANY, "Enable VSync"};
-  _image_cache_size = new wxSpinCtrl{panel, wxID_ANY};
+  _image_upload_thread = new wxCheckBox{panel, wxID_ANY, "Upload images on a separate thread"};
+  _animation_frame_parallel =
+      new wxCheckBox{panel, wxID_ANY, "Decode animation frames in parallel"};
+  _progressive_start = new wxCheckBox{panel, wxID_ANY, "Start before all images are loaded"};
+  _image_memory_budget = new wxSpinCtrl{panel, wxID_ANY};
+  _video_memory_budget = new wxSpinCtrl{panel, wxID_ANY};
   _animation_buffer_size = new wxSpinCtrl{panel, wxID_ANY};
+  _animation_decode_threads = new wxSpinCtrl{panel, wxID_ANY};
   _font_cache_size = new wxSpinCtrl{panel, wxID_ANY};
+  _image_decode_threads = new wxSpinCtrl{panel, wxID_ANY};
+  _image_disk_cache_size = new wxSpinCtrl{panel, wxID_ANY};
+  _image_upload_budget = new wxSpinCtrl{panel, wxID_ANY};
   _draw_depth = new wxSlider{panel,
                              wxID_ANY,
                              f2v(_system.draw_depth().draw_depth()),
@@ -113,15 +160,36 @@ SettingsFrame::SettingsFrame(CreatorFrame* parent, trance_pb::System& system)
   }
   _enable_vsync->SetToolTip(VSYNC_TOOLTIP);
   _enable_vsync->SetValue(_system.enable_vsync());
-  _image_cache_size->SetToolTip(IMAGE_CACHE_SIZE_TOOLTIP);
-  _image_cache_size->SetRange(16, 1024);
-  _image_cache_size->SetValue(_system.image_cache_size());
+  _image_upload_thread->SetToolTip(IMAGE_UPLOAD_THREAD_TOOLTIP);
+  _image_upload_thread->SetValue(_system.image_upload_thread());
+  _animation_frame_parallel->SetToolTip(ANIMATION_FRAME_PARALLEL_TOOLTIP);
+  _animation_frame_parallel->SetValue(_system.animation_frame_parallel());
+  _progressive_start->SetToolTip(PROGRESSIVE_START_TOOLTIP);
+  _progressive_start->SetValue(_system.progressive_start());
+  _image_memory_budget->SetToolTip(IMAGE_MEMORY_BUDGET_TOOLTIP);
+  _image_memory_budget->SetRange(256, 65536);
+  _image_memory_budget->SetValue(_system.image_memory_budget());
+  _video_memory_budget->SetToolTip(VIDEO_MEMORY_BUDGET_TOOLTIP);
+  _video_memory_budget->SetRange(128, 65536);
+  _video_memory_budget->SetValue(_system.video_memory_budget());
   _animation_buffer_size->SetToolTip(ANIMATION_BUFFER_SIZE_TOOLTIP);
   _animation_buffer_size->SetRange(8, 512);
   _animation_buffer_size->SetValue(_system.animation_buffer_size());
+  _animation_decode_threads->SetToolTip(ANIMATION_DECODE_THREADS_TOOLTIP);
+  _animation_decode_threads->SetRange(0, 64);
+  _animation_decode_threads->SetValue(_system.animation_decode_threads());
   _font_cache_size->SetToolTip(FONT_CACHE_SIZE_TOOLTIP);
   _font_cache_size->SetRange(2, 256);
   _font_cache_size->SetValue(_system.font_cache_size());
+  _image_decode_threads->SetToolTip(IMAGE_DECODE_THREADS_TOOLTIP);
+  _image_decode_threads->SetRange(0, 64);
+  _image_decode_threads->SetValue(_system.image_decode_threads());
+  _image_disk_cache_size->SetToolTip(IMAGE_DISK_CACHE_SIZE_TOOLTIP);
+  _image_disk_cache_size->SetRange(256, 65536);
+  _image_disk_cache_size->SetValue(_system.image_disk_cache_size());
+  _image_upload_budget->SetToolTip(IMAGE_UPLOAD_BUDGET_TOOLTIP);
+  _image_upload_budget->SetRange(1, 1024);
+  _image_upload_budget->SetValue(_system.image_upload_budget());
   _draw_depth->SetToolTip(DRAW_DEPTH_TOOLTIP);
   _eye_spacing->SetToolTip(EYE_SPACING_TOOLTIP);
   _eye_spacing->SetRange(-1., 1.);
@@ -134,24 +202,47 @@ SettingsFrame::SettingsFrame(CreatorFrame* parent, trance_pb::System& system)
   top->Add(right, 1, wxALL | wxEXPAND, DEFAULT_BORDER);
 
   wxStaticText* label = nullptr;
-  label = new wxStaticText{panel, wxID_ANY, "Image cache size:"};
-  label->SetToolTip(IMAGE_CACHE_SIZE_TOOLTIP);
+  label = new wxStaticText{panel, wxID_ANY, "Image memory (MB):"};
+  label->SetToolTip(IMAGE_MEMORY_BUDGET_TOOLTIP);
+  left->Add(label, 0, wxALL, DEFAULT_BORDER);
+  left->Add(_image_memory_budget, 0, wxALL | wxEXPAND, DEFAULT_BORDER);
+  label = new wxStaticText{panel, wxID_ANY, "Video memory (MB):"};
+  label->SetToolTip(VIDEO_MEMORY_BUDGET_TOOLTIP);
   left->Add(label, 0, wxALL, DEFAULT_BORDER);
-  left->Add(_image_cache_size, 0, wxALL | wxEXPAND, DEFAULT_BORDER);
+  left->Add(_video_memory_budget, 0, wxALL | wxEXPAND, DEFAULT_BORDER);
   label = new wxStaticText{panel, wxID_ANY, "Animation buffer size:"};
   label->SetToolTip(ANIMATION_BUFFER_SIZE_TOOLTIP);
   left->Add(label, 0, wxALL, DEFAULT_BORDER);
   left->Add(_animation_buffer_size, 0, wxALL | wxEXPAND, DEFAULT_BORDER);
+  label = new wxStaticText{panel, wxID_ANY, "Animation decode threads:"};
+  label->SetToolTip(ANIMATION_DECODE_THREADS_TOOLTIP);
+  left->Add(label, 0, wxALL, DEFAULT_BORDER);
+  left->Add(_animation_decode_threads, 0, wxALL | wxEXPAND, DEFAULT_BORDER);
   label = new wxStaticText{panel, wxID_ANY, "Font cache size:"};
-  label->SetToolTip(IMAGE_CACHE_SIZE_TOOLTIP);
+  label->SetToolTip(FONT_CACHE_SIZE_TOOLTIP);
   left->Add(label, 0, wxALL, DEFAULT_BORDER);
   left->Add(_font_cache_size, 0, wxALL | wxEXPAND, DEFAULT_BORDER);
+  label = new wxStaticText{panel, wxID_ANY, "Image decode threads:"};
+  label->SetToolTip(IMAGE_DECODE_THREADS_TOOLTIP);
+  left->Add(label, 0, wxALL, DEFAULT_BORDER);
+  left->Add(_image_decode_threads, 0, wxALL | wxEXPAND, DEFAULT_BORDER);
+  label = new wxStaticText{panel, wxID_ANY, "Image disk cache size (MB):"};
+  label->SetToolTip(IMAGE_DISK_CACHE_SIZE_TOOLTIP);
+  left->Add(label, 0, wxALL, DEFAULT_BORDER);
+  left->Add(_image_disk_cache_size, 0, wxALL | wxEXPAND, DEFAULT_BORDER);
+  label = new wxStaticText{panel, wxID_ANY, "Image upload budget (MB per frame):"};
+  label->SetToolTip(IMAGE_UPLOAD_BUDGET_TOOLTIP);
+  left->Add(label, 0, wxALL, DEFAULT_BORDER);
+  left->Add(_image_upload_budget, 0, wxALL | wxEXPAND, DEFAULT_BORDER);
   label = new wxStaticText{panel, wxID_ANY, "Rendering mode:"};
   right->Add(right_mode, 0, wxALL | wxEXPAND, DEFAULT_BORDER);
   right_mode->Add(_monitor, 1, wxALL, DEFAULT_BORDER);
   right_mode->Add(_oculus, 1, wxALL, DEFAULT_BORDER);
   right_mode->Add(_openvr, 1, wxALL, DEFAULT_BORDER);
   right->Add(_enable_vsync, 0, wxALL, DEFAULT_BORDER);
+  right->Add(_image_upload_thread, 0, wxALL, DEFAULT_BORDER);
+  right->Add(_animation_frame_parallel, 0, wxALL, DEFAULT_BORDER);
+  right->Add(_progressive_start, 0, wxALL, DEFAULT_BORDER);
   label = new wxStaticText{panel, wxID_ANY, "Draw depth:"};
   label->SetToolTip(DRAW_DEPTH_TOOLTIP);
   right->Add(label, 0, wxALL, DEFAULT_BORDER);
@@ -207,9 +298,17 @@ void SettingsFrame::Apply()
                                            : _oculus->GetValue() ? trance_pb::System::OCULUS
                                                                  : trance_pb::System::MONITOR);
   _system.set_enable_vsync(_enable_vsync->GetValue());
-  _system.set_image_cache_size(_image_cache_size->GetValue());
+  _system.set_image_upload_thread(_image_upload_thread->GetValue());
+  _system.set_animation_frame_parallel(_animation_frame_parallel->GetValue());
+  _system.set_progressive_start(_progressive_start->GetValue());
+  _system.set_image_memory_budget(_image_memory_budget->GetValue());
+  _system.set_video_memory_budget(_video_memory_budget->GetValue());
   _system.set_animation_buffer_size(_animation_buffer_size->GetValue());
+  _system.set_animation_decode_threads(_animation_decode_threads->GetValue());
   _system.set_font_cache_size(_font_cache_size->GetValue());
+  _system.set_image_decode_threads(_image_decode_threads->GetValue());
+  _system.set_image_disk_cache_size(_image_disk_cache_size->GetValue());
+  _system.set_image_upload_budget(_image_upload_budget->GetValue());
   _system.mutable_draw_depth()->set_draw_depth(v2f(_draw_depth->GetValue()));
   _system.mutable_eye_spacing()->set_eye_spacing(static_cast<float>(_eye_spacing->GetValue()));
   _parent->SaveSystem(true);
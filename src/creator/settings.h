@@ -34,9 +34,17 @@ private:
   wxRadioButton* _oculus;
   wxRadioButton* _openvr;
   wxCheckBox* _enable_vsync;
-  wxSpinCtrl* _image_cache_size;
+  wxCheckBox* _image_upload_thread;
+  wxCheckBox* _animation_frame_parallel;
+  wxCheckBox* _progressive_start;
+  wxSpinCtrl* _image_memory_budget;
+  wxSpinCtrl* _video_memory_budget;
   wxSpinCtrl* _animation_buffer_size;
+  wxSpinCtrl* _animation_decode_threads;
   wxSpinCtrl* _font_cache_size;
+  wxSpinCtrl* _image_decode_threads;
+  wxSpinCtrl* _image_disk_cache_size;
+  wxSpinCtrl* _image_upload_budget;
   wxSlider* _draw_depth;
   wxSpinCtrlDouble* _eye_spacing;
   wxStaticText* _eye_spacing_label;
@@ -1,5 +1,6 @@
 #include <creator/theme.h>
 #include <common/common.h>
+#include <common/media/colour.h>
 #include <common/media/image.h>
 #include <common/media/streamer.h>
 #include <common/session.h>
@@ -236,17 +237,63 @@ public:
 private:
   std::unique_ptr<wxImage> ConvertImage(const Image& image)
   {
-    auto ptr = image.get_sf_image();
-    if (!ptr) {
+    if (image.format() == PixelFormat::I420) {
+      return ConvertI420Image(image);
+    }
+    if (image.format() == PixelFormat::INDEXED) {
+      return ConvertIndexedImage(image);
+    }
+    auto pixels = image.get_pixels();
+    if (!pixels) {
       return {};
     }
-    auto sf_image = *ptr;
     std::unique_ptr<wxImage> wx =
-        std::make_unique<wxImage>((int) sf_image.getSize().x, (int) sf_image.getSize().y);
-    for (unsigned y = 0; y < sf_image.getSize().y; ++y) {
-      for (unsigned x = 0; x < sf_image.getSize().x; ++x) {
-        const auto& c = sf_image.getPixel(x, y);
-        wx->SetRGB(x, y, c.r, c.g, c.b);
+        std::make_unique<wxImage>((int) image.width(), (int) image.height());
+    auto data = wx->GetData();
+    for (std::size_t i = 0; i < std::size_t(image.width()) * image.height(); ++i) {
+      data[3 * i] = pixels[4 * i];
+      data[3 * i + 1] = pixels[4 * i + 1];
+      data[3 * i + 2] = pixels[4 * i + 2];
+    }
+    return wx;
+  }
+
+  // Video frames are kept in YUV, which trance converts to RGB as it draws them.
+  std::unique_ptr<wxImage> ConvertI420Image(const Image& image)
+  {
+    auto pixels = image.get_pixels();
+    if (!pixels) {
+      return {};
+    }
+    auto w = image.width();
+    auto h = image.height();
+    auto row = image.texture_width();
+    auto chroma = pixels + h * row;
+    std::unique_ptr<wxImage> wx = std::make_unique<wxImage>((int) w, (int) h);
+    i420_to_rgb(image.colour_space(), w, h, pixels, row, chroma, row, chroma + row / 2, row,
+                wx->GetData());
+    return wx;
+  }
+
+  // GIF frames are kept as palette indices, with the palette after them.
+  std::unique_ptr<wxImage> ConvertIndexedImage(const Image& image)
+  {
+    auto pixels = image.get_pixels();
+    if (!pixels) {
+      return {};
+    }
+    auto w = image.width();
+    auto h = image.height();
+    auto row = 4 * image.texture_width();
+    auto palette = pixels + h * row;
+    std::unique_ptr<wxImage> wx = std::make_unique<wxImage>((int) w, (int) h);
+    auto data = wx->GetData();
+    for (uint32_t y = 0; y < h; ++y) {
+      for (uint32_t x = 0; x < w; ++x) {
+        auto colour = palette + 4 * pixels[x + y * row];
+        *data++ = colour[0];
+        *data++ = colour[1];
+        *data++ = colour[2];
       }
     }
     return wx;
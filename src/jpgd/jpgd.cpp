@@ -26,6 +26,21 @@
 #define JPGD_TRUE (1)
 #define JPGD_FALSE (0)
 
+// SSE2 and AVX2 kernels for the IDCT and colour conversion are used on x86 when CPUID reports support.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define JPGD_USE_SIMD 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define JPGD_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define JPGD_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define JPGD_USE_SIMD 0
+#endif
+
 #define JPGD_MAX(a,b) (((a)>(b)) ? (a) : (b))
 #define JPGD_MIN(a,b) (((a)<(b)) ? (a) : (b))
 
@@ -227,6 +242,374 @@ struct Col<1>
   }
 };
 
+#if JPGD_USE_SIMD
+// SSE2/AVX2 kernels, selected at runtime. Each one produces exactly the same output as the
+// scalar code it replaces.
+enum jpgd_simd_level { JPGD_SIMD_NONE, JPGD_SIMD_SSE2, JPGD_SIMD_AVX2 };
+
+static void jpgd_cpuid(int info[4], int leaf)
+{
+#ifdef _MSC_VER
+  __cpuidex(info, leaf, 0);
+#else
+  __cpuid_count(leaf, 0, info[0], info[1], info[2], info[3]);
+#endif
+}
+
+static jpgd_simd_level detect_simd_level()
+{
+  int info[4];
+  jpgd_cpuid(info, 0);
+  const int max_leaf = info[0];
+
+  jpgd_cpuid(info, 1);
+  if (!(info[3] & (1 << 26)))
+    return JPGD_SIMD_NONE;
+
+  // AVX2 also needs the OS to save the upper halves of the YMM registers.
+  const bool osxsave = (info[2] & (1 << 27)) && (info[2] & (1 << 28));
+  if (!osxsave || max_leaf < 7)
+    return JPGD_SIMD_SSE2;
+
+#ifdef _MSC_VER
+  const unsigned long long xcr0 = _xgetbv(0);
+#else
+  unsigned int xcr0_lo, xcr0_hi;
+  __asm__ ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+  const unsigned long long xcr0 = xcr0_lo;
+#endif
+  if ((xcr0 & 6) != 6)
+    return JPGD_SIMD_SSE2;
+
+  jpgd_cpuid(info, 7);
+  return (info[1] & (1 << 5)) ? JPGD_SIMD_AVX2 : JPGD_SIMD_SSE2;
+}
+
+static const jpgd_simd_level g_detected_simd_level = detect_simd_level();
+static jpgd_simd_level g_simd_level = g_detected_simd_level;
+
+// Two int16 constants packed into 32 bits, to multiply an interleaved pair of inputs by with madd.
+static inline int pack_pair(int a, int b)
+{
+  return (int)((a & 0xFFFF) | ((uint)b << 16));
+}
+
+static inline __m128i madd_pair(int a, int b)
+{
+  return _mm_set1_epi32(pack_pair(a, b));
+}
+
+// The 1D IDCT of Row<8>::idct() and Col<8>::idct(), applied to four transforms at once. Each input
+// interleaves two coefficients (0 and 4, 2 and 6, 7 and 5, 3 and 1), and the multiplications are
+// regrouped so that every one is a single _mm_madd_epi16. Integer arithmetic makes this exact.
+static inline void idct_1d_sse2(__m128i c04, __m128i c26, __m128i c75, __m128i c31, __m128i* pOut)
+{
+  const __m128i tmp0 = _mm_madd_epi16(c04, madd_pair(1 << CONST_BITS, 1 << CONST_BITS));
+  const __m128i tmp1 = _mm_madd_epi16(c04, madd_pair(1 << CONST_BITS, -(1 << CONST_BITS)));
+  const __m128i tmp2 = _mm_madd_epi16(c26, madd_pair(FIX_0_541196100, FIX_0_541196100 - FIX_1_847759065));
+  const __m128i tmp3 = _mm_madd_epi16(c26, madd_pair(FIX_0_541196100 + FIX_0_765366865, FIX_0_541196100));
+
+  const __m128i tmp10 = _mm_add_epi32(tmp0, tmp3), tmp13 = _mm_sub_epi32(tmp0, tmp3);
+  const __m128i tmp11 = _mm_add_epi32(tmp1, tmp2), tmp12 = _mm_sub_epi32(tmp1, tmp2);
+
+  const __m128i btmp0 = _mm_add_epi32(
+    _mm_madd_epi16(c75, madd_pair(FIX_0_298631336 - FIX_0_899976223 + FIX_1_175875602 - FIX_1_961570560, FIX_1_175875602)),
+    _mm_madd_epi16(c31, madd_pair(FIX_1_175875602 - FIX_1_961570560, FIX_1_175875602 - FIX_0_899976223)));
+  const __m128i btmp1 = _mm_add_epi32(
+    _mm_madd_epi16(c75, madd_pair(FIX_1_175875602, FIX_2_053119869 - FIX_2_562915447 + FIX_1_175875602 - FIX_0_390180644)),
+    _mm_madd_epi16(c31, madd_pair(FIX_1_175875602 - FIX_2_562915447, FIX_1_175875602 - FIX_0_390180644)));
+  const __m128i btmp2 = _mm_add_epi32(
+    _mm_madd_epi16(c75, madd_pair(FIX_1_175875602 - FIX_1_961570560, FIX_1_175875602 - FIX_2_562915447)),
+    _mm_madd_epi16(c31, madd_pair(FIX_3_072711026 - FIX_2_562915447 + FIX_1_175875602 - FIX_1_961570560, FIX_1_175875602)));
+  const __m128i btmp3 = _mm_add_epi32(
+    _mm_madd_epi16(c75, madd_pair(FIX_1_175875602 - FIX_0_899976223, FIX_1_175875602 - FIX_0_390180644)),
+    _mm_madd_epi16(c31, madd_pair(FIX_1_175875602, FIX_1_501321110 - FIX_0_899976223 + FIX_1_175875602 - FIX_0_390180644)));
+
+  pOut[0] = _mm_add_epi32(tmp10, btmp3);
+  pOut[7] = _mm_sub_epi32(tmp10, btmp3);
+  pOut[1] = _mm_add_epi32(tmp11, btmp2);
+  pOut[6] = _mm_sub_epi32(tmp11, btmp2);
+  pOut[2] = _mm_add_epi32(tmp12, btmp1);
+  pOut[5] = _mm_sub_epi32(tmp12, btmp1);
+  pOut[3] = _mm_add_epi32(tmp13, btmp0);
+  pOut[4] = _mm_sub_epi32(tmp13, btmp0);
+}
+
+// Runs the 1D IDCT down the columns of an 8x8 int16 matrix held one row per register, then
+// rounds off the given number of bits (adding bias first) and packs the result back to int16.
+static inline void idct_pass_sse2(__m128i* pRows, int shift, int bias)
+{
+  __m128i lo[8], hi[8];
+  idct_1d_sse2(_mm_unpacklo_epi16(pRows[0], pRows[4]), _mm_unpacklo_epi16(pRows[2], pRows[6]),
+               _mm_unpacklo_epi16(pRows[7], pRows[5]), _mm_unpacklo_epi16(pRows[3], pRows[1]), lo);
+  idct_1d_sse2(_mm_unpackhi_epi16(pRows[0], pRows[4]), _mm_unpackhi_epi16(pRows[2], pRows[6]),
+               _mm_unpackhi_epi16(pRows[7], pRows[5]), _mm_unpackhi_epi16(pRows[3], pRows[1]), hi);
+
+  const __m128i round = _mm_set1_epi32(bias + (SCALEDONE << (shift - 1)));
+  for (int i = 0; i < 8; i++)
+  {
+    pRows[i] = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(lo[i], round), shift),
+                               _mm_srai_epi32(_mm_add_epi32(hi[i], round), shift));
+  }
+}
+
+static inline void transpose_8x8_sse2(__m128i* r)
+{
+  const __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]), a1 = _mm_unpackhi_epi16(r[0], r[1]);
+  const __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]), a3 = _mm_unpackhi_epi16(r[2], r[3]);
+  const __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]), a5 = _mm_unpackhi_epi16(r[4], r[5]);
+  const __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]), a7 = _mm_unpackhi_epi16(r[6], r[7]);
+
+  const __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+  const __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+  const __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+  const __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+
+  r[0] = _mm_unpacklo_epi64(b0, b4); r[1] = _mm_unpackhi_epi64(b0, b4);
+  r[2] = _mm_unpacklo_epi64(b1, b5); r[3] = _mm_unpackhi_epi64(b1, b5);
+  r[4] = _mm_unpacklo_epi64(b2, b6); r[5] = _mm_unpackhi_epi64(b2, b6);
+  r[6] = _mm_unpacklo_epi64(b3, b7); r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+// Full 8x8 IDCT. If only_4x4 is set, only the top-left 4x4 coefficients are read, as in idct_4x4().
+// Intermediate values are held as int16, which can't overflow while every coefficient is within
+// +/-1095 (the row pass multiplies by at most 61213 before shifting down 11 bits). Returns false
+// without writing anything for blocks outside that range, which are left to the scalar code.
+static bool idct_sse2(const jpgd_block_t* pSrc_ptr, uint8* pDst_ptr, bool only_4x4)
+{
+  __m128i r[8];
+  if (only_4x4)
+  {
+    for (int i = 0; i < 4; i++)
+    {
+      r[i] = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pSrc_ptr + i * 8));
+      r[i + 4] = _mm_setzero_si128();
+    }
+  }
+  else
+  {
+    for (int i = 0; i < 8; i++)
+      r[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc_ptr + i * 8));
+  }
+
+  const __m128i limit = _mm_set1_epi16(1095);
+  __m128i out_of_range = _mm_setzero_si128();
+  for (int i = 0; i < 8; i++)
+  {
+    out_of_range = _mm_or_si128(out_of_range, _mm_cmpgt_epi16(r[i], limit));
+    out_of_range = _mm_or_si128(out_of_range, _mm_cmplt_epi16(r[i], _mm_sub_epi16(_mm_setzero_si128(), limit)));
+  }
+  if (_mm_movemask_epi8(out_of_range))
+    return false;
+
+  // Rows, then columns, rounding as the scalar passes do.
+  transpose_8x8_sse2(r);
+  idct_pass_sse2(r, CONST_BITS-PASS1_BITS, 0);
+  transpose_8x8_sse2(r);
+  idct_pass_sse2(r, CONST_BITS+PASS1_BITS+3, 128 << (CONST_BITS+PASS1_BITS+3));
+
+  for (int i = 0; i < 8; i += 2)
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pDst_ptr + i * 8), _mm_packus_epi16(r[i], r[i + 1]));
+  return true;
+}
+
+// YCbCr -> RGB terms equal to create_look_ups()'s tables. Each table constant is split into a
+// multiple of 1 << SCALEBITS, applied as a plain add, plus a remainder that fits in an int16.
+#define JPGD_CR_R   (91881 - 65536)
+#define JPGD_CR_G   (-46802 + 65536)
+#define JPGD_CB_G   (-22554)
+#define JPGD_CB_B   (116130 - 131072)
+
+static inline __m128i ycc_term_sse2(__m128i crcb_lo, __m128i crcb_hi, __m128i k)
+{
+  const __m128i half = _mm_set1_epi32(1 << 15);
+  return _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(crcb_lo, k), half), 16),
+                         _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(crcb_hi, k), half), 16));
+}
+
+// Converts 8 pixels, given in the low halves of y8, cb8 and cr8, to 32 bytes of RGBA.
+static inline void ycc_to_rgba_sse2(__m128i y8, __m128i cb8, __m128i cr8, uint8* d)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bias = _mm_set1_epi16(128);
+  const __m128i y = _mm_unpacklo_epi8(y8, zero);
+  const __m128i cb = _mm_sub_epi16(_mm_unpacklo_epi8(cb8, zero), bias);
+  const __m128i cr = _mm_sub_epi16(_mm_unpacklo_epi8(cr8, zero), bias);
+  const __m128i crcb_lo = _mm_unpacklo_epi16(cr, cb), crcb_hi = _mm_unpackhi_epi16(cr, cb);
+
+  const __m128i r = _mm_add_epi16(_mm_add_epi16(y, cr), ycc_term_sse2(crcb_lo, crcb_hi, madd_pair(JPGD_CR_R, 0)));
+  const __m128i g = _mm_add_epi16(_mm_sub_epi16(y, cr), ycc_term_sse2(crcb_lo, crcb_hi, madd_pair(JPGD_CR_G, JPGD_CB_G)));
+  const __m128i b = _mm_add_epi16(_mm_add_epi16(y, _mm_add_epi16(cb, cb)), ycc_term_sse2(crcb_lo, crcb_hi, madd_pair(0, JPGD_CB_B)));
+
+  const __m128i rg = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_packus_epi16(g, g));
+  const __m128i ba = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_set1_epi8(-1));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(d), _mm_unpacklo_epi16(rg, ba));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(d + 16), _mm_unpackhi_epi16(rg, ba));
+}
+
+static inline __m128i load8(const uint8* p)
+{
+  return _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+}
+
+// Loads 4 chroma samples and duplicates each one horizontally.
+static inline __m128i load4_dup(const uint8* p)
+{
+  int v;
+  memcpy(&v, p, sizeof(v));
+  const __m128i c = _mm_cvtsi32_si128(v);
+  return _mm_unpacklo_epi8(c, c);
+}
+
+JPGD_TARGET_AVX2 static inline __m256i ycc_term_avx2(__m256i crcb_lo, __m256i crcb_hi, __m256i k)
+{
+  const __m256i half = _mm256_set1_epi32(1 << 15);
+  return _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(crcb_lo, k), half), 16),
+                            _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(crcb_hi, k), half), 16));
+}
+
+// Converts 16 pixels to 64 bytes of RGBA.
+JPGD_TARGET_AVX2 static inline void ycc_to_rgba_avx2(__m128i y8, __m128i cb8, __m128i cr8, uint8* d)
+{
+  const __m256i bias = _mm256_set1_epi16(128);
+  const __m256i y = _mm256_cvtepu8_epi16(y8);
+  const __m256i cb = _mm256_sub_epi16(_mm256_cvtepu8_epi16(cb8), bias);
+  const __m256i cr = _mm256_sub_epi16(_mm256_cvtepu8_epi16(cr8), bias);
+  // The in-lane unpacks and packs cancel out, so r, g and b stay in pixel order.
+  const __m256i crcb_lo = _mm256_unpacklo_epi16(cr, cb), crcb_hi = _mm256_unpackhi_epi16(cr, cb);
+
+  const __m256i r = _mm256_add_epi16(_mm256_add_epi16(y, cr),
+    ycc_term_avx2(crcb_lo, crcb_hi, _mm256_set1_epi32(pack_pair(JPGD_CR_R, 0))));
+  const __m256i g = _mm256_add_epi16(_mm256_sub_epi16(y, cr),
+    ycc_term_avx2(crcb_lo, crcb_hi, _mm256_set1_epi32(pack_pair(JPGD_CR_G, JPGD_CB_G))));
+  const __m256i b = _mm256_add_epi16(_mm256_add_epi16(y, _mm256_add_epi16(cb, cb)),
+    ycc_term_avx2(crcb_lo, crcb_hi, _mm256_set1_epi32(pack_pair(0, JPGD_CB_B))));
+
+  // Per lane: rb = r0-7 b0-7, ga = g0-7 a0-7; interleaving gives pixels 0-3 and 4-7 of each lane.
+  const __m256i rb = _mm256_packus_epi16(r, b);
+  const __m256i ga = _mm256_packus_epi16(g, _mm256_set1_epi16(255));
+  const __m256i rg = _mm256_unpacklo_epi8(rb, ga), ba = _mm256_unpackhi_epi8(rb, ga);
+  const __m256i p0 = _mm256_unpacklo_epi16(rg, ba), p1 = _mm256_unpackhi_epi16(rg, ba);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(d), _mm256_permute2x128_si256(p0, p1, 0x20));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(d + 32), _mm256_permute2x128_si256(p0, p1, 0x31));
+}
+
+static inline __m128i load8x2(const uint8* p0, const uint8* p1)
+{
+  return _mm_unpacklo_epi64(load8(p0), load8(p1));
+}
+
+static void h1v1_convert_sse2(uint8* d, const uint8* s, int mcus)
+{
+  for (int i = mcus; i > 0; i--)
+  {
+    ycc_to_rgba_sse2(load8(s), load8(s + 64), load8(s + 128), d);
+    d += 32;
+    s += 64*3;
+  }
+}
+
+static void h2v1_convert_sse2(uint8* d, const uint8* y, const uint8* c, int mcus)
+{
+  for (int i = mcus; i > 0; i--)
+  {
+    ycc_to_rgba_sse2(load8(y), load4_dup(c), load4_dup(c + 64), d);
+    ycc_to_rgba_sse2(load8(y + 64), load4_dup(c + 4), load4_dup(c + 68), d + 32);
+    d += 64;
+    y += 64*4;
+    c += 64*4;
+  }
+}
+
+JPGD_TARGET_AVX2 static void h2v1_convert_avx2(uint8* d, const uint8* y, const uint8* c, int mcus)
+{
+  for (int i = mcus; i > 0; i--)
+  {
+    const __m128i cb = load8(c), cr = load8(c + 64);
+    ycc_to_rgba_avx2(load8x2(y, y + 64), _mm_unpacklo_epi8(cb, cb), _mm_unpacklo_epi8(cr, cr), d);
+    d += 64;
+    y += 64*4;
+    c += 64*4;
+  }
+}
+
+static void h1v2_convert_sse2(uint8* d0, uint8* d1, const uint8* y, const uint8* c, int mcus)
+{
+  for (int i = mcus; i > 0; i--)
+  {
+    const __m128i cb = load8(c), cr = load8(c + 64);
+    ycc_to_rgba_sse2(load8(y), cb, cr, d0);
+    ycc_to_rgba_sse2(load8(y + 8), cb, cr, d1);
+    d0 += 32;
+    d1 += 32;
+    y += 64*4;
+    c += 64*4;
+  }
+}
+
+static void h2v2_convert_sse2(uint8* d0, uint8* d1, const uint8* y, const uint8* c, int mcus)
+{
+  for (int i = mcus; i > 0; i--)
+  {
+    for (int l = 0; l < 2; l++)
+    {
+      const __m128i cb = load4_dup(c + l * 4), cr = load4_dup(c + 64 + l * 4);
+      ycc_to_rgba_sse2(load8(y + l * 64), cb, cr, d0 + l * 32);
+      ycc_to_rgba_sse2(load8(y + l * 64 + 8), cb, cr, d1 + l * 32);
+    }
+    d0 += 64;
+    d1 += 64;
+    y += 64*6;
+    c += 64*6;
+  }
+}
+
+JPGD_TARGET_AVX2 static void h2v2_convert_avx2(uint8* d0, uint8* d1, const uint8* y, const uint8* c, int mcus)
+{
+  for (int i = mcus; i > 0; i--)
+  {
+    __m128i cb = load8(c), cr = load8(c + 64);
+    cb = _mm_unpacklo_epi8(cb, cb);
+    cr = _mm_unpacklo_epi8(cr, cr);
+    ycc_to_rgba_avx2(load8x2(y, y + 64), cb, cr, d0);
+    ycc_to_rgba_avx2(load8x2(y + 8, y + 72), cb, cr, d1);
+    d0 += 64;
+    d1 += 64;
+    y += 64*6;
+    c += 64*6;
+  }
+}
+
+// blocks_per_row is the number of 8-pixel Y blocks across each MCU. Cb and Cr follow Y at
+// multiples of chroma_ofs.
+static void expanded_convert_sse2(uint8* d, const uint8* py, int mcus, int blocks_per_row, int chroma_ofs, int mcu_size)
+{
+  for (int i = mcus; i > 0; i--)
+  {
+    for (int k = 0; k < blocks_per_row; k++)
+    {
+      const uint8* p = py + k * 64;
+      ycc_to_rgba_sse2(load8(p), load8(p + chroma_ofs), load8(p + chroma_ofs * 2), d);
+      d += 32;
+    }
+    py += mcu_size;
+  }
+}
+
+JPGD_TARGET_AVX2 static void expanded_convert_avx2(uint8* d, const uint8* py, int mcus, int chroma_ofs, int mcu_size)
+{
+  // Two Y blocks per MCU row.
+  for (int i = mcus; i > 0; i--)
+  {
+    const uint8* pcb = py + chroma_ofs;
+    const uint8* pcr = py + chroma_ofs * 2;
+    ycc_to_rgba_avx2(load8x2(py, py + 64), load8x2(pcb, pcb + 64), load8x2(pcr, pcr + 64), d);
+    d += 64;
+    py += mcu_size;
+  }
+}
+#endif // JPGD_USE_SIMD
+
 static const uint8 s_idct_row_table[] =
 {
   1,0,0,0,0,0,0,0, 2,0,0,0,0,0,0,0, 2,1,0,0,0,0,0,0, 2,1,1,0,0,0,0,0, 2,2,1,0,0,0,0,0, 3,2,1,0,0,0,0,0, 4,2,1,0,0,0,0,0, 4,3,1,0,0,0,0,0,
@@ -262,6 +645,11 @@ void idct(const jpgd_block_t* pSrc_ptr, uint8* pDst_ptr, int block_max_zag)
     return;
   }
 
+#if JPGD_USE_SIMD
+  if (g_simd_level >= JPGD_SIMD_SSE2 && idct_sse2(pSrc_ptr, pDst_ptr, false))
+    return;
+#endif
+
   int temp[64];
 
   const jpgd_block_t* pSrc = pSrc_ptr;
@@ -312,6 +700,11 @@ void idct(const jpgd_block_t* pSrc_ptr, uint8* pDst_ptr, int block_max_zag)
 
 void idct_4x4(const jpgd_block_t* pSrc_ptr, uint8* pDst_ptr)
 {
+#if JPGD_USE_SIMD
+  if (g_simd_level >= JPGD_SIMD_SSE2 && idct_sse2(pSrc_ptr, pDst_ptr, true))
+    return;
+#endif
+
   int temp[64];
   int* pTemp = temp;
   const jpgd_block_t* pSrc = pSrc_ptr;
@@ -332,6 +725,104 @@ void idct_4x4(const jpgd_block_t* pSrc_ptr, uint8* pDst_ptr)
   }
 }
 
+// Fixed-point C(u) * cos((2x + 1) * u * PI / 16) averaged over each group of 8/N adjacent x, for
+// the reduced-size IDCTs below. Indexed by [x * 8 + u] and scaled by 1 << CONST_BITS. Every
+// coefficient is used, so the result is exactly the full 8x8 IDCT output box-filtered down by 8/N
+// (as libjpeg's reduced IDCTs approximate it), not just the low frequencies.
+static const int s_idct_scaled_1[1 * 8] =
+{
+  5793,     0,     0,     0,     0,     0,     0,     0,
+};
+
+static const int s_idct_scaled_2[2 * 8] =
+{
+  5793,  5249,     0, -1843,     0,  1232,     0, -1044,
+  5793, -5249,     0,  1843,     0, -1232,     0,  1044,
+};
+
+static const int s_idct_scaled_4[4 * 8] =
+{
+  5793,  7423,  5352,  2607,     0, -1742, -2217, -1477,
+  5793,  3075, -5352, -6293,     0,  4205,  2217,  -612,
+  5793, -3075, -5352,  6293,     0, -4205,  2217,   612,
+  5793, -7423,  5352, -2607,     0,  1742, -2217,  1477,
+};
+
+static const int s_idct_scaled_8[8 * 8] =
+{
+  5793,  8035,  7568,  6811,  5793,  4551,  3135,  1598,
+  5793,  6811,  3135, -1598, -5793, -8035, -7568, -4551,
+  5793,  4551, -3135, -8035, -5793,  1598,  7568,  6811,
+  5793,  1598, -7568, -4551,  5793,  6811, -3135, -8035,
+  5793, -1598, -7568,  4551,  5793, -6811, -3135,  8035,
+  5793, -4551, -3135,  8035, -5793, -1598,  7568, -6811,
+  5793, -6811,  3135,  1598, -5793,  8035, -7568,  4551,
+  5793, -8035,  7568, -6811,  5793, -4551,  3135, -1598,
+};
+
+static const int* const s_idct_scaled[4] = { s_idct_scaled_8, s_idct_scaled_4, s_idct_scaled_2, s_idct_scaled_1 };
+
+// IDCT to (8 >> h_shift) x (8 >> v_shift) pixels, for decoding at 1/2, 1/4 or 1/8 scale. The
+// shifts differ for subsampled chroma, which is decoded at twice the scale of luma in each
+// subsampled direction so that it needs no upsampling. Output rows are still 8 bytes apart so that
+// the sample buffer layout is the same as for full-size decoding.
+void idct_scaled(const jpgd_block_t* pSrc_ptr, uint8* pDst_ptr, int block_max_zag, int h_shift, int v_shift)
+{
+  JPGD_ASSERT(block_max_zag >= 1);
+  JPGD_ASSERT(block_max_zag <= 64);
+  JPGD_ASSERT(h_shift >= 0 && h_shift <= 3 && v_shift >= 0 && v_shift <= 3);
+
+  if ((!h_shift) && (!v_shift))
+  {
+    idct(pSrc_ptr, pDst_ptr, block_max_zag);
+    return;
+  }
+
+  const int w = 8 >> h_shift, h = 8 >> v_shift;
+
+  if (block_max_zag <= 1)
+  {
+    // Only the DC coefficient contributes.
+    int k = ((pSrc_ptr[0] + 4) >> 3) + 128;
+    k = CLAMP(k);
+
+    for (int y = 0; y < h; y++)
+      for (int x = 0; x < w; x++)
+        pDst_ptr[y * 8 + x] = (uint8)k;
+    return;
+  }
+
+  const int* pH_cos = s_idct_scaled[h_shift];
+  const int* pV_cos = s_idct_scaled[v_shift];
+  const uint8* pRow_tab = &s_idct_row_table[(block_max_zag - 1) * 8];
+  const int nonzero_rows = s_idct_col_table[block_max_zag - 1];
+  int temp[8 * 8];
+
+  for (int v = 0; v < nonzero_rows; v++)
+  {
+    const int nonzero_cols = pRow_tab[v];
+    for (int x = 0; x < w; x++)
+    {
+      int sum = 0;
+      for (int u = 0; u < nonzero_cols; u++)
+        sum += MULTIPLY(pSrc_ptr[v * 8 + u], pH_cos[x * 8 + u]);
+      temp[v * 8 + x] = DESCALE(sum, CONST_BITS-PASS1_BITS);
+    }
+  }
+
+  for (int y = 0; y < h; y++)
+  {
+    for (int x = 0; x < w; x++)
+    {
+      int sum = 0;
+      for (int v = 0; v < nonzero_rows; v++)
+        sum += MULTIPLY(temp[v * 8 + x], pV_cos[y * 8 + v]);
+      int i = DESCALE_ZEROSHIFT(sum, CONST_BITS+PASS1_BITS+2);
+      pDst_ptr[y * 8 + x] = (uint8)CLAMP(i);
+    }
+  }
+}
+
 // Retrieve one character from the input stream.
 inline uint jpeg_decoder::get_char()
 {
@@ -1358,6 +1849,7 @@ void jpeg_decoder::init(jpeg_decoder_stream *pStream)
   m_error_code = JPGD_SUCCESS;
   m_ready_flag = false;
   m_image_x_size = m_image_y_size = 0;
+  m_scale_shift = 0;
   m_pStream = pStream;
   m_progressive_flag = JPGD_FALSE;
 
@@ -1499,7 +1991,16 @@ void jpeg_decoder::transform_mcu(int mcu_row)
 
   for (int mcu_block = 0; mcu_block < m_blocks_per_mcu; mcu_block++)
   {
-    idct(pSrc_ptr, pDst_ptr, m_mcu_block_max_zag[mcu_block]);
+    if (m_scale_shift)
+    {
+      // Subsampled chroma is scaled down by half as much in each subsampled direction.
+      const bool chroma = m_mcu_org[mcu_block] != 0;
+      const int h_shift = m_scale_shift - (chroma ? m_comp_h_samp[0] - 1 : 0);
+      const int v_shift = m_scale_shift - (chroma ? m_comp_v_samp[0] - 1 : 0);
+      idct_scaled(pSrc_ptr, pDst_ptr, m_mcu_block_max_zag[mcu_block], h_shift, v_shift);
+    }
+    else
+      idct(pSrc_ptr, pDst_ptr, m_mcu_block_max_zag[mcu_block]);
     pSrc_ptr += 64;
     pDst_ptr += 64;
   }
@@ -1871,6 +2372,14 @@ void jpeg_decoder::H1V1Convert()
   uint8 *d = m_pScan_line_0;
   uint8 *s = m_pSample_buf + row * 8;
 
+#if JPGD_USE_SIMD
+  if (g_simd_level >= JPGD_SIMD_SSE2)
+  {
+    h1v1_convert_sse2(d, s, m_max_mcus_per_row);
+    return;
+  }
+#endif
+
   for (int i = m_max_mcus_per_row; i > 0; i--)
   {
     for (int j = 0; j < 8; j++)
@@ -1899,6 +2408,19 @@ void jpeg_decoder::H2V1Convert()
   uint8 *y = m_pSample_buf + row * 8;
   uint8 *c = m_pSample_buf + 2*64 + row * 8;
 
+#if JPGD_USE_SIMD
+  if (g_simd_level >= JPGD_SIMD_AVX2)
+  {
+    h2v1_convert_avx2(d0, y, c, m_max_mcus_per_row);
+    return;
+  }
+  if (g_simd_level >= JPGD_SIMD_SSE2)
+  {
+    h2v1_convert_sse2(d0, y, c, m_max_mcus_per_row);
+    return;
+  }
+#endif
+
   for (int i = m_max_mcus_per_row; i > 0; i--)
   {
     for (int l = 0; l < 2; l++)
@@ -1952,6 +2474,14 @@ void jpeg_decoder::H1V2Convert()
 
   c = m_pSample_buf + 64*2 + (row >> 1) * 8;
 
+#if JPGD_USE_SIMD
+  if (g_simd_level >= JPGD_SIMD_SSE2)
+  {
+    h1v2_convert_sse2(d0, d1, y, c, m_max_mcus_per_row);
+    return;
+  }
+#endif
+
   for (int i = m_max_mcus_per_row; i > 0; i--)
   {
     for (int j = 0; j < 8; j++)
@@ -2000,6 +2530,19 @@ void jpeg_decoder::H2V2Convert()
 
 	c = m_pSample_buf + 64*4 + (row >> 1) * 8;
 
+#if JPGD_USE_SIMD
+	if (g_simd_level >= JPGD_SIMD_AVX2)
+	{
+		h2v2_convert_avx2(d0, d1, y, c, m_max_mcus_per_row);
+		return;
+	}
+	if (g_simd_level >= JPGD_SIMD_SSE2)
+	{
+		h2v2_convert_sse2(d0, d1, y, c, m_max_mcus_per_row);
+		return;
+	}
+#endif
+
 	for (int i = m_max_mcus_per_row; i > 0; i--)
 	{
 		for (int l = 0; l < 2; l++)
@@ -2075,6 +2618,21 @@ void jpeg_decoder::expanded_convert()
 
   uint8* d = m_pScan_line_0;
 
+#if JPGD_USE_SIMD
+  const int chroma_ofs = 64 * m_expanded_blocks_per_component;
+  const int mcu_size = 64 * m_expanded_blocks_per_mcu;
+  if (g_simd_level >= JPGD_SIMD_AVX2 && m_max_mcu_x_size == 16)
+  {
+    expanded_convert_avx2(d, Py, m_max_mcus_per_row, chroma_ofs, mcu_size);
+    return;
+  }
+  if (g_simd_level >= JPGD_SIMD_SSE2)
+  {
+    expanded_convert_sse2(d, Py, m_max_mcus_per_row, m_max_mcu_x_size / 8, chroma_ofs, mcu_size);
+    return;
+  }
+#endif
+
   for (int i = m_max_mcus_per_row; i > 0; i--)
   {
     for (int k = 0; k < m_max_mcu_x_size; k += 8)
@@ -2101,6 +2659,52 @@ void jpeg_decoder::expanded_convert()
   }
 }
 
+// Any supported sampling factor, when decoding at reduced scale. Each luma block in the sample
+// buffer holds an (8 >> m_scale_shift)-pixel square in its top-left corner, and each chroma block
+// holds the chroma for the whole MCU at the same resolution, so no upsampling is needed.
+void jpeg_decoder::scaled_convert()
+{
+  const int n = 8 >> m_scale_shift;
+  const int h_samp = m_comp_h_samp[0];
+  const int v_samp = m_comp_v_samp[0];
+  const int row = (m_max_mcu_y_size >> m_scale_shift) - m_mcu_lines_left;
+
+  uint8 *d = m_pScan_line_0;
+  uint8 *s = m_pSample_buf;
+  const int y_ofs = (row / n) * h_samp * 64 + (row % n) * 8;
+  const int c_ofs = h_samp * v_samp * 64 + row * 8;
+
+  for (int i = m_max_mcus_per_row; i > 0; i--)
+  {
+    const uint8 *py = s + y_ofs;
+    if (m_scan_type == JPGD_GRAYSCALE)
+    {
+      for (int x = 0; x < n; x++)
+        *d++ = py[x];
+    }
+    else
+    {
+      const uint8 *pcb = s + c_ofs;
+      const uint8 *pcr = pcb + 64;
+      for (int x = 0; x < h_samp * n; x++)
+      {
+        int y = py[(x / n) * 64 + (x % n)];
+        int cb = pcb[x];
+        int cr = pcr[x];
+
+        d[0] = clamp(y + m_crr[cr]);
+        d[1] = clamp(y + ((m_crg[cr] + m_cbg[cb]) >> 16));
+        d[2] = clamp(y + m_cbb[cb]);
+        d[3] = 255;
+
+        d += 4;
+      }
+    }
+
+    s += m_blocks_per_mcu * 64;
+  }
+}
+
 // Find end of image (EOI) marker, so we can return to the user the exact size of the input stream.
 void jpeg_decoder::find_eoi()
 {
@@ -2140,13 +2744,18 @@ int jpeg_decoder::decode(const void** pScan_line, uint* pScan_line_len)
       decode_next_row();
 
     // Find the EOI marker if that was the last row.
-    if (m_total_lines_left <= m_max_mcu_y_size)
+    if (m_total_lines_left <= (m_max_mcu_y_size >> m_scale_shift))
       find_eoi();
 
-    m_mcu_lines_left = m_max_mcu_y_size;
+    m_mcu_lines_left = m_max_mcu_y_size >> m_scale_shift;
   }
 
-  if (m_freq_domain_chroma_upsample)
+  if (m_scale_shift)
+  {
+    scaled_convert();
+    *pScan_line = m_pScan_line_0;
+  }
+  else if (m_freq_domain_chroma_upsample)
   {
     expanded_convert();
     *pScan_line = m_pScan_line_0;
@@ -2531,7 +3140,7 @@ void jpeg_decoder::init_frame()
 
   m_dest_bytes_per_scan_line = ((m_image_x_size + 15) & 0xFFF0) * m_dest_bytes_per_pixel;
 
-  m_real_dest_bytes_per_scan_line = (m_image_x_size * m_dest_bytes_per_pixel);
+  m_real_dest_bytes_per_scan_line = (get_width() * m_dest_bytes_per_pixel);
 
   // Initialize two scan line buffers.
   m_pScan_line_0 = (uint8 *)alloc(m_dest_bytes_per_scan_line, true);
@@ -2556,7 +3165,7 @@ void jpeg_decoder::init_frame()
 	// Freq. domain chroma upsampling is only supported for H2V2 subsampling factor (the most common one I've seen).
   m_freq_domain_chroma_upsample = false;
 #if JPGD_SUPPORT_FREQ_DOMAIN_UPSAMPLING
-  m_freq_domain_chroma_upsample = (m_expanded_blocks_per_mcu == 4*3);
+  m_freq_domain_chroma_upsample = (m_expanded_blocks_per_mcu == 4*3) && !m_scale_shift;
 #endif
 
   if (m_freq_domain_chroma_upsample)
@@ -2564,7 +3173,7 @@ void jpeg_decoder::init_frame()
   else
     m_pSample_buf = (uint8 *)alloc(m_max_blocks_per_row * 64);
 
-  m_total_lines_left = m_image_y_size;
+  m_total_lines_left = get_height();
 
   m_mcu_lines_left = 0;
 
@@ -2952,6 +3561,15 @@ int jpeg_decoder::begin_decoding()
   return JPGD_SUCCESS;
 }
 
+bool jpeg_decoder::set_scale_shift(int scale_shift)
+{
+  if ((m_ready_flag) || (scale_shift < 0) || (scale_shift > 3))
+    return false;
+
+  m_scale_shift = scale_shift;
+  return true;
+}
+
 jpeg_decoder::~jpeg_decoder()
 {
   free_all_blocks();
@@ -3056,7 +3674,7 @@ int jpeg_decoder_mem_stream::read(uint8 *pBuf, int max_bytes_to_read, bool *pEOF
   return max_bytes_to_read;
 }
 
-unsigned char *decompress_jpeg_image_from_stream(jpeg_decoder_stream *pStream, int *width, int *height, int *actual_comps, int req_comps)
+unsigned char *decompress_jpeg_image_from_stream(jpeg_decoder_stream *pStream, int *width, int *height, int *actual_comps, int req_comps, int fit_width, int fit_height)
 {
   if (!actual_comps)
     return NULL;
@@ -3072,6 +3690,22 @@ unsigned char *decompress_jpeg_image_from_stream(jpeg_decoder_stream *pStream, i
   if (decoder.get_error_code() != JPGD_SUCCESS)
     return NULL;
 
+  if ((fit_width > 0) && (fit_height > 0))
+  {
+    // Use the largest downscale at which the image, scaled to fit inside fit_width x fit_height,
+    // still isn't enlarged.
+    int scale_shift = 3;
+    while (scale_shift > 0)
+    {
+      const int round = (1 << scale_shift) - 1;
+      if (((decoder.get_source_width() + round) >> scale_shift) >= fit_width ||
+          ((decoder.get_source_height() + round) >> scale_shift) >= fit_height)
+        break;
+      scale_shift--;
+    }
+    decoder.set_scale_shift(scale_shift);
+  }
+
   const int image_width = decoder.get_width(), image_height = decoder.get_height();
   *width = image_width;
   *height = image_height;
@@ -3155,18 +3789,27 @@ unsigned char *decompress_jpeg_image_from_stream(jpeg_decoder_stream *pStream, i
   return pImage_data;
 }
 
-unsigned char *decompress_jpeg_image_from_memory(const unsigned char *pSrc_data, int src_data_size, int *width, int *height, int *actual_comps, int req_comps)
+void set_max_simd_level(int level)
+{
+#if JPGD_USE_SIMD
+  g_simd_level = (jpgd_simd_level)JPGD_MIN(JPGD_MAX(level, (int)JPGD_SIMD_NONE), (int)g_detected_simd_level);
+#else
+  (void)level;
+#endif
+}
+
+unsigned char *decompress_jpeg_image_from_memory(const unsigned char *pSrc_data, int src_data_size, int *width, int *height, int *actual_comps, int req_comps, int fit_width, int fit_height)
 {
   jpgd::jpeg_decoder_mem_stream mem_stream(pSrc_data, src_data_size);
-  return decompress_jpeg_image_from_stream(&mem_stream, width, height, actual_comps, req_comps);
+  return decompress_jpeg_image_from_stream(&mem_stream, width, height, actual_comps, req_comps, fit_width, fit_height);
 }
 
-unsigned char *decompress_jpeg_image_from_file(const char *pSrc_filename, int *width, int *height, int *actual_comps, int req_comps)
+unsigned char *decompress_jpeg_image_from_file(const char *pSrc_filename, int *width, int *height, int *actual_comps, int req_comps, int fit_width, int fit_height)
 {
   jpgd::jpeg_decoder_file_stream file_stream;
   if (!file_stream.open(pSrc_filename))
     return NULL;
-  return decompress_jpeg_image_from_stream(&file_stream, width, height, actual_comps, req_comps);
+  return decompress_jpeg_image_from_stream(&file_stream, width, height, actual_comps, req_comps, fit_width, fit_height);
 }
 
 } // namespace jpgd
\ No newline at end of file
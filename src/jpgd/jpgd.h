@@ -28,8 +28,13 @@ namespace jpgd
   // On return, width/height will be set to the image's dimensions, and actual_comps will be set to the either 1 (grayscale) or 3 (RGB).
   // Notes: For more control over where and how the source data is read, see the decompress_jpeg_image_from_stream() function below, or call the jpeg_decoder class directly.
   // Requesting a 8 or 32bpp image is currently a little faster than 24bpp because the jpeg_decoder class itself currently always unpacks to either 8 or 32bpp.
-  unsigned char *decompress_jpeg_image_from_memory(const unsigned char *pSrc_data, int src_data_size, int *width, int *height, int *actual_comps, int req_comps);
-  unsigned char *decompress_jpeg_image_from_file(const char *pSrc_filename, int *width, int *height, int *actual_comps, int req_comps);
+  // If fit_width and fit_height are non-zero, the image is decoded at 1/2, 1/4 or 1/8 scale where that still leaves it at least as large as it would be when scaled to fit inside fit_width x fit_height; width/height are set to the decoded dimensions.
+  unsigned char *decompress_jpeg_image_from_memory(const unsigned char *pSrc_data, int src_data_size, int *width, int *height, int *actual_comps, int req_comps, int fit_width = 0, int fit_height = 0);
+  unsigned char *decompress_jpeg_image_from_file(const char *pSrc_filename, int *width, int *height, int *actual_comps, int req_comps, int fit_width = 0, int fit_height = 0);
+
+  // Limits the SIMD kernels used to those up to the given level (0 for none, 1 for SSE2, 2 for SSE2 and AVX2), so that tests can compare them with the scalar code.
+  // Levels the CPU doesn't support are never used. Not thread-safe: call only while nothing is being decoded.
+  void set_max_simd_level(int level);
 
   // Success/failure error codes.
   enum jpgd_status
@@ -104,7 +109,7 @@ namespace jpgd
   };
 
   // Loads JPEG file from a jpeg_decoder_stream.
-  unsigned char *decompress_jpeg_image_from_stream(jpeg_decoder_stream *pStream, int *width, int *height, int *actual_comps, int req_comps);
+  unsigned char *decompress_jpeg_image_from_stream(jpeg_decoder_stream *pStream, int *width, int *height, int *actual_comps, int req_comps, int fit_width = 0, int fit_height = 0);
 
   enum 
   { 
@@ -128,6 +133,11 @@ namespace jpgd
     // If JPGD_SUCCESS is returned you may then call decode() on each scanline.
     int begin_decoding();
 
+    // Call before begin_decoding() to decode at 1/2, 1/4 or 1/8 scale (scale_shift of 1, 2 or 3) by using a reduced-size IDCT.
+    // get_width() and get_height() then return the scaled dimensions. Returns false if decoding has already begun.
+    bool set_scale_shift(int scale_shift);
+    inline int get_scale_shift() const { return m_scale_shift; }
+
     // Returns the next scan line.
     // For grayscale images, pScan_line will point to a buffer containing 8-bit pixels (get_bytes_per_pixel() will return 1). 
     // Otherwise, it will always point to a buffer containing 32-bit RGBA pixels (A will always be 255, and get_bytes_per_pixel() will return 4).
@@ -138,13 +148,16 @@ namespace jpgd
     
     inline jpgd_status get_error_code() const { return m_error_code; }
 
-    inline int get_width() const { return m_image_x_size; }
-    inline int get_height() const { return m_image_y_size; }
+    inline int get_width() const { return (m_image_x_size + (1 << m_scale_shift) - 1) >> m_scale_shift; }
+    inline int get_height() const { return (m_image_y_size + (1 << m_scale_shift) - 1) >> m_scale_shift; }
+
+    inline int get_source_width() const { return m_image_x_size; }
+    inline int get_source_height() const { return m_image_y_size; }
 
     inline int get_num_components() const { return m_comps_in_frame; }
 
     inline int get_bytes_per_pixel() const { return m_dest_bytes_per_pixel; }
-    inline int get_bytes_per_scan_line() const { return m_image_x_size * get_bytes_per_pixel(); }
+    inline int get_bytes_per_scan_line() const { return get_width() * get_bytes_per_pixel(); }
 
     // Returns the total number of bytes actually consumed by the decoder (which should equal the actual size of the JPEG file).
     inline int get_total_bytes_read() const { return m_total_bytes_read; }
@@ -184,6 +197,7 @@ namespace jpgd
     mem_block *m_pMem_blocks;
     int m_image_x_size;
     int m_image_y_size;
+    int m_scale_shift;
     jpeg_decoder_stream *m_pStream;
     int m_progressive_flag;
     uint8 m_huff_ac[JPGD_MAX_HUFF_TABLES];
@@ -297,6 +311,7 @@ namespace jpgd
     void H1V2Convert();
     void H1V1Convert();
     void gray_convert();
+    void scaled_convert();
     void expanded_convert();
     void find_eoi();
     inline uint get_char();
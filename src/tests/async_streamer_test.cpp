@@ -0,0 +1,295 @@
+#include <tests/tests.h>
+#include <common/media/image.h>
+#include <common/media/streamer.h>
+#include <trance/media/async_streamer.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+  // What the decode thread has asked of the streamers, for the test to check.
+  struct Record {
+    std::atomic<std::size_t> calls{0};
+    std::mutex mutex;
+    // Frames of each streamer made into images.
+    std::map<uint32_t, std::set<std::size_t>> decoded;
+  };
+
+  // Gives out 1x1 frames whose pixel is the streamer's number and the frame's. Keyframes come
+  // every keyframe_interval frames and, as for WebmStreamer, are only known once decoded;
+  // seeking carries on from the current frame if there's no keyframe in between.
+  class FakeStreamer : public Streamer
+  {
+  public:
+    FakeStreamer(uint32_t id, std::size_t length, std::size_t keyframe_interval, Record& record)
+    : _id{id}, _length{length}, _keyframe_interval{keyframe_interval}, _record(record)
+    {
+    }
+
+    bool success() const override
+    {
+      return true;
+    }
+
+    void reset() override
+    {
+      ++_record.calls;
+      _frame = 0;
+    }
+
+    Image next_frame() override
+    {
+      auto frame = _frame;
+      if (!advance()) {
+        return {};
+      }
+      {
+        std::lock_guard<std::mutex> lock{_record.mutex};
+        _record.decoded[_id].insert(frame);
+      }
+      uint32_t pixel = (_id << 16) | uint32_t(frame);
+      return {1, 1, reinterpret_cast<const unsigned char*>(&pixel), _frame_pool};
+    }
+
+    bool skip_frame() override
+    {
+      return advance();
+    }
+
+    bool seek(std::size_t frame) override
+    {
+      auto start = keyframe(frame);
+      if (_frame < start || _frame > frame) {
+        reset();
+        _frame = start;
+      }
+      while (_frame < frame) {
+        if (!skip_frame()) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    std::size_t keyframe(std::size_t frame) const override
+    {
+      if (!_known) {
+        return 0;
+      }
+      auto last = std::min(frame, _known - 1);
+      return last - last % _keyframe_interval;
+    }
+
+  private:
+    bool advance()
+    {
+      ++_record.calls;
+      if (_frame >= _length) {
+        return false;
+      }
+      _known = std::max(_known, ++_frame);
+      return true;
+    }
+
+    const uint32_t _id;
+    const std::size_t _length;
+    const std::size_t _keyframe_interval;
+    Record& _record;
+    std::size_t _frame = 0;
+    // Frames up to here have been decoded at least once.
+    std::size_t _known = 0;
+  };
+
+  // Waits until the decode thread hasn't touched a streamer for a while, so that it's as far
+  // ahead as it can get.
+  void wait_for_decoding(const Record& record)
+  {
+    while (true) {
+      auto calls = record.calls.load();
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+      if (calls == record.calls.load()) {
+        return;
+      }
+    }
+  }
+
+  uint32_t pixel(const Image& image)
+  {
+    uint32_t p = 0;
+    if (image && image.get_pixels()) {
+      memcpy(&p, image.get_pixels(), sizeof(p));
+    }
+    return p;
+  }
+
+  // How the kept frames of an animation should play, from the given one: forwards, then
+  // backwards, then forwards again, without repeating the frame at either end.
+  std::vector<uint32_t> expected_frames(uint32_t id, const std::vector<std::size_t>& kept,
+                                        std::size_t count, std::size_t first = 0)
+  {
+    std::vector<uint32_t> frames;
+    std::size_t i = first;
+    bool backwards = false;
+    while (frames.size() < count) {
+      frames.push_back((id << 16) | uint32_t(kept[i]));
+      if (kept.size() == 1) {
+        continue;
+      }
+      if (backwards ? i == 0 : i == kept.size() - 1) {
+        backwards = !backwards;
+      }
+      i = backwards ? i - 1 : i + 1;
+    }
+    return frames;
+  }
+
+  struct Config {
+    std::size_t length;
+    std::size_t buffer_size;
+    std::size_t keyframe_interval;
+  };
+
+  std::string describe(const Config& config)
+  {
+    return std::to_string(config.length) + " frames, buffer " +
+        std::to_string(config.buffer_size) + ", keyframes every " +
+        std::to_string(config.keyframe_interval);
+  }
+}
+
+// Plays animations shorter and longer than the buffer, with keyframes at various intervals
+// including longer than the runs decoded backwards, and checks that each frame is shown in
+// turn: forwards to the end, then backwards to the start, and forwards again. Checks too that
+// decoding backwards never holds more than half a buffer of frames besides those queued.
+TEST(async_streamer_plays_back_and_forth)
+{
+  std::vector<Config> configs;
+  for (std::size_t buffer_size : {2, 5, 16}) {
+    for (std::size_t length : {1, 4, 16, 17, 40}) {
+      for (std::size_t keyframe_interval : {1, 3, 11, 1000}) {
+        configs.push_back({length, buffer_size, keyframe_interval});
+      }
+    }
+  }
+
+  for (const auto& config : configs) {
+    Record record;
+    uint32_t loads = 0;
+    auto load = [&]() -> std::unique_ptr<Streamer> {
+      // The next animation never loads, so that it's never switched to.
+      if (loads++) {
+        return {};
+      }
+      return std::make_unique<FakeStreamer>(0, config.length, config.keyframe_interval, record);
+    };
+
+    std::vector<std::size_t> kept(config.length);
+    for (std::size_t i = 0; i < kept.size(); ++i) {
+      kept[i] = i;
+    }
+    auto passes = 3 * config.length;
+    auto expected = expected_frames(0, kept, passes);
+    std::vector<uint32_t> shown;
+    uint64_t most_held = 0;
+    {
+      AsyncStreamer streamer{load, config.buffer_size};
+      // At 15 fps the cursor moves one frame per call, once the first has started it off.
+      streamer.advance_frame(15, false, false);
+      while (shown.size() < passes) {
+        shown.push_back(pixel(streamer.get_frame([](const Image&) {})));
+        wait_for_decoding(record);
+        most_held = std::max(most_held, streamer.buffer_bytes() / 4);
+        streamer.advance_frame(15, false, false);
+      }
+    }
+    // The buffer, the queue of 8 frames feeding it, and a run of up to half a buffer.
+    auto max_held = config.buffer_size + 8 + std::max<std::size_t>(1, config.buffer_size / 2);
+    if (most_held > max_held) {
+      test_failure(__FILE__, __LINE__,
+                   describe(config) + ": held " + std::to_string(most_held) + " frames at once");
+      return;
+    }
+    if (shown != expected) {
+      test_failure(__FILE__, __LINE__, describe(config) + ": frames shown out of order");
+      return;
+    }
+  }
+}
+
+// Plays animations at frame rates where the cursor steps over one frame in every few, a whole or
+// a fractional number, and checks that only the first frame of each step is made into an image,
+// the rest only being skipped, and that those are shown one per call, back and forth.
+TEST(async_streamer_keeps_one_frame_per_step)
+{
+  std::vector<Config> configs;
+  for (std::size_t buffer_size : {5, 16}) {
+    for (std::size_t length : {7, 40}) {
+      for (std::size_t keyframe_interval : {1, 11}) {
+        configs.push_back({length, buffer_size, keyframe_interval});
+      }
+    }
+  }
+
+  for (uint32_t fps : {15, 12, 10, 9, 7, 5, 4}) {
+    auto stride = std::max(1.f, (120.f / fps) / 8.f);
+    for (const auto& config : configs) {
+      auto name = std::to_string(fps) + " fps, " + describe(config);
+      Record record;
+      uint32_t loads = 0;
+      auto load = [&]() -> std::unique_ptr<Streamer> {
+        return std::make_unique<FakeStreamer>(loads++, config.length, config.keyframe_interval,
+                                              record);
+      };
+
+      // The first frame of each run with the same floor(frame / stride).
+      std::vector<std::size_t> kept;
+      for (std::size_t i = 0; i < config.length; ++i) {
+        if (!i || std::floor(double(i) / stride) != std::floor(double(i - 1) / stride)) {
+          kept.push_back(i);
+        }
+      }
+
+      std::vector<uint32_t> shown;
+      {
+        AsyncStreamer streamer{load, config.buffer_size};
+        // The first two animations were loaded before the frame rate was known, so switch until
+        // the third is showing.
+        uint32_t p = 0;
+        while (p >> 16 != 2) {
+          wait_for_decoding(record);
+          streamer.advance_frame(fps, true, true);
+          p = pixel(streamer.get_frame([](const Image&) {}));
+        }
+        while (shown.size() < 3 * kept.size()) {
+          shown.push_back(pixel(streamer.get_frame([](const Image&) {})));
+          wait_for_decoding(record);
+          streamer.advance_frame(fps, false, false);
+        }
+      }
+
+      // Switching may have moved the cursor on from the first frame already.
+      auto first = kept.size() > 1 && shown[0] == (2u << 16 | uint32_t(kept[1]));
+      if (shown != expected_frames(2, kept, shown.size(), first)) {
+        test_failure(__FILE__, __LINE__, name + ": frames shown out of order");
+        return;
+      }
+      std::set<std::size_t> all_kept{kept.begin(), kept.end()};
+      const auto& decoded = record.decoded[2];
+      if (!std::includes(all_kept.begin(), all_kept.end(), decoded.begin(), decoded.end())) {
+        test_failure(__FILE__, __LINE__, name + ": made images of frames stepped over");
+        return;
+      }
+    }
+  }
+}
@@ -0,0 +1,187 @@
+#include <tests/tests.h>
+#include <common/media/colour.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+  struct Planes {
+    std::vector<uint8_t> y;
+    std::vector<uint8_t> u;
+    std::vector<uint8_t> v;
+  };
+
+  // Planes with rows padded past the width, so that writing beyond it shows up.
+  Planes make_planes(uint32_t height, std::size_t y_stride, std::size_t chroma_stride)
+  {
+    auto chroma_height = (height + 1) / 2;
+    return {std::vector<uint8_t>(y_stride * height, 0xa5),
+            std::vector<uint8_t>(chroma_stride * chroma_height, 0xa5),
+            std::vector<uint8_t>(chroma_stride * chroma_height, 0xa5)};
+  }
+
+  // The conversion as documented, one pixel at a time.
+  void reference_pack_i420(const std::vector<uint8_t>& yuvx, uint32_t width, uint32_t height,
+                           Planes& planes, std::size_t y_stride, std::size_t chroma_stride,
+                           uint32_t chroma_width, uint32_t chroma_height)
+  {
+    auto at = [&](uint32_t x, uint32_t y, uint32_t channel) {
+      return yuvx[4 * (std::min(y, height - 1) * std::size_t(width) + std::min(x, width - 1)) +
+                  channel];
+    };
+    for (uint32_t j = 0; j < height; ++j) {
+      for (uint32_t i = 0; i < width; ++i) {
+        planes.y[j * y_stride + i] = at(i, j, 0);
+      }
+    }
+    for (uint32_t j = 0; j < height && j / 2 < chroma_height; j += 2) {
+      for (uint32_t i = 0; i < width && i / 2 < chroma_width; i += 2) {
+        for (uint32_t channel = 1; channel <= 2; ++channel) {
+          auto sum = at(i, j, channel) + at(i + 1, j, channel) + at(i, j + 1, channel) +
+              at(i + 1, j + 1, channel);
+          (channel == 1 ? planes.u : planes.v)[(j / 2) * chroma_stride + i / 2] =
+              uint8_t(sum / 4);
+        }
+      }
+    }
+  }
+
+  std::vector<uint8_t> random_pixels(std::mt19937& generator, uint32_t width, uint32_t height)
+  {
+    std::vector<uint8_t> pixels(4 * std::size_t(width) * height);
+    for (auto& p : pixels) {
+      p = uint8_t(generator());
+    }
+    return pixels;
+  }
+}
+
+// Packs random frames of every size up to a few SIMD blocks across, and some odd-sized larger
+// ones, at each level of SIMD kernels, and checks that the output is exactly that of the
+// reference. Chroma planes are sized both ways for odd sizes: rounded up, as for libvpx, and
+// rounded down, as for x264, where nothing may be written past them.
+TEST(pack_i420_matches_reference)
+{
+  std::mt19937 generator{3};
+  std::vector<std::pair<uint32_t, uint32_t>> sizes;
+  for (uint32_t width = 1; width <= 40; ++width) {
+    for (uint32_t height = 1; height <= 4; ++height) {
+      sizes.emplace_back(width, height);
+    }
+  }
+  sizes.emplace_back(321, 241);
+  sizes.emplace_back(640, 360);
+  sizes.emplace_back(1279, 719);
+
+  for (const auto& size : sizes) {
+    auto width = size.first;
+    auto height = size.second;
+    auto y_stride = std::size_t(width) + 7;
+    auto chroma_stride = std::size_t(width + 1) / 2 + 5;
+    auto pixels = random_pixels(generator, width, height);
+    for (uint32_t round_up = 0; round_up <= 1; ++round_up) {
+      auto chroma_width = (width + round_up) / 2;
+      auto chroma_height = (height + round_up) / 2;
+      auto expected = make_planes(height, y_stride, chroma_stride);
+      reference_pack_i420(pixels, width, height, expected, y_stride, chroma_stride, chroma_width,
+                          chroma_height);
+
+      for (int level = 0; level <= 2; ++level) {
+        set_max_colour_simd_level(level);
+        auto planes = make_planes(height, y_stride, chroma_stride);
+        pack_i420(pixels.data(), width, height, planes.y.data(), y_stride, planes.u.data(),
+                  chroma_stride, planes.v.data(), chroma_stride, chroma_width, chroma_height);
+        if (planes.y != expected.y || planes.u != expected.u || planes.v != expected.v) {
+          test_failure(__FILE__, __LINE__,
+                       std::to_string(width) + "x" + std::to_string(height) + " with " +
+                           std::to_string(chroma_width) + "x" + std::to_string(chroma_height) +
+                           " chroma differs at SIMD level " + std::to_string(level));
+        }
+      }
+    }
+  }
+  set_max_colour_simd_level(2);
+}
+
+// Checks the ends of the range, and the primaries, for each matrix and range.
+TEST(i420_to_rgb_known_colours)
+{
+  struct Case {
+    YuvColourSpace colour_space;
+    uint8_t y;
+    uint8_t u;
+    uint8_t v;
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+  };
+  const YuvColourSpace bt601_limited{YuvMatrix::BT601, YuvRange::LIMITED};
+  const YuvColourSpace bt601_full{YuvMatrix::BT601, YuvRange::FULL};
+  const YuvColourSpace bt709_limited{YuvMatrix::BT709, YuvRange::LIMITED};
+  const YuvColourSpace bt709_full{YuvMatrix::BT709, YuvRange::FULL};
+  const Case cases[] = {
+      {bt601_limited, 16, 128, 128, 0, 0, 0},
+      {bt601_limited, 235, 128, 128, 255, 255, 255},
+      {bt601_limited, 81, 90, 240, 255, 0, 0},
+      {bt601_limited, 145, 54, 34, 0, 255, 0},
+      {bt601_limited, 41, 240, 110, 0, 0, 255},
+      {bt601_full, 0, 128, 128, 0, 0, 0},
+      {bt601_full, 255, 128, 128, 255, 255, 255},
+      {bt601_full, 76, 85, 255, 254, 0, 0},
+      {bt709_limited, 16, 128, 128, 0, 0, 0},
+      {bt709_limited, 235, 128, 128, 255, 255, 255},
+      {bt709_limited, 63, 102, 240, 255, 0, 0},
+      {bt709_limited, 173, 42, 26, 0, 255, 0},
+      {bt709_limited, 32, 240, 118, 0, 0, 255},
+      {bt709_full, 0, 128, 128, 0, 0, 0},
+      {bt709_full, 255, 128, 128, 255, 255, 255},
+  };
+  for (const auto& c : cases) {
+    // A 2x2 image, so that each plane is a single sample.
+    uint8_t y[4] = {c.y, c.y, c.y, c.y};
+    uint8_t rgb[12];
+    i420_to_rgb(c.colour_space, 2, 2, y, 2, &c.u, 1, &c.v, 1, rgb);
+    for (int i = 0; i < 4; ++i) {
+      // Allow for the rounding of the YUV values given.
+      if (std::abs(rgb[3 * i] - c.r) > 2 || std::abs(rgb[3 * i + 1] - c.g) > 2 ||
+          std::abs(rgb[3 * i + 2] - c.b) > 2) {
+        test_failure(__FILE__, __LINE__,
+                     "YUV " + std::to_string(c.y) + " " + std::to_string(c.u) + " " +
+                         std::to_string(c.v) + " gave RGB " + std::to_string(rgb[3 * i]) + " " +
+                         std::to_string(rgb[3 * i + 1]) + " " + std::to_string(rgb[3 * i + 2]));
+        break;
+      }
+    }
+  }
+}
+
+// Times packing a 4K frame, as exporting does for each frame, at each level of SIMD kernels.
+BENCHMARK(pack_i420_4k)
+{
+  const uint32_t width = 3840;
+  const uint32_t height = 2160;
+  const uint32_t frames = 50;
+  std::mt19937 generator{4};
+  auto pixels = random_pixels(generator, width, height);
+  auto planes = make_planes(height, width, width / 2);
+
+  const char* names[] = {"scalar", "SSE2", "AVX2"};
+  for (int level = 0; level <= 2; ++level) {
+    set_max_colour_simd_level(level);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < frames; ++i) {
+      pack_i420(pixels.data(), width, height, planes.y.data(), width, planes.u.data(),
+                width / 2, planes.v.data(), width / 2, width / 2, height / 2);
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << names[level] << ": " << elapsed.count() / frames << " ms per frame"
+              << std::endl;
+  }
+  set_max_colour_simd_level(2);
+}
@@ -0,0 +1,236 @@
+#include <tests/tests.h>
+#include <common/media/image.h>
+#include <trance/media/image_cache.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace
+{
+  // A JPEG from the corpus, so that the cache decodes something real.
+  const std::string source_jpeg = "jpeg/yuv420.jpg";
+
+  // Names of the entries in the cache directory.
+  std::set<std::string> entry_names(const std::string& directory)
+  {
+    std::set<std::string> names;
+    std::error_code ec;
+    for (std::tr2::sys::directory_iterator it{directory, ec}, end; !ec && it != end;
+         it.increment(ec)) {
+      names.insert(it->path().filename().string());
+    }
+    return names;
+  }
+
+  // The one name in after that isn't in before, or empty if there isn't exactly one.
+  std::string new_name(const std::set<std::string>& before, const std::set<std::string>& after)
+  {
+    std::string name;
+    for (const auto& n : after) {
+      if (!before.count(n)) {
+        if (!name.empty()) {
+          return {};
+        }
+        name = n;
+      }
+    }
+    return name;
+  }
+
+  std::vector<uint8_t> pixels(const Image& image)
+  {
+    auto data = image.get_pixels();
+    if (!data) {
+      return {};
+    }
+    return {data, data + image.byte_size()};
+  }
+
+  void copy_source(const std::string& to)
+  {
+    std::error_code ec;
+    std::tr2::sys::copy_file(test_data_path(source_jpeg), to, ec);
+    EXPECT(!ec);
+  }
+
+  // Sets a file's modification time to the given time ago.
+  void set_age(const std::string& path, std::chrono::hours age)
+  {
+    std::error_code ec;
+    std::tr2::sys::last_write_time(path, std::tr2::sys::file_time_type::clock::now() - age, ec);
+    EXPECT(!ec);
+  }
+
+  // Overwrites the last pixel of a cache entry, so that images read back from it can be told
+  // apart from fresh decodes.
+  const uint8_t marker[4] = {1, 2, 3, 4};
+  void mark_entry(const std::string& path)
+  {
+    std::fstream file{path, std::ios::in | std::ios::out | std::ios::binary};
+    file.seekp(-4, std::ios::end);
+    file.write(reinterpret_cast<const char*>(marker), 4);
+    EXPECT(bool(file));
+  }
+
+  bool is_marked(const std::vector<uint8_t>& pixels)
+  {
+    return pixels.size() >= 4 && std::equal(marker, marker + 4, pixels.end() - 4);
+  }
+}
+
+// Loads an image through the cache, then again through a new cache on the same directory, and
+// checks that the second load reads back exactly the pixels written by the first.
+TEST(image_cache_round_trip)
+{
+  auto directory = test_temp_directory("image_cache_round_trip");
+  auto cache_directory = directory + "/cache";
+  auto source = directory + "/a.jpg";
+  copy_source(source);
+  auto image = load_image(source);
+  auto decoded = pixels(image);
+  EXPECT(!decoded.empty());
+
+  {
+    ImageCache cache{cache_directory, 64 << 20};
+    EXPECT(pixels(cache.load(source, 0, 0)) == decoded);
+  }
+  auto names = entry_names(cache_directory);
+  EXPECT(names.size() == 1);
+  if (names.size() != 1) {
+    return;
+  }
+  mark_entry(cache_directory + "/" + *names.begin());
+
+  ImageCache cache{cache_directory, 64 << 20};
+  auto cached = pixels(cache.load(source, 0, 0));
+  EXPECT(is_marked(cached));
+  EXPECT(cached.size() == decoded.size() &&
+         std::equal(cached.begin(), cached.end() - 4, decoded.begin()));
+  // Decoded to fit a different size, it's a different entry.
+  auto fitted = cache.load(source, 20, 20);
+  EXPECT(fitted.width() < image.width() && !is_marked(pixels(fitted)));
+  EXPECT(entry_names(cache_directory).size() == 2);
+}
+
+// Changes the modification time and then the size of a cached file, and checks that each time
+// it's decoded afresh rather than read from the cache.
+TEST(image_cache_ignores_changed_files)
+{
+  auto directory = test_temp_directory("image_cache_ignores_changed_files");
+  auto cache_directory = directory + "/cache";
+  auto source = directory + "/a.jpg";
+  copy_source(source);
+  set_age(source, std::chrono::hours{2});
+  auto decoded = pixels(load_image(source));
+
+  ImageCache cache{cache_directory, 64 << 20};
+  cache.load(source, 0, 0);
+  auto names = entry_names(cache_directory);
+  EXPECT(names.size() == 1);
+  mark_entry(cache_directory + "/" + *names.begin());
+  EXPECT(is_marked(pixels(cache.load(source, 0, 0))));
+
+  set_age(source, std::chrono::hours{1});
+  EXPECT(pixels(cache.load(source, 0, 0)) == decoded);
+  auto after_time = entry_names(cache_directory);
+  auto name = new_name(names, after_time);
+  EXPECT(!name.empty());
+  mark_entry(cache_directory + "/" + name);
+  EXPECT(is_marked(pixels(cache.load(source, 0, 0))));
+
+  // Bytes after the end of the JPEG don't change the image.
+  {
+    std::ofstream file{source, std::ios::binary | std::ios::app};
+    file.put(0);
+  }
+  set_age(source, std::chrono::hours{1});
+  EXPECT(pixels(cache.load(source, 0, 0)) == decoded);
+  EXPECT(!new_name(after_time, entry_names(cache_directory)).empty());
+}
+
+// Loads the same image on several threads at once, so that they all write the same entry, and
+// checks that each gets the image and that exactly one whole entry is left.
+TEST(image_cache_concurrent_writes)
+{
+  auto directory = test_temp_directory("image_cache_concurrent_writes");
+  auto cache_directory = directory + "/cache";
+  auto source = directory + "/a.jpg";
+  copy_source(source);
+  auto decoded = pixels(load_image(source));
+
+  ImageCache cache{cache_directory, 64 << 20};
+  std::vector<std::vector<uint8_t>> results(8);
+  std::vector<std::thread> threads;
+  for (auto& result : results) {
+    threads.emplace_back([&] { result = pixels(cache.load(source, 0, 0)); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& result : results) {
+    EXPECT(result == decoded);
+  }
+  auto names = entry_names(cache_directory);
+  EXPECT(names.size() == 1);
+  if (names.size() == 1) {
+    mark_entry(cache_directory + "/" + *names.begin());
+    EXPECT(is_marked(pixels(ImageCache{cache_directory, 64 << 20}.load(source, 0, 0))));
+  }
+}
+
+// Fills the cache over several runs, using the oldest entry in between, and checks that the
+// entries evicted are always the least recently used, going by their use in earlier runs too.
+TEST(image_cache_evicts_least_recently_used_across_runs)
+{
+  auto directory = test_temp_directory("image_cache_evicts_least_recently_used_across_runs");
+  auto cache_directory = directory + "/cache";
+  std::string sources[3];
+  for (int i = 0; i < 3; ++i) {
+    sources[i] = directory + "/" + char('a' + i) + ".jpg";
+    copy_source(sources[i]);
+  }
+
+  std::string names[3];
+  {
+    ImageCache cache{cache_directory, 64 << 20};
+    for (int i = 0; i < 2; ++i) {
+      auto before = entry_names(cache_directory);
+      cache.load(sources[i], 0, 0);
+      names[i] = new_name(before, entry_names(cache_directory));
+      EXPECT(!names[i].empty());
+    }
+  }
+  // Entries written within the same clock tick would tie, so make a older than b. Using a in
+  // the next run should then make it the newer.
+  set_age(cache_directory + "/" + names[0], std::chrono::hours{2});
+  set_age(cache_directory + "/" + names[1], std::chrono::hours{1});
+  {
+    ImageCache cache{cache_directory, 64 << 20};
+    cache.load(sources[0], 0, 0);
+  }
+  EXPECT(entry_names(cache_directory) == (std::set<std::string>{names[0], names[1]}));
+
+  std::error_code ec;
+  auto entry_bytes = std::tr2::sys::file_size(cache_directory + "/" + names[0], ec);
+  EXPECT(!ec);
+  {
+    // Room for two entries; the third pushes out b.
+    ImageCache cache{cache_directory, 2 * entry_bytes + entry_bytes / 2};
+    auto before = entry_names(cache_directory);
+    cache.load(sources[2], 0, 0);
+    names[2] = new_name(before, entry_names(cache_directory));
+    EXPECT(!names[2].empty());
+  }
+  EXPECT(entry_names(cache_directory) == (std::set<std::string>{names[0], names[2]}));
+
+  // Starting with room for one entry keeps only the newest.
+  ImageCache cache{cache_directory, entry_bytes + entry_bytes / 2};
+  EXPECT(entry_names(cache_directory) == (std::set<std::string>{names[2]}));
+}
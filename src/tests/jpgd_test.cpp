@@ -0,0 +1,215 @@
+#include <tests/tests.h>
+#include <common/util.h>
+#include <jpgd/jpgd.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#pragma warning(push, 0)
+#include <gflags/gflags.h>
+#pragma warning(pop)
+
+DEFINE_string(jpeg_corpus, "",
+              "directory of JPEGs for the jpgd tests, if not the one under src/tests/data");
+
+namespace
+{
+  // How far decoding at reduced scale may be from averaging the full-size pixels. The reduced
+  // IDCTs average the full one exactly, so luma only differs by rounding; colours differ more, at
+  // hard edges in subsampled chroma, which the two blur differently.
+  const int max_luma_error_bound = 8;
+  const double mean_error_bound = 1.0;
+  const int max_error_bound = 48;
+  // Images smaller than this either way are mostly edge padding at reduced scale, so only their
+  // size is checked.
+  const int min_compared_size = 16;
+
+  struct Decoded {
+    bool ok;
+    int width;
+    int height;
+    std::vector<uint8_t> pixels;
+  };
+
+  Decoded decode(const std::vector<uint8_t>& data, int fit_width, int fit_height)
+  {
+    Decoded result{false, 0, 0, {}};
+    int comps = 0;
+    auto pixels = jpgd::decompress_jpeg_image_from_memory(
+        data.data(), int(data.size()), &result.width, &result.height, &comps, 4, fit_width,
+        fit_height);
+    if (pixels) {
+      result.ok = true;
+      result.pixels.assign(pixels, pixels + std::size_t(result.width) * result.height * 4);
+      free(pixels);
+    }
+    return result;
+  }
+
+  bool operator==(const Decoded& a, const Decoded& b)
+  {
+    return a.ok == b.ok && a.width == b.width && a.height == b.height && a.pixels == b.pixels;
+  }
+
+  // Every JPEG under the corpus directory.
+  std::vector<std::string> corpus_files()
+  {
+    auto directory = FLAGS_jpeg_corpus.empty() ? test_data_path("jpeg") : FLAGS_jpeg_corpus;
+    std::vector<std::string> paths;
+    std::error_code ec;
+    for (std::tr2::sys::recursive_directory_iterator it{directory, ec}, end; !ec && it != end;
+         it.increment(ec)) {
+      auto path = it->path().string();
+      if (std::tr2::sys::is_regular_file(it->status()) &&
+          (ext_is(path, "jpg") || ext_is(path, "jpeg"))) {
+        paths.push_back(path);
+      }
+    }
+    if (paths.empty()) {
+      test_failure(__FILE__, __LINE__, "no JPEGs found in " + directory);
+    }
+    return paths;
+  }
+
+  int luma(const std::vector<uint8_t>& pixels, std::size_t i)
+  {
+    return (77 * pixels[i] + 150 * pixels[i + 1] + 29 * pixels[i + 2] + 128) >> 8;
+  }
+
+  std::vector<uint8_t> read_file(const std::string& path)
+  {
+    std::ifstream file{path, std::ios::binary};
+    return {std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+  }
+
+  // The full-size image reduced by averaging each scale x scale block of pixels (fewer at the
+  // right and bottom edges), which is what decoding at reduced scale approximates.
+  Decoded box_filter(const Decoded& full, int scale)
+  {
+    Decoded result{true, (full.width + scale - 1) / scale, (full.height + scale - 1) / scale, {}};
+    result.pixels.resize(std::size_t(result.width) * result.height * 4);
+    for (int y = 0; y < result.height; ++y) {
+      for (int x = 0; x < result.width; ++x) {
+        int sums[4] = {0, 0, 0, 0};
+        int count = 0;
+        for (int j = y * scale; j < std::min(full.height, (y + 1) * scale); ++j) {
+          for (int i = x * scale; i < std::min(full.width, (x + 1) * scale); ++i) {
+            for (int c = 0; c < 4; ++c) {
+              sums[c] += full.pixels[(std::size_t(j) * full.width + i) * 4 + c];
+            }
+            ++count;
+          }
+        }
+        for (int c = 0; c < 4; ++c) {
+          result.pixels[(std::size_t(y) * result.width + x) * 4 + c] =
+              uint8_t((sums[c] + count / 2) / count);
+        }
+      }
+    }
+    return result;
+  }
+}
+
+// Decodes every JPEG in the corpus at full size and at each reduced scale with each level of SIMD
+// kernels, and checks that the output is exactly that of the scalar code.
+TEST(jpgd_simd_matches_scalar)
+{
+  uint32_t images = 0;
+  for (const auto& path : corpus_files()) {
+    auto data = read_file(path);
+    jpgd::set_max_simd_level(0);
+    auto full = decode(data, 0, 0);
+    if (!full.ok) {
+      test_failure(__FILE__, __LINE__, path + ": failed to decode");
+      continue;
+    }
+    ++images;
+
+    for (int scale_shift = 0; scale_shift <= 3; ++scale_shift) {
+      int round = (1 << scale_shift) - 1;
+      int fit_width = scale_shift ? (full.width + round) >> scale_shift : 0;
+      int fit_height = scale_shift ? (full.height + round) >> scale_shift : 0;
+      jpgd::set_max_simd_level(0);
+      auto scalar = decode(data, fit_width, fit_height);
+      for (int level = 1; level <= 2; ++level) {
+        jpgd::set_max_simd_level(level);
+        if (!(decode(data, fit_width, fit_height) == scalar)) {
+          test_failure(__FILE__, __LINE__,
+                       path + ": SIMD level " + std::to_string(level) + " differs at 1/" +
+                           std::to_string(1 << scale_shift) + " scale");
+        }
+      }
+    }
+  }
+  jpgd::set_max_simd_level(2);
+  std::cout << "compared " << images << " images" << std::endl;
+  EXPECT(images > 0);
+}
+
+// Decodes every JPEG in the corpus at 1/2, 1/4 and 1/8 scale, and checks that each comes out at
+// exactly the size asked for, and close to the full-size image reduced by averaging. Scales at
+// which the next one down would round to the same width or height are skipped, since that fits
+// just as well.
+TEST(jpgd_scaled_decode_matches_box_filter)
+{
+  uint32_t images = 0;
+  for (const auto& path : corpus_files()) {
+    auto data = read_file(path);
+    auto full = decode(data, 0, 0);
+    if (!full.ok) {
+      test_failure(__FILE__, __LINE__, path + ": failed to decode");
+      continue;
+    }
+    ++images;
+
+    for (int scale_shift = 1; scale_shift <= 3; ++scale_shift) {
+      int scale = 1 << scale_shift;
+      auto expected = box_filter(full, scale);
+      if (scale_shift < 3 && ((full.width + 2 * scale - 1) / (2 * scale) == expected.width ||
+                              (full.height + 2 * scale - 1) / (2 * scale) == expected.height)) {
+        continue;
+      }
+      auto scaled = decode(data, expected.width, expected.height);
+      auto name = path + " at 1/" + std::to_string(scale) + " scale";
+      if (!scaled.ok || scaled.width != expected.width || scaled.height != expected.height) {
+        test_failure(__FILE__, __LINE__,
+                     name + ": decoded to " + std::to_string(scaled.width) + "x" +
+                         std::to_string(scaled.height) + ", not " +
+                         std::to_string(expected.width) + "x" + std::to_string(expected.height));
+        continue;
+      }
+      if (full.width < min_compared_size || full.height < min_compared_size) {
+        continue;
+      }
+
+      uint64_t total_error = 0;
+      int max_error = 0;
+      int max_luma_error = 0;
+      for (std::size_t i = 0; i < scaled.pixels.size(); i += 4) {
+        for (std::size_t c = 0; c < 3; ++c) {
+          auto error = std::abs(scaled.pixels[i + c] - expected.pixels[i + c]);
+          total_error += error;
+          max_error = std::max(max_error, error);
+        }
+        max_luma_error = std::max(
+            max_luma_error, std::abs(luma(scaled.pixels, i) - luma(expected.pixels, i)));
+      }
+      auto mean_error = double(total_error) / (scaled.pixels.size() / 4 * 3);
+      if (max_luma_error > max_luma_error_bound || mean_error > mean_error_bound ||
+          max_error > max_error_bound) {
+        test_failure(__FILE__, __LINE__,
+                     name + ": luma error up to " + std::to_string(max_luma_error) +
+                         ", colour error " + std::to_string(mean_error) + " on average and up to " +
+                         std::to_string(max_error) + " from the box-filtered image");
+      }
+    }
+  }
+  EXPECT(images > 0);
+}
@@ -0,0 +1,83 @@
+#include <tests/tests.h>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <system_error>
+#include <vector>
+
+#pragma warning(push, 0)
+#include <gflags/gflags.h>
+#pragma warning(pop)
+
+DEFINE_bool(benchmark, false, "run the benchmarks as well as the tests");
+DEFINE_string(filter, "", "only run tests and benchmarks whose names contain this");
+DEFINE_string(test_data, "", "directory of the files the tests read, if not src/tests/data");
+
+namespace
+{
+  struct TestCase {
+    const char* name;
+    void (*function)();
+    bool benchmark;
+  };
+
+  std::vector<TestCase>& test_cases()
+  {
+    static std::vector<TestCase> cases;
+    return cases;
+  }
+
+  uint32_t failures = 0;
+}
+
+TestRegistration::TestRegistration(const char* name, void (*function)(), bool benchmark)
+{
+  test_cases().push_back({name, function, benchmark});
+}
+
+void test_failure(const char* file, int line, const std::string& message)
+{
+  ++failures;
+  std::cerr << file << ":" << line << ": " << message << std::endl;
+}
+
+std::string test_data_path(const std::string& name)
+{
+  if (!FLAGS_test_data.empty()) {
+    return FLAGS_test_data + "/" + name;
+  }
+  // This file's path is as the compiler was given it, which is absolute for project builds.
+  std::string file = __FILE__;
+  return file.substr(0, file.find_last_of("\\/") + 1) + "data/" + name;
+}
+
+std::string test_temp_directory(const std::string& name)
+{
+  std::error_code ec;
+  auto path = std::tr2::sys::temp_directory_path(ec) / "trance_tests" / name;
+  std::tr2::sys::remove_all(path, ec);
+  std::tr2::sys::create_directories(path, ec);
+  return path.string();
+}
+
+int main(int argc, char** argv)
+{
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  uint32_t run = 0;
+  uint32_t failed = 0;
+  for (const auto& test : test_cases()) {
+    if ((test.benchmark && !FLAGS_benchmark) ||
+        std::string{test.name}.find(FLAGS_filter) == std::string::npos) {
+      continue;
+    }
+    std::cout << "[ RUN  ] " << test.name << std::endl;
+    auto failures_before = failures;
+    test.function();
+    bool passed = failures == failures_before;
+    std::cout << (passed ? "[  OK  ] " : "[ FAIL ] ") << test.name << std::endl;
+    ++run;
+    failed += !passed;
+  }
+  std::cout << run - failed << " of " << run << " passed" << std::endl;
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+#include <tests/tests.h>
+#include <common/media/scale.h>
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+  // A plane of samples of the given number of bytes, with rows padded past the width.
+  struct Plane {
+    std::vector<uint8_t> data;
+    std::size_t stride;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytes;
+  };
+
+  Plane random_plane(std::mt19937& generator, uint32_t width, uint32_t height, uint32_t bytes,
+                     std::size_t padding)
+  {
+    Plane plane{{}, bytes * std::size_t(width) + padding, width, height, bytes};
+    plane.data.resize(plane.stride * height);
+    for (auto& p : plane.data) {
+      p = uint8_t(generator());
+    }
+    return plane;
+  }
+
+  // The downscaling as documented, one sample at a time: each step averages every 2x2 block,
+  // rounding to nearest, with the last row or column of an odd size averaged with itself.
+  std::vector<uint8_t> reference_downscale(const Plane& plane, uint32_t shift)
+  {
+    auto width = plane.width;
+    auto height = plane.height;
+    auto bytes = plane.bytes;
+    std::vector<uint8_t> samples(bytes * std::size_t(width) * height);
+    for (uint32_t y = 0; y < height; ++y) {
+      std::copy_n(&plane.data[y * plane.stride], bytes * width, &samples[bytes * y * width]);
+    }
+    for (uint32_t i = 0; i < shift; ++i) {
+      auto at = [&](uint32_t x, uint32_t y, uint32_t c) {
+        return samples[bytes * (std::min(y, height - 1) * std::size_t(width) +
+                                std::min(x, width - 1)) +
+                       c];
+      };
+      auto half_width = (width + 1) / 2;
+      auto half_height = (height + 1) / 2;
+      std::vector<uint8_t> half(bytes * std::size_t(half_width) * half_height);
+      for (uint32_t y = 0; y < half_height; ++y) {
+        for (uint32_t x = 0; x < half_width; ++x) {
+          for (uint32_t c = 0; c < bytes; ++c) {
+            auto sum = at(2 * x, 2 * y, c) + at(2 * x + 1, 2 * y, c) + at(2 * x, 2 * y + 1, c) +
+                at(2 * x + 1, 2 * y + 1, c);
+            half[bytes * (y * std::size_t(half_width) + x) + c] = uint8_t((sum + 2) / 4);
+          }
+        }
+      }
+      samples.swap(half);
+      width = half_width;
+      height = half_height;
+    }
+    return samples;
+  }
+
+  // Downscales the plane at each level of SIMD kernels, into a buffer with as much room as is
+  // documented and some guard bytes past it, and checks the result against the reference and
+  // that nothing was written past the room given.
+  void check_downscale(const std::string& name, const Plane& plane, uint32_t shift)
+  {
+    const std::size_t guard = 64;
+    auto expected = reference_downscale(plane, shift);
+    auto room = plane.bytes * std::size_t(halved(plane.width, 1)) * halved(plane.height, 1);
+    for (int level = 0; level <= 1; ++level) {
+      set_max_scale_simd_level(level);
+      std::vector<uint8_t> dst(room + guard, 0xa5);
+      (plane.bytes == 1 ? downscale_plane : downscale_pixels)(
+          plane.data.data(), plane.stride, plane.width, plane.height, shift, dst.data());
+      auto description = name + " " + std::to_string(plane.width) + "x" +
+          std::to_string(plane.height) + " halved " + std::to_string(shift) +
+          " times at SIMD level " + std::to_string(level);
+      if (!std::equal(expected.begin(), expected.end(), dst.begin())) {
+        test_failure(__FILE__, __LINE__, description + " differs");
+      }
+      if (std::any_of(dst.begin() + room, dst.end(), [](uint8_t b) { return b != 0xa5; })) {
+        test_failure(__FILE__, __LINE__, description + " wrote past the plane");
+      }
+    }
+    set_max_scale_simd_level(1);
+  }
+}
+
+// Downscales frames of every size up to a few SIMD blocks across, and some odd-sized larger
+// ones, by each power of two down to a single pixel, and checks that the output is exactly that
+// of the reference with and without SSE2. Frames are laid out as the streamers downscale them:
+// separate I420 planes with padded rows for WebM, and for GIFs either RGBA or colours looked up
+// from palette indices, one of them transparent. RGBA rows are padded too, to cover the stride.
+TEST(downscale_matches_reference)
+{
+  std::mt19937 generator{5};
+  std::vector<std::pair<uint32_t, uint32_t>> sizes;
+  for (uint32_t width = 1; width <= 40; ++width) {
+    for (uint32_t height = 1; height <= 5; ++height) {
+      sizes.emplace_back(width, height);
+    }
+  }
+  sizes.emplace_back(321, 241);
+  sizes.emplace_back(640, 360);
+  sizes.emplace_back(1279, 719);
+
+  std::vector<uint32_t> palette(16);
+  for (auto& colour : palette) {
+    colour = uint32_t(generator());
+  }
+  palette[0] = 0;
+
+  for (const auto& size : sizes) {
+    auto width = size.first;
+    auto height = size.second;
+    auto y = random_plane(generator, width, height, 1, 7);
+    auto u = random_plane(generator, (width + 1) / 2, (height + 1) / 2, 1, 5);
+    auto v = random_plane(generator, (width + 1) / 2, (height + 1) / 2, 1, 5);
+    auto rgba = random_plane(generator, width, height, 4, 12);
+    Plane indexed{{}, 4 * std::size_t(width), width, height, 4};
+    for (std::size_t i = 0; i < std::size_t(width) * height; ++i) {
+      auto colour = palette[generator() % palette.size()];
+      for (uint32_t c = 0; c < 4; ++c) {
+        indexed.data.push_back(uint8_t(colour >> (8 * c)));
+      }
+    }
+
+    for (uint32_t shift = 1; shift == 1 || halved(std::max(width, height), shift - 1) > 1;
+         ++shift) {
+      check_downscale("I420 Y plane of", y, shift);
+      check_downscale("I420 U plane of", u, shift);
+      check_downscale("I420 V plane of", v, shift);
+      check_downscale("RGBA", rgba, shift);
+      check_downscale("indexed", indexed, shift);
+    }
+  }
+}
@@ -0,0 +1,146 @@
+#include <tests/tests.h>
+#include <common/util.h>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace
+{
+  // The Shuffler as it was before it stored only the elements whose priority
+  // isn't 0, kept as the reference for how it should behave.
+  class DenseShuffler
+  {
+  public:
+    DenseShuffler(std::size_t size) : _size{size}
+    {
+      _enabled_count[-1] = size;
+      for (std::size_t i = 0; i < size; ++i) {
+        _enabled.push_back(0);
+      }
+    }
+
+    void increase(std::size_t index)
+    {
+      auto& v = _enabled[index];
+      if (!_enabled_count.count(v)) {
+        _enabled_count[v] = 0;
+      }
+      ++_enabled_count[v];
+      ++v;
+    }
+
+    void decrease(std::size_t index)
+    {
+      auto& v = _enabled[index];
+      --v;
+      if (!_enabled_count.count(v)) {
+        _enabled_count[v] = _size;
+      }
+      --_enabled_count[v];
+    }
+
+    void modify(std::size_t index, int32_t amount)
+    {
+      for (; amount > 0; --amount) {
+        increase(index);
+      }
+      for (; amount < 0; ++amount) {
+        decrease(index);
+      }
+    }
+
+    std::size_t next() const
+    {
+      for (auto it = _enabled_count.rbegin(); it != _enabled_count.rend(); ++it) {
+        auto r = random(it->second);
+        std::size_t t = 0;
+        for (std::size_t i = 0; i < _size; ++i) {
+          t += _enabled[i] > it->first;
+          if (r < t) {
+            return i;
+          }
+        }
+      }
+      return _size ? random(_size) : -1;
+    }
+
+  private:
+    std::size_t _size;
+    // _enabled_count[n] == | k s.t. _enabled[k] > n |.
+    std::map<int32_t, std::size_t> _enabled_count;
+    std::vector<int32_t> _enabled;
+  };
+
+  // Enough draws per element that one never drawn by a reference over as many
+  // elements again is practically impossible.
+  const std::size_t draws_per_element = 64;
+
+  // Elements the reference draws from, found by drawing from it.
+  std::set<std::size_t> reference_choices(const DenseShuffler& reference, std::size_t size)
+  {
+    std::set<std::size_t> choices;
+    for (std::size_t i = 0; i < draws_per_element * size; ++i) {
+      choices.insert(reference.next());
+    }
+    return choices;
+  }
+}
+
+// Applies the same random changes of priority to a Shuffler and the reference, over sizes either
+// side of where the Shuffler switches between trying random elements and walking its tree. After
+// each one, checks that next() draws evenly from exactly the elements the reference does, less
+// those avoided unless that leaves none.
+TEST(shuffler_matches_dense_reference)
+{
+  // Fixed seeds, so that a failure can be reproduced.
+  get_mersenne_twister().seed(1);
+  std::mt19937 generator{2};
+  for (uint32_t trial = 0; trial < 400; ++trial) {
+    std::size_t size = 1 + generator() % 48;
+    Shuffler shuffler{size};
+    DenseShuffler reference{size};
+    for (uint32_t change = 0; change < 100; ++change) {
+      auto index = generator() % size;
+      auto amount = int32_t(generator() % 7) - 3;
+      shuffler.modify(index, amount);
+      reference.modify(index, amount);
+
+      // Avoided indices may repeat or be out of range.
+      std::vector<std::size_t> avoid;
+      for (auto count = generator() % 8; count; --count) {
+        avoid.push_back(generator() % (size + 2));
+      }
+      auto choices = reference_choices(reference, size);
+      auto expected = choices;
+      for (auto a : avoid) {
+        expected.erase(a);
+      }
+      if (expected.empty()) {
+        expected = choices;
+      }
+
+      std::map<std::size_t, std::size_t> counts;
+      auto draws = draws_per_element * expected.size();
+      for (std::size_t i = 0; i < draws; ++i) {
+        auto chosen = shuffler.next(avoid);
+        if (!expected.count(chosen)) {
+          test_failure(__FILE__, __LINE__, "chose an element the reference wouldn't have");
+          return;
+        }
+        ++counts[chosen];
+      }
+      for (auto chosen : expected) {
+        EXPECT(counts[chosen] >= draws_per_element / 4 &&
+               counts[chosen] <= draws_per_element * 9 / 4);
+      }
+    }
+  }
+}
+
+TEST(shuffler_empty)
+{
+  Shuffler shuffler{0};
+  EXPECT(shuffler.next() == std::size_t(-1));
+  EXPECT(shuffler.next({0, 1}) == std::size_t(-1));
+}
@@ -0,0 +1,592 @@
+#include <tests/tests.h>
+#include <common/media/image.h>
+#include <common/media/streamer.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+  // Colours are 0xBBGGRR, as the streamer gives them out less the alpha.
+  struct GifFrame {
+    int left;
+    int top;
+    int width;
+    int height;
+    int disposal;
+    // Index drawn as transparent, or -1 for none.
+    int transparent;
+    // Empty to use the global palette.
+    std::vector<uint32_t> palette;
+    // One per pixel of the frame, in row order even if interlaced.
+    std::vector<uint8_t> indices;
+    bool interlace;
+  };
+
+  struct Gif {
+    int width;
+    int height;
+    std::vector<uint32_t> palette;
+    std::vector<GifFrame> frames;
+  };
+
+  // Bits per entry of a palette of the given size, as GIF palettes are powers of two.
+  int palette_bits(std::size_t size)
+  {
+    int bits = 1;
+    while ((std::size_t(1) << bits) < size) {
+      ++bits;
+    }
+    return bits;
+  }
+
+  // The palette as the file stores it, padded with black.
+  std::vector<uint32_t> padded(const std::vector<uint32_t>& palette)
+  {
+    auto p = palette;
+    p.resize(std::size_t(1) << palette_bits(palette.size()));
+    return p;
+  }
+
+  class GifWriter
+  {
+  public:
+    const std::vector<uint8_t>& bytes() const
+    {
+      return _bytes;
+    }
+
+    void byte(int b)
+    {
+      _bytes.push_back(uint8_t(b));
+    }
+
+    void word(int w)
+    {
+      byte(w & 0xff);
+      byte(w >> 8);
+    }
+
+    void palette(const std::vector<uint32_t>& palette)
+    {
+      for (auto c : padded(palette)) {
+        byte(c & 0xff);
+        byte((c >> 8) & 0xff);
+        byte((c >> 16) & 0xff);
+      }
+    }
+
+    // LZW-codes the indices with 8-bit literals only, clearing the table
+    // often enough that codes stay 9 bits wide.
+    void image_data(const std::vector<uint8_t>& indices)
+    {
+      const int clear = 256;
+      const int end = 257;
+      byte(8);
+      code(clear);
+      for (std::size_t i = 0; i < indices.size(); ++i) {
+        if (i && !(i % 200)) {
+          code(clear);
+        }
+        code(indices[i]);
+      }
+      code(end);
+      if (_bit_count) {
+        _block.push_back(uint8_t(_bits));
+      }
+      flush();
+      byte(0);
+      _bits = 0;
+      _bit_count = 0;
+    }
+
+  private:
+    void code(int c)
+    {
+      _bits |= uint32_t(c) << _bit_count;
+      _bit_count += 9;
+      while (_bit_count >= 8) {
+        _block.push_back(uint8_t(_bits));
+        _bits >>= 8;
+        _bit_count -= 8;
+        if (_block.size() == 255) {
+          flush();
+        }
+      }
+    }
+
+    void flush()
+    {
+      if (!_block.empty()) {
+        byte(int(_block.size()));
+        _bytes.insert(_bytes.end(), _block.begin(), _block.end());
+        _block.clear();
+      }
+    }
+
+    std::vector<uint8_t> _bytes;
+    std::vector<uint8_t> _block;
+    uint32_t _bits = 0;
+    int _bit_count = 0;
+  };
+
+  std::vector<uint8_t> encode_gif(const Gif& gif)
+  {
+    GifWriter w;
+    for (auto c : std::string{"GIF89a"}) {
+      w.byte(c);
+    }
+    w.word(gif.width);
+    w.word(gif.height);
+    auto bits = palette_bits(gif.palette.size());
+    w.byte(gif.palette.empty() ? 0 : 0x80 | ((bits - 1) << 4) | (bits - 1));
+    w.byte(0);
+    w.byte(0);
+    if (!gif.palette.empty()) {
+      w.palette(gif.palette);
+    }
+
+    for (const auto& frame : gif.frames) {
+      // Graphics control extension.
+      w.byte(0x21);
+      w.byte(0xf9);
+      w.byte(4);
+      w.byte((frame.disposal << 2) | (frame.transparent >= 0));
+      w.word(0);
+      w.byte(std::max(0, frame.transparent));
+      w.byte(0);
+
+      w.byte(0x2c);
+      w.word(frame.left);
+      w.word(frame.top);
+      w.word(frame.width);
+      w.word(frame.height);
+      auto local_bits = palette_bits(frame.palette.size());
+      w.byte((frame.palette.empty() ? 0 : 0x80 | (local_bits - 1)) | (frame.interlace ? 0x40 : 0));
+      if (!frame.palette.empty()) {
+        w.palette(frame.palette);
+      }
+      auto indices = frame.indices;
+      if (frame.interlace) {
+        indices.clear();
+        const int offsets[] = {0, 4, 2, 1};
+        const int steps[] = {8, 8, 4, 2};
+        for (int pass = 0; pass < 4; ++pass) {
+          for (int y = offsets[pass]; y < frame.height; y += steps[pass]) {
+            auto row = frame.indices.begin() + std::size_t(y) * frame.width;
+            indices.insert(indices.end(), row, row + frame.width);
+          }
+        }
+      }
+      w.image_data(indices);
+    }
+    w.byte(0x3b);
+    return w.bytes();
+  }
+
+  std::string write_gif(const std::string& directory, const std::string& name, const Gif& gif)
+  {
+    auto path = directory + "/" + name + ".gif";
+    auto bytes = encode_gif(gif);
+    std::ofstream file{path, std::ios::binary};
+    file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    return path;
+  }
+
+  // Composites every frame onto a full RGBA canvas, as the GIF format describes: undrawn pixels
+  // are transparent, and each frame's disposal applies before the next is drawn.
+  std::vector<std::vector<uint32_t>> reference_frames(const Gif& gif)
+  {
+    std::vector<std::vector<uint32_t>> frames;
+    std::vector<uint32_t> canvas(std::size_t(gif.width) * gif.height, 0);
+    std::vector<uint32_t> saved;
+    const GifFrame* last = nullptr;
+    for (const auto& frame : gif.frames) {
+      if (last && last->disposal == 2) {
+        for (int y = last->top; y < std::min(gif.height, last->top + last->height); ++y) {
+          for (int x = last->left; x < std::min(gif.width, last->left + last->width); ++x) {
+            canvas[std::size_t(y) * gif.width + x] = 0;
+          }
+        }
+      } else if (last && last->disposal == 3) {
+        canvas = saved;
+      }
+      if (frame.disposal == 3) {
+        saved = canvas;
+      }
+      auto palette = padded(frame.palette.empty() ? gif.palette : frame.palette);
+      for (int y = frame.top; y < std::min(gif.height, frame.top + frame.height); ++y) {
+        for (int x = frame.left; x < std::min(gif.width, frame.left + frame.width); ++x) {
+          auto index = frame.indices[std::size_t(y - frame.top) * frame.width + x - frame.left];
+          if (index != frame.transparent) {
+            canvas[std::size_t(y) * gif.width + x] = palette[index] | 0xff000000;
+          }
+        }
+      }
+      frames.push_back(canvas);
+      last = &frame;
+    }
+    return frames;
+  }
+
+  // The image's pixels as RGBA, looking indices up in its palette.
+  std::vector<uint32_t> rgba(const Image& image)
+  {
+    std::vector<uint32_t> pixels(std::size_t(image.width()) * image.height());
+    auto data = image.get_pixels();
+    if (image.format() == PixelFormat::RGBA) {
+      memcpy(pixels.data(), data, 4 * pixels.size());
+      return pixels;
+    }
+    auto row = 4 * std::size_t(image.texture_width());
+    uint32_t palette[256];
+    memcpy(palette, data + image.height() * row, sizeof(palette));
+    for (uint32_t y = 0; y < image.height(); ++y) {
+      for (uint32_t x = 0; x < image.width(); ++x) {
+        pixels[std::size_t(y) * image.width() + x] = palette[data[y * row + x]];
+      }
+    }
+    return pixels;
+  }
+
+  // Checks the frames the streamer gives out from here on against the reference, from the
+  // given one to the end, and that it ends there. Returns false on the first mismatch.
+  bool check_frames(Streamer& streamer, const std::vector<std::vector<uint32_t>>& expected,
+                    std::size_t first, const Gif& gif, const std::string& name,
+                    std::vector<PixelFormat>* formats = nullptr)
+  {
+    for (auto i = first; i < expected.size(); ++i) {
+      auto image = streamer.next_frame();
+      if (!image || image.width() != uint32_t(gif.width) ||
+          image.height() != uint32_t(gif.height) || rgba(image) != expected[i]) {
+        test_failure(__FILE__, __LINE__, name + ": frame " + std::to_string(i) + " differs");
+        return false;
+      }
+      if (formats) {
+        formats->push_back(image.format());
+      }
+    }
+    if (streamer.next_frame()) {
+      test_failure(__FILE__, __LINE__, name + ": frames after the last");
+      return false;
+    }
+    return true;
+  }
+
+  // Colours from a small set, so that palettes often share some.
+  uint32_t random_colour(std::mt19937& generator)
+  {
+    const uint32_t colours[] = {0x000000, 0xffffff, 0x0000ff, 0x00ff00, 0xff0000, 0x804020};
+    return colours[generator() % 6];
+  }
+
+  std::vector<uint32_t> random_palette(std::mt19937& generator)
+  {
+    const std::size_t sizes[] = {2, 3, 4, 16, 256};
+    std::vector<uint32_t> palette(sizes[generator() % 5]);
+    for (auto& c : palette) {
+      c = random_colour(generator);
+    }
+    return palette;
+  }
+
+  Gif random_gif(std::mt19937& generator)
+  {
+    Gif gif;
+    gif.width = 1 + generator() % 12;
+    gif.height = 1 + generator() % 9;
+    gif.palette = random_palette(generator);
+    auto frame_count = 1 + generator() % 8;
+    for (uint32_t f = 0; f < frame_count; ++f) {
+      GifFrame frame;
+      if (generator() % 4) {
+        // Some frames hang off the right and bottom of the canvas.
+        frame.left = generator() % gif.width;
+        frame.top = generator() % gif.height;
+        frame.width = 1 + generator() % (gif.width + 2 - frame.left);
+        frame.height = 1 + generator() % (gif.height + 2 - frame.top);
+      } else {
+        frame.left = frame.top = 0;
+        frame.width = gif.width;
+        frame.height = gif.height;
+      }
+      frame.disposal = generator() % 4;
+      if (generator() % 3 == 0) {
+        frame.palette = random_palette(generator);
+      }
+      auto colour_count = (frame.palette.empty() ? gif.palette : frame.palette).size();
+      frame.transparent = generator() % 2 ? int(generator() % colour_count) : -1;
+      frame.indices.resize(std::size_t(frame.width) * frame.height);
+      // Some frames draw few colours, so that indices are left free.
+      auto colours = generator() % 2 ? colour_count : 1 + generator() % 3;
+      for (auto& i : frame.indices) {
+        i = uint8_t(generator() % std::min(colours, colour_count));
+      }
+      frame.interlace = generator() % 4 == 0;
+      gif.frames.push_back(frame);
+    }
+    return gif;
+  }
+
+  // A frame of one index, with no transparency, left in place.
+  GifFrame filled(int left, int top, int width, int height, uint8_t index)
+  {
+    return {left, top, width, height, 1, -1, {}, std::vector<uint8_t>(width * height, index),
+            false};
+  }
+
+  // Checks the GIF's frames against the reference, and that the streamer gives them out in the
+  // formats expected.
+  void check_formats(const std::string& name, const Gif& gif,
+                     const std::vector<PixelFormat>& expected)
+  {
+    GifStreamer streamer{write_gif(test_temp_directory(name), name, gif)};
+    EXPECT(streamer.success());
+    std::vector<PixelFormat> formats;
+    if (check_frames(streamer, reference_frames(gif), 0, gif, name, &formats)) {
+      EXPECT(formats == expected);
+    }
+  }
+
+  // FNV-1a over an I420 frame's visible samples: the Y plane, then U, then V.
+  uint32_t i420_hash(const Image& image)
+  {
+    auto row = std::size_t(image.texture_width());
+    auto chroma_width = (image.width() + 1) / 2;
+    auto chroma_height = (image.height() + 1) / 2;
+    auto luma = image.get_pixels();
+    auto chroma = luma + row * image.height();
+    uint32_t hash = 0x811c9dc5;
+    auto add = [&](const uint8_t* samples, uint32_t width, uint32_t height) {
+      for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+          hash = (hash ^ samples[y * row + x]) * 0x01000193;
+        }
+      }
+    };
+    add(luma, image.width(), image.height());
+    add(chroma, chroma_width, chroma_height);
+    add(chroma + chroma_width, chroma_width, chroma_height);
+    return hash;
+  }
+
+  // Checks the streamer's frames from the given one on against the hashes of each of the clip's
+  // frames, and that none come after the last.
+  bool check_webm_frames(WebmStreamer& streamer, const std::vector<uint32_t>& expected,
+                         std::size_t first, const std::string& name)
+  {
+    for (auto i = first; i < expected.size(); ++i) {
+      auto image = streamer.next_frame();
+      if (!image || image.format() != PixelFormat::I420 || i420_hash(image) != expected[i]) {
+        test_failure(__FILE__, __LINE__, name + ": frame " + std::to_string(i) +
+                                             (image ? " differs" : " missing"));
+        return false;
+      }
+    }
+    if (streamer.next_frame()) {
+      test_failure(__FILE__, __LINE__, name + ": frames after the last");
+      return false;
+    }
+    return true;
+  }
+}
+
+// Streams random GIFs, with frames of every disposal mode, with and without transparency and
+// palettes of their own, covering the canvas or part of it, and checks every frame against a
+// compositor working on RGBA. Then checks the same again after resetting part way through, and
+// after seeking.
+TEST(gif_streamer_matches_reference)
+{
+  auto directory = test_temp_directory("gif_streamer_matches_reference");
+  std::mt19937 generator{5};
+  for (uint32_t trial = 0; trial < 300; ++trial) {
+    auto gif = random_gif(generator);
+    auto name = "gif " + std::to_string(trial);
+    auto path = write_gif(directory, std::to_string(trial), gif);
+    auto expected = reference_frames(gif);
+
+    GifStreamer streamer{path};
+    EXPECT(streamer.success());
+    if (!check_frames(streamer, expected, 0, gif, name)) {
+      return;
+    }
+
+    auto stop = generator() % (expected.size() + 1);
+    streamer.reset();
+    for (std::size_t i = 0; i < stop; ++i) {
+      streamer.next_frame();
+    }
+    streamer.reset();
+    if (!check_frames(streamer, expected, 0, gif, name + " after reset")) {
+      return;
+    }
+
+    auto frame = generator() % expected.size();
+    EXPECT(streamer.seek(frame));
+    if (!check_frames(streamer, expected, frame, gif, name + " after seek")) {
+      return;
+    }
+  }
+}
+
+// An interlaced frame, then one sub-rect frame with each disposal mode in turn, each with
+// transparent pixels, so that what each leaves for the next shows.
+TEST(gif_streamer_disposal_modes)
+{
+  auto directory = test_temp_directory("gif_streamer_disposal_modes");
+  Gif gif{9, 10, {0x000000, 0x0000ff, 0x00ff00, 0xff0000}, {}};
+  auto frame = [&](int left, int top, int width, int height, int disposal, uint8_t index) {
+    GifFrame f{left, top, width, height, disposal, 0, {}, {}, false};
+    f.indices.resize(std::size_t(width) * height, index);
+    // Transparent down the diagonal.
+    for (int i = 0; i < std::min(width, height); ++i) {
+      f.indices[std::size_t(i) * width + i] = 0;
+    }
+    return f;
+  };
+  gif.frames.push_back(frame(0, 0, 9, 10, 1, 1));
+  gif.frames.back().interlace = true;
+  for (int disposal = 0; disposal < 4; ++disposal) {
+    gif.frames.push_back(frame(disposal, 2 * disposal, 5, 3, disposal, uint8_t(2 + disposal % 2)));
+  }
+  gif.frames.push_back(frame(2, 2, 4, 4, 3, 3));
+  gif.frames.push_back(frame(1, 1, 2, 2, 2, 2));
+  gif.frames.push_back(frame(0, 0, 3, 3, 0, 3));
+
+  GifStreamer streamer{write_gif(directory, "disposal", gif)};
+  EXPECT(streamer.success());
+  check_frames(streamer, reference_frames(gif), 0, gif, "disposal");
+}
+
+// Draws half the canvas with 254 colours, including the last, so that the index marking the
+// undrawn pixels has to move past it. Then draws the other half with the other 255 colours of
+// the palette, over a transparent half. No index is left free to mark the undrawn pixels, so the
+// canvas has to become RGBA, and stay so through a frame disposed to the background.
+TEST(gif_streamer_full_palette_with_transparency)
+{
+  Gif gif{32, 16, {}, {}};
+  for (uint32_t i = 0; i < 256; ++i) {
+    gif.palette.push_back(i * 0x010101);
+  }
+  auto top = filled(0, 0, 32, 8, 0);
+  for (std::size_t i = 0; i < top.indices.size(); ++i) {
+    top.indices[i] = uint8_t(i % 254 == 253 ? 255 : i % 254);
+  }
+  gif.frames.push_back(top);
+  auto bottom = filled(0, 0, 32, 16, 0);
+  bottom.transparent = 0;
+  for (std::size_t i = 256; i < bottom.indices.size(); ++i) {
+    bottom.indices[i] = uint8_t(1 + i % 255);
+  }
+  gif.frames.push_back(bottom);
+  gif.frames.push_back(filled(4, 4, 8, 8, 7));
+  gif.frames.back().disposal = 2;
+  gif.frames.push_back(filled(20, 2, 4, 4, 9));
+  check_formats("full_palette", gif,
+                {PixelFormat::INDEXED, PixelFormat::RGBA, PixelFormat::RGBA, PixelFormat::RGBA});
+}
+
+// Frames with palettes of their own: one changes a colour the canvas doesn't show, one brings the
+// same colour the canvas already shows, and both stay indexed. The last changes a colour that's
+// showing, so the canvas has to become RGBA.
+TEST(gif_streamer_local_palettes)
+{
+  Gif gif{8, 8, {0x000000, 0x0000ff, 0x00ff00, 0xff0000}, {}};
+  auto halves = filled(0, 0, 8, 8, 0);
+  for (std::size_t i = 0; i < halves.indices.size(); ++i) {
+    halves.indices[i] = i % 8 >= 4;
+  }
+  gif.frames.push_back(halves);
+  gif.frames.push_back(filled(0, 0, 4, 4, 2));
+  gif.frames.back().palette = {0x000000, 0x0000ff, 0xffffff, 0x00ffff};
+  gif.frames.push_back(filled(2, 2, 4, 4, 0));
+  gif.frames.back().palette = {0x000000, 0x804020};
+  gif.frames.push_back(filled(4, 4, 4, 4, 1));
+  gif.frames.back().palette = {0x000000, 0x00ff00};
+  check_formats("local_palettes", gif, {PixelFormat::INDEXED, PixelFormat::INDEXED,
+                                        PixelFormat::INDEXED, PixelFormat::RGBA});
+}
+
+// Falls back to RGBA, then draws a full-cover frame that has to be kept for the next, which
+// can't go back to indices, and then one that isn't, which can. Frames disposed to the background
+// after that need an index for the undrawn pixels again.
+TEST(gif_streamer_full_cover_after_rgba)
+{
+  Gif gif{6, 5, {0x000000, 0x0000ff, 0x00ff00, 0xff0000}, {}};
+  gif.frames.push_back(filled(0, 0, 3, 5, 1));
+  gif.frames.push_back(filled(3, 0, 3, 5, 1));
+  gif.frames.back().palette = {0x000000, 0xffffff};
+  gif.frames.push_back(filled(0, 0, 6, 5, 2));
+  gif.frames.back().disposal = 3;
+  gif.frames.push_back(filled(1, 1, 2, 2, 3));
+  auto full = filled(0, 0, 6, 5, 0);
+  full.palette = {0x804020, 0x00ffff, 0xff00ff, 0xffff00};
+  for (std::size_t i = 0; i < full.indices.size(); ++i) {
+    full.indices[i] = uint8_t(i % 4);
+  }
+  gif.frames.push_back(full);
+  gif.frames.push_back(filled(1, 1, 2, 2, 2));
+  gif.frames.back().disposal = 2;
+  gif.frames.back().palette = full.palette;
+  gif.frames.push_back(filled(4, 2, 2, 2, 3));
+  gif.frames.back().palette = full.palette;
+  check_formats("full_cover_after_rgba", gif,
+                {PixelFormat::INDEXED, PixelFormat::RGBA, PixelFormat::RGBA, PixelFormat::RGBA,
+                 PixelFormat::INDEXED, PixelFormat::INDEXED, PixelFormat::INDEXED});
+}
+
+// Streams 96x54 VP8 and VP9 clips of 30 frames, with a keyframe every 10, on one codec thread and
+// on several, each with and without frame-parallel decoding, and checks every frame against
+// hashes of ffmpeg's decoding of the same clips. Frame-parallel decoding, where the codec has it,
+// holds back the last few frames until the decoder is flushed at the end of the file. Then checks
+// the same again after resetting part way through, and after seeking back past a keyframe.
+TEST(webm_streamer_decode_threads)
+{
+  struct Clip {
+    std::string file;
+    std::vector<uint32_t> hashes;
+  };
+  std::vector<Clip> clips = {
+      {"webm/vp8.webm",
+       {0x9407cf9c, 0x24269ec2, 0x30aebb52, 0xacde5879, 0x1bdc31e8, 0xc9802a7b,
+        0xd92f5ecb, 0x47e04b82, 0x1a66008e, 0x3e416ec0, 0xa45e2a05, 0x4c92a8aa,
+        0x9ca1b686, 0x4435abb9, 0xa89e86cf, 0xf1787f8f, 0x5b9e5689, 0x7b1432df,
+        0x067be7f2, 0x19e4d200, 0xddfee8a8, 0x996c8abb, 0x660432a4, 0x787f2ba1,
+        0xd5348783, 0x07b5ebbb, 0x6faec439, 0x0b9aadd7, 0x39a88064, 0x8115d6ac}},
+      {"webm/vp9.webm",
+       {0xd88e5079, 0x16c249f9, 0x2829ff40, 0xffac66b9, 0x1ba53f0e, 0xb4723387,
+        0x1f911216, 0x87e0b97c, 0xfd1a0356, 0x01a3d5a9, 0x8a2bc05e, 0xcd7f208d,
+        0x1d4f0ea6, 0xb37d2f5f, 0x23de959a, 0x21ef42c3, 0x5e172a85, 0x4bf37701,
+        0x5107cc77, 0x166c9e61, 0x7349a049, 0xe4d57c04, 0x5cea9f58, 0x4c23b91b,
+        0x9433d91b, 0x7e4d5d4f, 0x28637806, 0x36add5c3, 0x8fe1604e, 0x77636e9b}},
+  };
+  for (const auto& clip : clips) {
+    for (uint32_t threads : {1u, 4u}) {
+      for (bool frame_parallel : {false, true}) {
+        auto name = clip.file + " on " + std::to_string(threads) + " threads" +
+            (frame_parallel ? " frame-parallel" : "");
+        WebmStreamer streamer{test_data_path(clip.file), threads, frame_parallel};
+        EXPECT(streamer.success());
+        if (!check_webm_frames(streamer, clip.hashes, 0, name)) {
+          continue;
+        }
+
+        streamer.reset();
+        for (std::size_t i = 0; i < 7; ++i) {
+          streamer.next_frame();
+        }
+        streamer.reset();
+        if (!check_webm_frames(streamer, clip.hashes, 0, name + " after reset")) {
+          continue;
+        }
+
+        EXPECT(streamer.seek(15));
+        check_webm_frames(streamer, clip.hashes, 15, name + " after seek");
+      }
+    }
+  }
+}
@@ -0,0 +1,36 @@
+#ifndef TRANCE_SRC_TESTS_TESTS_H
+#define TRANCE_SRC_TESTS_TESTS_H
+#include <string>
+
+// Tests and benchmarks for tests.exe. Each file defines its own with the macros below; main runs
+// every test, and every benchmark too if given --benchmark.
+struct TestRegistration {
+  TestRegistration(const char* name, void (*function)(), bool benchmark);
+};
+
+// Marks the test that's running as failed.
+void test_failure(const char* file, int line, const std::string& message);
+// Path of a file or directory under src/tests/data, or under --test_data if given.
+std::string test_data_path(const std::string& name);
+// Path of an empty directory of the given name under the system's temporary directory, for files
+// the test writes. Anything left there from an earlier run is deleted first.
+std::string test_temp_directory(const std::string& name);
+
+#define TEST(name)                                                        \
+  static void name();                                                     \
+  static const TestRegistration name##_registration{#name, &name, false}; \
+  static void name()
+
+#define BENCHMARK(name)                                                  \
+  static void name();                                                    \
+  static const TestRegistration name##_registration{#name, &name, true}; \
+  static void name()
+
+#define EXPECT(condition)                            \
+  do {                                               \
+    if (!(condition)) {                              \
+      test_failure(__FILE__, __LINE__, #condition); \
+    }                                                \
+  } while (false)
+
+#endif
@@ -0,0 +1,144 @@
+#include <tests/tests.h>
+#include <common/util.h>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+  // The splitting as it was when parts were copied out, kept as the reference
+  // for which parts there should be.
+  std::vector<std::string> reference_split(const std::string& text, bool split_words)
+  {
+    std::vector<std::string> result;
+    std::string s = text;
+    while (!s.empty()) {
+      auto of = split_words ? " \t\r\n" : "\r\n";
+      auto p = s.find_first_of(of);
+      auto q = s.substr(0, p != std::string::npos ? p : s.size());
+      if (!q.empty()) {
+        result.push_back(q);
+      }
+      s = s.substr(p != std::string::npos ? 1 + p : s.size());
+    }
+    if (result.empty()) {
+      result.emplace_back();
+    }
+    return result;
+  }
+
+  std::vector<std::string> split_parts(const std::string& text, bool split_words)
+  {
+    std::vector<std::string> parts;
+    for (const auto& part : split_text(text, split_words)) {
+      parts.push_back(text.substr(part.first, part.second));
+    }
+    return parts;
+  }
+
+  void check_split(const std::string& text, bool split_words,
+                   const std::vector<std::string>& expected)
+  {
+    if (split_parts(text, split_words) != expected) {
+      test_failure(__FILE__, __LINE__, (split_words ? "words of \"" : "lines of \"") + text +
+                                           "\" differ");
+    }
+  }
+}
+
+// Interns the text lines of a few themes, with lines repeated within and
+// between themes, empty lines, lines that are prefixes of others and lines
+// with embedded newlines and null characters, and checks that each reads back
+// byte for byte, that equal lines share an ID and that distinct ones are given
+// the next free ID, before and after interning is finished.
+TEST(text_arena_interns_lines_once)
+{
+  std::vector<std::vector<std::string>> themes = {
+      {"Relax", "Relax", "", "Relax and sink", "Relax and sink deeper", "deeper"},
+      {"", "", "Relax and sink", "Relax", "Sink\ndeeper\r\n", std::string{"nul\0l", 5}},
+      {},
+      {"deeper", std::string{"nul\0", 4}, std::string{"nul\0l", 5}, " ", "  ", "\n"},
+  };
+  std::mt19937 generator{3};
+  std::vector<std::string> random_theme;
+  for (std::size_t i = 0; i < 2000; ++i) {
+    // A small alphabet, so that many lines repeat or share prefixes.
+    std::string line(generator() % 6, ' ');
+    for (auto& c : line) {
+      c = "ab \n"[generator() % 4];
+    }
+    random_theme.push_back(line);
+  }
+  themes.push_back(random_theme);
+
+  TextArena arena;
+  std::map<std::string, uint32_t> ids{{std::string{}, 0}};
+  std::vector<std::vector<uint32_t>> theme_ids;
+  for (const auto& theme : themes) {
+    theme_ids.emplace_back();
+    for (const auto& line : theme) {
+      auto id = arena.intern(line);
+      auto it = ids.find(line);
+      if (it == ids.end()) {
+        EXPECT(id == ids.size());
+        ids.emplace(line, id);
+      } else {
+        EXPECT(id == it->second);
+      }
+      theme_ids.back().push_back(id);
+      EXPECT(arena.get(id) == line);
+    }
+  }
+  EXPECT(arena.intern("") == 0);
+  EXPECT(arena.intern("Relax and sink") == ids["Relax and sink"]);
+
+  arena.finish();
+  EXPECT(arena.get(0).empty());
+  for (std::size_t t = 0; t < themes.size(); ++t) {
+    for (std::size_t i = 0; i < themes[t].size(); ++i) {
+      if (arena.get(theme_ids[t][i]) != themes[t][i]) {
+        test_failure(__FILE__, __LINE__, "line " + std::to_string(i) + " of theme " +
+                                             std::to_string(t) + " differs after finishing");
+      }
+    }
+  }
+}
+
+// Splits text into lines and into words, checking the parts of some texts by
+// hand and those of random ones against the reference.
+TEST(split_text_finds_lines_and_words)
+{
+  check_split("", false, {""});
+  check_split("", true, {""});
+  check_split("\n\r\n", false, {""});
+  check_split(" \t\n", true, {""});
+  check_split("Relax", false, {"Relax"});
+  check_split("Relax and\tsink", false, {"Relax and\tsink"});
+  check_split("Relax and\tsink", true, {"Relax", "and", "sink"});
+  check_split("Relax\r\nand sink\n\ndeeper\n", false, {"Relax", "and sink", "deeper"});
+  check_split("Relax\r\nand sink\n\ndeeper\n", true, {"Relax", "and", "sink", "deeper"});
+  check_split("  two  spaces ", true, {"two", "spaces"});
+  check_split("  two  spaces ", false, {"  two  spaces "});
+
+  EXPECT(split_text("", false) == (std::vector<std::pair<std::size_t, std::size_t>>{{0, 0}}));
+  EXPECT(split_text("a\nbc", false) ==
+         (std::vector<std::pair<std::size_t, std::size_t>>{{0, 1}, {2, 2}}));
+
+  std::mt19937 generator{11};
+  for (std::size_t i = 0; i < 5000; ++i) {
+    std::string text(generator() % 12, ' ');
+    for (auto& c : text) {
+      c = "ab \t\r\n"[generator() % 6];
+    }
+    for (bool split_words : {false, true}) {
+      if (split_parts(text, split_words) != reference_split(text, split_words)) {
+        test_failure(__FILE__, __LINE__, "random text " + std::to_string(i) + " splits " +
+                                             (split_words ? "words" : "lines") +
+                                             " differently");
+      }
+    }
+  }
+}
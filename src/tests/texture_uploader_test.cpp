@@ -0,0 +1,211 @@
+#include <tests/tests.h>
+#include <common/media/image.h>
+#include <trance/media/texture_uploader.h>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#pragma warning(push, 0)
+#include <GL/glew.h>
+#include <SFML/Window/Context.hpp>
+#include <libvpx/vpx_image.h>
+#pragma warning(pop)
+
+namespace
+{
+  // Makes textures as Image would without an allocator, and keeps track of those given out and
+  // not yet given back.
+  class CountingAllocator : public TextureAllocator
+  {
+  public:
+    uint32_t allocate(uint32_t width, uint32_t height, PixelFormat format) override
+    {
+      Image::set_texture_allocator(nullptr);
+      auto texture = Image::create_texture(width, height, format);
+      Image::set_texture_allocator(this);
+      live.insert(texture);
+      all.push_back(texture);
+      return texture;
+    }
+
+    void release(uint32_t texture, uint32_t, uint32_t, PixelFormat) override
+    {
+      if (!live.erase(texture)) {
+        ++bad_releases;
+      }
+      glDeleteTextures(1, &texture);
+    }
+
+    std::set<uint32_t> live;
+    std::vector<uint32_t> all;
+    std::size_t bad_releases = 0;
+  };
+
+  // Images of each format, at sizes whose rows aren't all a multiple of 4 bytes.
+  std::vector<Image> random_images(std::mt19937& generator, std::size_t count)
+  {
+    std::vector<Image> images;
+    for (std::size_t i = 0; i < count; ++i) {
+      auto width = 1 + uint32_t(generator() % 70);
+      auto height = 1 + uint32_t(generator() % 50);
+      std::vector<uint8_t> bytes(4 * width * height + 1024);
+      for (auto& b : bytes) {
+        b = uint8_t(generator());
+      }
+      if (i % 3 == 0) {
+        images.emplace_back(width, height, bytes.data(), nullptr);
+      } else if (i % 3 == 1) {
+        images.emplace_back(width, height, bytes.data(),
+                            reinterpret_cast<const uint32_t*>(bytes.data() + width * height),
+                            nullptr);
+      } else {
+        vpx_image_t frame{};
+        frame.d_w = width;
+        frame.d_h = height;
+        frame.planes[VPX_PLANE_Y] = bytes.data();
+        frame.planes[VPX_PLANE_U] = bytes.data() + width * height;
+        frame.planes[VPX_PLANE_V] = bytes.data() + 2 * width * height;
+        frame.stride[VPX_PLANE_Y] = int(width);
+        frame.stride[VPX_PLANE_U] = int(width + 1) / 2;
+        frame.stride[VPX_PLANE_V] = int(width + 1) / 2;
+        images.emplace_back(frame);
+      }
+    }
+    return images;
+  }
+
+  // Reads back an image's texture, in the layout of its pixels.
+  std::vector<uint8_t> texture_pixels(const Image& image)
+  {
+    std::vector<uint8_t> pixels(std::size_t(image.byte_size()));
+    glBindTexture(GL_TEXTURE_2D, image.texture());
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, 0, Image::gl_format(image.format()), GL_UNSIGNED_BYTE,
+                  pixels.data());
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return pixels;
+  }
+
+  // Uploads images until each is done or cancelled, checking what ends up in their textures,
+  // then queues more and drops the uploader with them still on their way. Every texture it
+  // took from the allocator must have been given back by the time the images are gone.
+  void check_uploads(bool use_thread, bool sync)
+  {
+    auto name = std::string{use_thread ? "upload thread" : "pixel buffers"} +
+        (sync ? " with sync objects" : " without sync objects");
+    // As on drivers without ARB_sync, where uploads are waited on with glFinish instead.
+    auto had_sync = __GLEW_ARB_sync;
+    __GLEW_ARB_sync = GLboolean(sync && had_sync);
+    CountingAllocator allocator;
+    Image::set_texture_allocator(&allocator);
+
+    std::mt19937 generator{7};
+    {
+      TextureUploader uploader{16 << 10, use_thread};
+      auto images = random_images(generator, 30);
+      std::vector<std::vector<uint8_t>> expected;
+      for (const auto& image : images) {
+        expected.emplace_back(image.get_pixels(),
+                              image.get_pixels() + std::size_t(image.byte_size()));
+      }
+      std::set<const void*> reported;
+      auto report = [&](const Image& image) { reported.insert(image.get_pixel_data().get()); };
+
+      // One is cancelled before it's given a texture, and one probably after.
+      for (const auto& image : images) {
+        uploader.enqueue(image);
+      }
+      images[4].cancel_upload();
+      auto start = std::chrono::steady_clock::now();
+      for (std::size_t frame = 0;; ++frame) {
+        bool done = true;
+        for (const auto& image : images) {
+          if (!image.texture() && !image.upload_cancelled()) {
+            uploader.enqueue(image);
+            done = false;
+          }
+        }
+        if (done) {
+          break;
+        }
+        uploader.update(report);
+        uploader.async_update();
+        if (frame == 0) {
+          images[5].cancel_upload();
+        }
+        if (std::chrono::steady_clock::now() - start > std::chrono::seconds{10}) {
+          test_failure(__FILE__, __LINE__, name + ": uploads never finished");
+          break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+      }
+
+      for (std::size_t i = 0; i < images.size(); ++i) {
+        if (!images[i].texture()) {
+          continue;
+        }
+        if (!reported.count(images[i].get_pixel_data().get())) {
+          test_failure(__FILE__, __LINE__, name + ": image " + std::to_string(i) +
+                                               " uploaded without being passed on");
+        }
+        if (texture_pixels(images[i]) != expected[i]) {
+          test_failure(__FILE__, __LINE__, name + ": image " + std::to_string(i) +
+                                               " differs in its texture");
+        }
+      }
+      EXPECT(!images[4].texture());
+
+      // Leave some queued, some given textures and some uploaded but not handed over, cancelling
+      // every other one.
+      auto more = random_images(generator, 20);
+      for (const auto& image : more) {
+        uploader.enqueue(image);
+      }
+      uploader.update(report);
+      uploader.async_update();
+      for (std::size_t i = 0; i < more.size(); i += 2) {
+        more[i].cancel_upload();
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds{20});
+    }
+    Image::delete_textures();
+
+    if (!allocator.live.empty() || allocator.bad_releases) {
+      test_failure(__FILE__, __LINE__,
+                   name + ": " + std::to_string(allocator.live.size()) +
+                       " textures never given back, " + std::to_string(allocator.bad_releases) +
+                       " given back twice or never given out");
+    }
+    for (auto texture : allocator.all) {
+      if (glIsTexture(texture)) {
+        test_failure(__FILE__, __LINE__, name + ": texture left behind");
+        break;
+      }
+    }
+    Image::set_texture_allocator(nullptr);
+    __GLEW_ARB_sync = had_sync;
+  }
+}
+
+// Runs uploads through pixel buffers on this thread and through the upload thread's own
+// context, each with and without sync objects, and checks that each texture has the image's
+// pixels when it's handed over and that no texture is kept past the uploader.
+TEST(texture_uploader_uploads_and_releases)
+{
+  // Stands in for the rendering thread's context, sharing with the upload thread's.
+  sf::Context context;
+  if (glewInit() != GLEW_OK) {
+    test_failure(__FILE__, __LINE__, "no OpenGL");
+    return;
+  }
+  for (bool use_thread : {false, true}) {
+    for (bool sync : {true, false}) {
+      check_uploads(use_thread, sync);
+    }
+  }
+}
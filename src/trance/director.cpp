@@ -1,4 +1,5 @@
 ﻿#include <trance/director.h>
+#include <common/media/colour.h>
 #include <common/session.h>
 #include <common/util.h>
 #include <trance/media/font.h>
@@ -30,19 +31,27 @@ Director::Director(const trance_pb::Session& session, const trance_pb::System& s
 , _themes{themes}
 , _program{&program}
 , _new_program{0}
+, _i420_program{0}
+, _indexed_program{0}
 , _spiral_program{0}
 , _quad_buffer{0}
 , _renderer{renderer}
 , _last_visual_selection{0}
 {
-  std::cout << "\npreloading GPU" << std::endl;
-  static const std::size_t gl_preload = 1000;
-  for (std::size_t i = 0; i < gl_preload; ++i) {
-    themes.get_image(false);
-    themes.get_image(true);
+  // Starting progressively, images are uploaded as they're first drawn
+  // instead.
+  if (!system.progressive_start()) {
+    std::cout << "\npreloading GPU" << std::endl;
+    static const std::size_t gl_preload = 1000;
+    for (std::size_t i = 0; i < gl_preload; ++i) {
+      themes.get_image(false);
+      themes.get_image(true);
+    }
   }
 
   _new_program = compile(new_vertex, new_fragment);
+  _i420_program = compile(new_vertex, new_i420_fragment);
+  _indexed_program = compile(new_vertex, new_indexed_fragment);
   _spiral_program = compile(spiral_vertex, spiral_fragment);
 
   static const float quad_data[] = {-1.f, -1.f, 1.f, -1.f, -1.f, 1.f,
@@ -80,6 +89,7 @@ bool Director::update()
 void Director::render() const
 {
   Image::delete_textures();
+  _themes.update_uploads();
   _renderer.render([&](Renderer::State state) {
     _render_state = state;
     _visual->render(*_visual_api);
@@ -215,22 +225,44 @@ void Director::render_image(const Image& image, float alpha, float zoom_origin,
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
   glDisable(GL_DEPTH_TEST);
   glDisable(GL_CULL_FACE);
-  glUseProgram(_new_program);
+  // Video frames are kept in YUV, and GIF frames as palette indices, and converted as they're
+  // drawn.
+  bool i420 = image.format() == PixelFormat::I420;
+  bool indexed = image.format() == PixelFormat::INDEXED;
+  auto program = i420 ? _i420_program : indexed ? _indexed_program : _new_program;
+  glUseProgram(program);
 
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, image.texture());
-  glUniform1i(glGetUniformLocation(_new_program, "texture"), 0);
-  glUniform1f(glGetUniformLocation(_new_program, "near_plane"), 1.f);
-  glUniform1f(glGetUniformLocation(_new_program, "far_plane"), 1.f + far_plane_distance());
-  glUniform1f(glGetUniformLocation(_new_program, "eye_offset"), eye_offset());
-  glUniform4f(glGetUniformLocation(_new_program, "colour"), 1.f, 1.f, 1.f, alpha);
+  glUniform1i(glGetUniformLocation(program, "texture"), 0);
+  glUniform1f(glGetUniformLocation(program, "near_plane"), 1.f);
+  glUniform1f(glGetUniformLocation(program, "far_plane"), 1.f + far_plane_distance());
+  glUniform1f(glGetUniformLocation(program, "eye_offset"), eye_offset());
+  glUniform4f(glGetUniformLocation(program, "colour"), 1.f, 1.f, 1.f, alpha);
+  if (i420) {
+    glUniform2f(glGetUniformLocation(program, "texture_size"), float(image.texture_width()),
+                float(image.texture_height()));
+    glUniform2f(glGetUniformLocation(program, "luma_size"), float(image.width()),
+                float(image.height()));
+    glUniform2f(glGetUniformLocation(program, "chroma_size"), float(image.texture_width() / 2),
+                float(image.texture_height() - image.height()));
+    auto conversion = yuv_to_rgb(image.colour_space());
+    glUniformMatrix3fv(glGetUniformLocation(program, "yuv_matrix"), 1, false, conversion.matrix);
+    glUniform3fv(glGetUniformLocation(program, "yuv_offset"), 1, conversion.offset);
+  }
+  if (indexed) {
+    glUniform2f(glGetUniformLocation(program, "texture_size"), float(image.texture_width()),
+                float(image.texture_height()));
+    glUniform2f(glGetUniformLocation(program, "image_size"), float(image.width()),
+                float(image.height()));
+  }
 
-  GLuint position_location = glGetAttribLocation(_new_program, "virtual_position");
+  GLuint position_location = glGetAttribLocation(program, "virtual_position");
   glEnableVertexAttribArray(position_location);
   glBindBuffer(GL_ARRAY_BUFFER, position_buffer);
   glVertexAttribPointer(position_location, 4, GL_FLOAT, false, 0, 0);
 
-  GLuint texture_location = glGetAttribLocation(_new_program, "texture_coord");
+  GLuint texture_location = glGetAttribLocation(program, "texture_coord");
   glEnableVertexAttribArray(texture_location);
   glBindBuffer(GL_ARRAY_BUFFER, texture_buffer);
   glVertexAttribPointer(texture_location, 2, GL_FLOAT, false, 0, 0);
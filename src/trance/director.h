@@ -56,6 +56,8 @@ private:
   const trance_pb::Program* _program;
 
   GLuint _new_program;
+  GLuint _i420_program;
+  GLuint _indexed_program;
   GLuint _spiral_program;
   GLuint _quad_buffer;
 
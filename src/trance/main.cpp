@@ -4,12 +4,14 @@
 #include <trance/director.h>
 #include <trance/media/audio.h>
 #include <trance/media/export.h>
+#include <trance/media/texture_pool.h>
 #include <common/media/image.h>
 #include <trance/render/oculus.h>
 #include <trance/render/openvr.h>
 #include <trance/render/render.h>
 #include <trance/render/video_export.h>
 #include <trance/theme_bank.h>
+#include <algorithm>
 #include <chrono>
 #include <filesystem>
 #include <iostream>
@@ -48,6 +50,8 @@ std::string next_playlist_item(const std::map<std::string, std::string>& variabl
 
 static const std::string bad_alloc = "OUT OF MEMORY! TRY REDUCING USAGE IN SETTINGS...";
 static const uint32_t async_millis = 10;
+// Video memory kept by unused textures waiting to be reused.
+static const uint64_t texture_pool_bytes = uint64_t(256) << 20;
 
 std::thread run_async_thread(std::atomic<bool>& running, ThemeBank& bank)
 {
@@ -94,33 +98,86 @@ void print_info(double elapsed_seconds, uint64_t frames, uint64_t total_frames)
 }
 
 void play_session(const std::string& root_path, const trance_pb::Session& session,
-                  const trance_pb::System& system,
+                  const trance_pb::System& system, const std::string& image_cache_path,
                   const std::map<std::string, std::string> variables,
                   const exporter_settings& settings)
 {
+  // Time from here to the first frame drawn is logged on every launch.
+  const auto startup_time = std::chrono::steady_clock::now();
+  auto startup_millis = [&] {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() -
+                                                                 startup_time)
+        .count();
+  };
+
   struct PlayStackEntry {
     const trance_pb::PlaylistItem* item;
     int subroutine_step;
+    // Chosen as soon as the item starts, so that what comes after it is known
+    // ahead of time.
+    std::string next;
+  };
+  auto start_item = [&](const std::string& name) -> PlayStackEntry {
+    const auto* item = &session.playlist().find(name)->second;
+    return {item, 0, next_playlist_item(variables, item)};
   };
   std::vector<PlayStackEntry> stack;
-  stack.push_back({&session.playlist().find(session.first_playlist_item())->second, 0});
+  stack.push_back(start_item(session.first_playlist_item()));
 
-  auto program = [&]() -> const trance_pb::Program& {
+  auto item_program = [&](const trance_pb::PlaylistItem& item) -> const trance_pb::Program& {
     static const auto default_session = get_default_session();
     static const auto default_program = default_session.program_map().find("default")->second;
-    if (!stack.back().item->has_standard()) {
+    if (!item.has_standard()) {
       return default_program;
     }
-    auto it = session.program_map().find(stack.back().item->standard().program());
+    auto it = session.program_map().find(item.standard().program());
     if (it == session.program_map().end()) {
       return default_program;
     }
     return it->second;
   };
+  auto program = [&]() -> const trance_pb::Program& {
+    return item_program(*stack.back().item);
+  };
 
-  std::cout << "loading themes" << std::endl;
-  auto theme_bank = std::make_unique<ThemeBank>(root_path, session, system, program());
-  std::cout << "\nloaded themes" << std::endl;
+  // Follows the playlist the way the loop below does to find the program that
+  // will play once the current item ends, so that its themes can be loaded
+  // ahead. Null if there's none, or if it depends on a choice not yet made.
+  auto next_program = [&]() -> const trance_pb::Program* {
+    auto next_stack = stack;
+    // Entries from here on were pushed below and have no next item chosen.
+    auto chosen = next_stack.size();
+    while (true) {
+      auto& entry = next_stack.back();
+      if (entry.item->has_subroutine() &&
+          entry.subroutine_step < entry.item->subroutine().playlist_item_name_size() &&
+          next_stack.size() < MAXIMUM_STACK) {
+        auto name = entry.item->subroutine().playlist_item_name(entry.subroutine_step++);
+        const auto& item = session.playlist().find(name)->second;
+        if (item.has_standard()) {
+          return &item_program(item);
+        }
+        next_stack.push_back({&item, 0, {}});
+        continue;
+      }
+      if (next_stack.size() > chosen) {
+        return nullptr;
+      }
+      if (entry.next.empty() && next_stack.size() > 1) {
+        next_stack.pop_back();
+        chosen = std::min(chosen, next_stack.size());
+        continue;
+      } else if (entry.next.empty()) {
+        return nullptr;
+      }
+      const auto& item = session.playlist().find(entry.next)->second;
+      if (item.has_standard()) {
+        return &item_program(item);
+      }
+      entry = {&item, 0, {}};
+      chosen = next_stack.size() - 1;
+    }
+  };
 
   std::unique_ptr<Renderer> renderer;
   bool realtime = settings.path.empty();
@@ -142,9 +199,21 @@ void play_session(const std::string& root_path, const trance_pb::Session& sessio
   if (!renderer) {
     renderer.reset(new ScreenRenderer(system));
   }
+  auto texture_pool = std::make_unique<TexturePool>(texture_pool_bytes);
+  Image::set_texture_allocator(texture_pool.get());
+
+  // Create the renderer first so images can be decoded no larger than needed.
+  std::cout << "loading themes" << std::endl;
+  auto theme_bank =
+      std::make_unique<ThemeBank>(root_path, session, system, program(), renderer->width(),
+                                  renderer->height(), image_cache_path);
+  theme_bank->set_next_program(next_program());
+  auto themes_millis = startup_millis();
+  std::cout << "\nloaded themes" << std::endl;
 
   std::cout << "\nloading session" << std::endl;
-  Director director{session, system, *theme_bank, program(), *renderer};
+  auto director =
+      std::make_unique<Director>(session, system, *theme_bank, program(), *renderer);
   std::cout << "\nloaded session" << std::endl;
 
   std::thread async_thread;
@@ -178,6 +247,7 @@ void play_session(const std::string& root_path, const trance_pb::Session& sessio
     const auto true_clock_start = true_clock_time();
     auto last_clock_time = clock_time();
     auto last_playlist_switch = clock_time();
+    bool started = false;
 
     while (running) {
       handle_events(running, renderer->window());
@@ -229,18 +299,19 @@ void play_session(const std::string& root_path, const trance_pb::Session& sessio
           } else {
             last_playlist_switch = clock_time();
             auto name = entry.item->subroutine().playlist_item_name(entry.subroutine_step);
-            stack.push_back({&session.playlist().find(name)->second, 0});
+            stack.push_back(start_item(name));
             if (realtime) {
               audio->TriggerEvents(*stack.back().item);
             }
             std::cout << "\n-> " << name << std::endl;
-            theme_bank->set_program(program());
-            director.set_program(program());
             ++stack[stack.size() - 2].subroutine_step;
+            theme_bank->set_program(program());
+            theme_bank->set_next_program(next_program());
+            director->set_program(program());
             continue;
           }
         }
-        auto next = next_playlist_item(variables, entry.item);
+        auto next = entry.next;
         // Finish a subroutine.
         if (next.empty() && stack.size() > 1) {
           stack.pop_back();
@@ -250,14 +321,14 @@ void play_session(const std::string& root_path, const trance_pb::Session& sessio
         }
         // Trigger the next item of a standard playlist item.
         last_playlist_switch = clock_time();
-        stack.back().item = &session.playlist().find(next)->second;
-        stack.back().subroutine_step = 0;
+        stack.back() = start_item(next);
         if (realtime) {
           audio->TriggerEvents(*entry.item);
         }
         std::cout << "\n-> " << next << std::endl;
         theme_bank->set_program(program());
-        director.set_program(program());
+        theme_bank->set_next_program(next_program());
+        director->set_program(program());
       }
       if (theme_bank->swaps_to_match_theme()) {
         theme_bank->change_themes();
@@ -268,14 +339,19 @@ void play_session(const std::string& root_path, const trance_pb::Session& sessio
       while (frames_this_loop > 0) {
         update = true;
         --frames_this_loop;
-        continue_playing &= director.update();
+        continue_playing &= director->update();
         theme_bank->advance_frames();
       }
       if (!continue_playing) {
         break;
       }
       if (update || !realtime) {
-        director.render();
+        director->render();
+        if (!started) {
+          started = true;
+          std::cout << "\nstartup: first frame after " << startup_millis()
+                    << "ms (themes loaded after " << themes_millis << "ms)" << std::endl;
+        }
       }
       if (realtime) {
         audio->Update();
@@ -289,6 +365,24 @@ void play_session(const std::string& root_path, const trance_pb::Session& sessio
   if (realtime) {
     async_thread.join();
   }
+  auto frames = theme_bank->animation_frames();
+  auto reused = theme_bank->animation_frames_reused();
+
+  // Everything holding textures goes while the window's OpenGL context is still
+  // there to delete them: first the images, whose textures go back to the pool,
+  // then the pool itself.
+  director.reset();
+  theme_bank.reset();
+  Image::delete_textures();
+  auto hits = texture_pool->hits();
+  auto allocations = texture_pool->allocations();
+  texture_pool.reset();
+  Image::set_texture_allocator(nullptr);
+  std::cout << std::endl
+            << "textures reused: " << hits << " / " << allocations << " ["
+            << (allocations ? 100 * hits / allocations : 0) << "%]" << std::endl;
+  std::cout << "animation frames reused: " << reused << " / " << frames << " ["
+            << (frames ? 100 * reused / frames : 0) << "%]" << std::endl;
   renderer->window().close();
 }
 
@@ -473,6 +567,8 @@ int main(int argc, char** argv)
   if (!FLAGS_export_archive.empty()) {
     return export_archive(root_path, session, FLAGS_export_archive);
   }
-  play_session(root_path, session, system, variables, settings);
+  auto image_cache_path =
+      get_image_cache_path(std::tr2::sys::path{system_path}.parent_path().string());
+  play_session(root_path, session, system, image_cache_path, variables, settings);
   return 0;
 }
\ No newline at end of file
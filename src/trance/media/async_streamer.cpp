@@ -1,5 +1,7 @@
 #include <trance/media/async_streamer.h>
 #include <common/util.h>
+#include <algorithm>
+#include <cmath>
 
 namespace
 {
@@ -7,47 +9,112 @@ namespace
   {
     return (i + buffer_size - 1) % buffer_size;
   }
+
+  // Number of the given kept frame: the first n with floor(n / stride) equal to
+  // it.
+  std::size_t kept_frame(std::size_t kept, float stride)
+  {
+    return std::size_t(std::ceil(double(kept) * stride));
+  }
+}
+
+AsyncStreamer::Queue::Queue(std::size_t capacity) : _slots(capacity + 1), _head{0}, _tail{0}
+{
+}
+
+bool AsyncStreamer::Queue::full() const
+{
+  return (_tail.load(std::memory_order_relaxed) + 1) % _slots.size() ==
+      _head.load(std::memory_order_acquire);
+}
+
+void AsyncStreamer::Queue::push(Frame&& frame)
+{
+  auto tail = _tail.load(std::memory_order_relaxed);
+  _slots[tail] = std::move(frame);
+  _tail.store((tail + 1) % _slots.size(), std::memory_order_release);
+}
+
+AsyncStreamer::Frame* AsyncStreamer::Queue::front()
+{
+  auto head = _head.load(std::memory_order_relaxed);
+  if (head == _tail.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+  return &_slots[head];
+}
+
+void AsyncStreamer::Queue::pop()
+{
+  auto head = _head.load(std::memory_order_relaxed);
+  _slots[head].image = {};
+  _head.store((head + 1) % _slots.size(), std::memory_order_release);
+}
+
+AsyncStreamer::Animation::Animation(std::size_t buffer_size)
+: queue{queue_size}, generation{0}, stride{1.f}, buffer(buffer_size), turn(buffer_size)
+{
 }
 
 AsyncStreamer::AsyncStreamer(const std::function<std::unique_ptr<Streamer>()>& load_function,
                              size_t buffer_size)
-: _load_function{load_function}, _buffer_size{buffer_size}
+: _load_function{load_function}
+, _buffer_size{buffer_size}
+, _frame_pool{buffer_size}
+, _buffer_bytes{0}
+, _a{buffer_size}
+, _b{buffer_size}
+, _current{&_a}
+, _next{&_b}
+, _b_current{false}
+, _retired{2 * buffer_size}
+, _stride{1.f}
+, _wake{false}
+, _running{true}
 {
-  _a.streamer = load_function();
-  _a.buffer.resize(_buffer_size);
-  _b.buffer.resize(_buffer_size);
-  _current = &_a;
-  _next = &_b;
+  // Fill the first buffer before starting, so that there's something to play
+  // straight away.
+  _a.streamer = load();
+  _a.loaded = true;
   while (_a.streamer && !_a.end && _a.size < _buffer_size) {
     auto image = _a.streamer->next_frame();
     if (image) {
+      _buffer_bytes += image.byte_size();
       _a.buffer[_a.size] = image;
       ++_a.size;
     } else {
       _a.end = true;
     }
   }
+  _a.decoded_end = !_a.streamer || _a.end;
+  _a.position = _a.size;
+  _a.last = _a.size ? _a.size - 1 : 0;
+  _a.pushed = _a.size;
+  _thread = std::thread{[this] { run_thread(); }};
 }
 
-void AsyncStreamer::maybe_upload_next(const std::function<void(const Image&)>& function)
+AsyncStreamer::~AsyncStreamer()
 {
   {
-    std::lock_guard<std::mutex> lock{_swap_mutex};
-    if (_current->size) {
-      function(_current->buffer[(_current->begin + random(_current->size)) % _buffer_size]);
-    }
+    std::lock_guard<std::mutex> lock{_wake_mutex};
+    _running = false;
   }
-  {
-    std::lock_guard<std::mutex> lock{_swap_mutex};
-    if (_next->size) {
-      function(_next->buffer[(_next->begin + random(_next->size)) % _buffer_size]);
-    }
+  _wake_condition.notify_one();
+  _thread.join();
+}
+
+void AsyncStreamer::maybe_upload_next(const std::function<void(const Image&)>& function)
+{
+  if (_current->size) {
+    function(_current->buffer[(_current->begin + random(_current->size)) % _buffer_size]);
+  }
+  if (_next->size) {
+    function(_next->buffer[(_next->begin + random(_next->size)) % _buffer_size]);
   }
 }
 
 Image AsyncStreamer::get_frame(const std::function<void(const Image&)>& function) const
 {
-  std::lock_guard<std::mutex> lock{_swap_mutex};
   function(_current->buffer[_index]);
   Image image = _current->buffer[_index];
   return image;
@@ -55,27 +122,34 @@ Image AsyncStreamer::get_frame(const std::function<void(const Image&)>& function
 
 void AsyncStreamer::advance_frame(uint32_t global_fps, bool maybe_switch, bool force_switch)
 {
-  std::lock_guard<std::mutex> lock{_swap_mutex};
-  bool can_change = _current->streamer && _next->streamer && !_old_streamer &&
-      (!_current->streamer->success() || !_current->size ||
-       (maybe_switch && (_reached_end || force_switch) &&
-        (_next->end || _next->size >= _buffer_size)));
+  take_frames();
+  bool can_change = (!_current->size && _next->size) ||
+      (maybe_switch && (_reached_end || force_switch) &&
+       (_next->end || _next->size >= _buffer_size));
   if (can_change) {
     std::swap(_current, _next);
+    _b_current = _current == &_b;
+    for (std::size_t i = 0; i < _next->size; ++i) {
+      retire(std::move(_next->buffer[(_next->begin + i) % _buffer_size]));
+    }
     _next->begin = 0;
     _next->size = 0;
     _next->end = false;
+    ++_next->generation;
     _reached_end = false;
     _backwards = false;
     _index = 0;
-    std::lock_guard<std::mutex> lock{_old_mutex};
-    _old_streamer.swap(_next->streamer);
-    for (auto& image : _next->buffer) {
-      _old_buffer.emplace_back(std::move(image));
-    }
+    take_frames();
+    wake();
   }
 
-  _update_counter += (120.f / global_fps) / 8.f;
+  // The cursor moves step frames per call, so below 15 fps it passes over
+  // some. Animations are then decoded keeping only one frame in every step,
+  // each standing in for the ones skipped, so that the cursor moves one kept
+  // frame per call and the rest are never converted.
+  auto step = (120.f / global_fps) / 8.f;
+  _stride = std::max(1.f, step);
+  _update_counter += step / _current->stride;
   while (_update_counter > 1.f) {
     _update_counter -= 1.f;
     if (_backwards) {
@@ -107,82 +181,249 @@ void AsyncStreamer::advance_frame(uint32_t global_fps, bool maybe_switch, bool f
         }
       }
     }
+    if (_current->turn[_index]) {
+      _reached_end = true;
+    }
   }
   if (_current->end && _index == prev_index(_current->begin + _current->size, _buffer_size)) {
     _reached_end = true;
   }
 }
 
-void AsyncStreamer::async_update(const std::function<void(const Image&)>& cleanup_function)
+uint64_t AsyncStreamer::buffer_bytes() const
 {
-  {
-    std::lock_guard<std::mutex> lock{_old_mutex};
-    if (_old_streamer) {
-      _old_streamer.reset();
-    }
-    if (!_old_buffer.empty()) {
-      cleanup_function(_old_buffer.front());
-      _old_buffer.pop_front();
-    }
+  return _buffer_bytes;
+}
+
+uint64_t AsyncStreamer::texture_bytes() const
+{
+  return _frame_pool.texture_bytes();
+}
+
+const FramePool& AsyncStreamer::frame_pool() const
+{
+  return _frame_pool;
+}
+
+std::unique_ptr<Streamer> AsyncStreamer::load()
+{
+  auto streamer = _load_function();
+  if (streamer) {
+    streamer->set_frame_pool(&_frame_pool);
   }
-  do {
-    std::lock_guard<std::mutex> lock{_old_mutex};
-    if (_old_buffer.size() <= _buffer_size) {
-      break;
+  return streamer;
+}
+
+void AsyncStreamer::take_frames()
+{
+  bool taken = false;
+  for (auto* animation : {_current, _next}) {
+    while (auto* frame = animation->queue.front()) {
+      if (frame->generation != animation->generation) {
+        // Left over from the animation this one replaced.
+        retire(std::move(frame->image));
+      } else if (!frame->image) {
+        animation->end = true;
+      } else if (animation->size < _buffer_size) {
+        auto index = (animation->begin + animation->size) % _buffer_size;
+        animation->buffer[index] = std::move(frame->image);
+        animation->turn[index] = frame->turn;
+        ++animation->size;
+      } else if (animation == _current && _index != animation->begin) {
+        // Replace the oldest frame, unless it's the one showing.
+        retire(std::move(animation->buffer[animation->begin]));
+        animation->buffer[animation->begin] = std::move(frame->image);
+        animation->turn[animation->begin] = frame->turn;
+        animation->begin = (1 + animation->begin) % _buffer_size;
+      } else {
+        break;
+      }
+      animation->queue.pop();
+      taken = true;
     }
-    cleanup_function(_old_buffer.front());
+  }
+  while (!_old_buffer.empty() && !_retired.full()) {
+    _retired.push({0, std::move(_old_buffer.front()), false});
     _old_buffer.pop_front();
-  } while (true);
+    taken = true;
+  }
+  if (taken) {
+    wake();
+  }
+}
+
+void AsyncStreamer::retire(Image&& image)
+{
+  if (image) {
+    image.cancel_upload();
+    _old_buffer.emplace_back(std::move(image));
+  }
+}
+
+void AsyncStreamer::wake()
+{
+  {
+    std::lock_guard<std::mutex> lock{_wake_mutex};
+    _wake = true;
+  }
+  _wake_condition.notify_one();
+}
+
+void AsyncStreamer::run_thread()
+{
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock{_wake_mutex};
+      if (!_running) {
+        return;
+      }
+    }
 
-  do {
-    std::unique_lock<std::mutex> swap_lock{_swap_mutex};
-    if (!_current->streamer || _current->end || _index == _current->begin) {
-      break;
+    // Old frames are freed here rather than on the rendering thread.
+    bool worked = false;
+    while (auto* frame = _retired.front()) {
+      _buffer_bytes -= frame->image.byte_size();
+      _retired.pop();
+      worked = true;
     }
-    swap_lock.unlock();
-    auto image = _current->streamer->next_frame();
-    swap_lock.lock();
-    while (_index == _current->begin) {
-      swap_lock.unlock();
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
-      swap_lock.lock();
+
+    // Decode one frame at a time, keeping the current animation ahead first.
+    auto* first = _b_current ? &_b : &_a;
+    auto* second = first == &_a ? &_b : &_a;
+    worked = decode(*first) || decode(*second) || worked;
+    if (worked) {
+      continue;
     }
+
+    std::unique_lock<std::mutex> lock{_wake_mutex};
+    _wake_condition.wait(lock, [&] { return _wake || !_running; });
+    _wake = false;
+  }
+}
+
+bool AsyncStreamer::decode(Animation& animation)
+{
+  uint32_t generation = animation.generation;
+  if (!animation.loaded || animation.loaded_generation != generation) {
+    drop_run(animation);
+    animation.streamer = load();
+    animation.loaded = true;
+    animation.loaded_generation = generation;
+    animation.decoded_end = false;
+    animation.stride = _stride.load();
+    animation.position = 0;
+    animation.last = 0;
+    animation.pushed = 0;
+    animation.backwards = false;
+    animation.turned = false;
+    return true;
+  }
+  if (animation.decoded_end || animation.queue.full()) {
+    return false;
+  }
+  if (animation.backwards) {
+    return decode_backwards(animation, generation);
+  }
+
+  auto image = animation.streamer ? animation.streamer->next_frame() : Image{};
+  if (image) {
+    _buffer_bytes += image.byte_size();
+    ++animation.position;
+    animation.last = animation.pushed ? animation.last + 1 : 0;
+    push(animation, generation, std::move(image));
+    skip_to(animation, animation.last + 1);
+    return true;
+  }
+  if (animation.pushed <= _buffer_size) {
+    // All of it is buffered, so it plays back and forth there.
+    return finish(animation, generation);
+  }
+  animation.backwards = true;
+  animation.turned = true;
+  return true;
+}
+
+bool AsyncStreamer::decode_backwards(Animation& animation, uint32_t generation)
+{
+  auto& streamer = *animation.streamer;
+  float stride = animation.stride;
+  if (animation.run_left) {
+    auto image = streamer.next_frame();
     if (!image) {
-      _current->end = true;
-      break;
+      return finish(animation, generation);
     }
-    if (_current->size == _buffer_size) {
-      {
-        std::lock_guard<std::mutex> lock{_old_mutex};
-        _old_buffer.emplace_back(std::move(_current->buffer[_current->begin]));
-      }
-      _current->buffer[_current->begin] = image;
-      _current->begin = (1 + _current->begin) % _buffer_size;
-    } else {
-      _current->buffer[(_current->begin + _current->size) % _buffer_size] = image;
-      ++_current->size;
+    _buffer_bytes += image.byte_size();
+    ++animation.position;
+    animation.run.emplace_back(std::move(image));
+    if (--animation.run_left && !skip_to(animation, animation.last - animation.run_left)) {
+      return finish(animation, generation);
     }
-  } while (true);
-
-  std::unique_lock<std::mutex> swap_lock{_swap_mutex};
-  if (!_next->streamer) {
-    swap_lock.unlock();
-    auto next_streamer = _load_function();
-    swap_lock.lock();
-    _next->streamer.swap(next_streamer);
-  }
-  for (auto i = 0; i < 8; ++i) {
-    if (!_next->streamer || _next->end || _next->size == _buffer_size) {
-      break;
+    return true;
+  }
+  if (!animation.run.empty()) {
+    --animation.last;
+    push(animation, generation, std::move(animation.run.back()));
+    animation.run.pop_back();
+    return true;
+  }
+
+  if (!animation.last) {
+    // Back at the start, so turn around again.
+    animation.backwards = false;
+    animation.position = kept_frame(1, stride);
+  } else {
+    // The next run goes back from the frame before the last one pushed as far
+    // as the keyframe before it, but no more than half a buffer of frames, to
+    // bound both the memory held here and the wait before it's handed over.
+    auto run_end = animation.last - 1;
+    auto keyframe = streamer.keyframe(kept_frame(run_end, stride));
+    auto max_run = std::max<std::size_t>(1, _buffer_size / 2);
+    std::size_t run_size = 1;
+    while (run_size < max_run && run_size <= run_end &&
+           kept_frame(run_end - run_size, stride) >= keyframe) {
+      ++run_size;
     }
-    swap_lock.unlock();
-    auto image = _next->streamer->next_frame();
-    swap_lock.lock();
-    if (!image) {
-      _next->end = true;
-      break;
+    animation.position = kept_frame(run_end + 1 - run_size, stride);
+    animation.run_left = run_size;
+  }
+  if (!streamer.seek(animation.position)) {
+    return finish(animation, generation);
+  }
+  return true;
+}
+
+void AsyncStreamer::push(Animation& animation, uint32_t generation, Image&& image)
+{
+  animation.queue.push({generation, std::move(image), animation.turned});
+  animation.turned = false;
+  ++animation.pushed;
+}
+
+bool AsyncStreamer::skip_to(Animation& animation, std::size_t kept)
+{
+  // Frames in between are only decoded as far as later ones depend on them.
+  for (auto frame = kept_frame(kept, animation.stride); animation.position < frame;) {
+    if (!animation.streamer->skip_frame()) {
+      return false;
     }
-    _next->buffer[_next->size] = image;
-    ++_next->size;
+    ++animation.position;
+  }
+  return true;
+}
+
+bool AsyncStreamer::finish(Animation& animation, uint32_t generation)
+{
+  drop_run(animation);
+  animation.decoded_end = true;
+  animation.queue.push({generation, {}, false});
+  return true;
+}
+
+void AsyncStreamer::drop_run(Animation& animation)
+{
+  for (const auto& image : animation.run) {
+    _buffer_bytes -= image.byte_size();
   }
+  animation.run.clear();
+  animation.run_left = 0;
 }
@@ -1,51 +1,166 @@
 #ifndef TRANCE_SRC_TRANCE_MEDIA_ASYNC_STREAMER_H
 #define TRANCE_SRC_TRANCE_MEDIA_ASYNC_STREAMER_H
+#include <common/media/frame_pool.h>
 #include <common/media/image.h>
 #include <common/media/streamer.h>
 #include <atomic>
+#include <condition_variable>
 #include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <thread>
 #include <vector>
 
-// TODO: should really use image pools to avoid allocating every frame separately.
+// Plays animations from a buffer of frames, decoding the current and next
+// animations on a thread of its own. Frames are handed to the rendering thread
+// through lock-free queues, so the rendering thread never waits on decoding.
+// Frames are decoded into buffers recycled through a pool, which keeps as many
+// free buffers as the animation buffer holds frames. When playback is slow
+// enough to step over frames, those are skipped as they're decoded instead of
+// being converted and buffered only never to be shown. The step can be
+// fractional: a frame is kept when it's the first of those n with the same
+// floor(n / stride).
+//
+// Animations play forwards then backwards. One that fits in the buffer does
+// so within it; a longer one is decoded backwards in runs, each decoded
+// forwards from the keyframe before it and handed over in reverse, so that it
+// plays back and forth over its whole length in bounded memory.
 class AsyncStreamer
 {
 public:
   AsyncStreamer(const std::function<std::unique_ptr<Streamer>()>& load_function,
                 size_t buffer_size);
+  ~AsyncStreamer();
 
+  // Called from the rendering thread only.
   void maybe_upload_next(const std::function<void(const Image&)>& function);
   Image get_frame(const std::function<void(const Image&)>& function) const;
   void advance_frame(uint32_t global_fps, bool maybe_switch, bool force_switch);
 
-  // Called from async update thread.
-  void async_update(const std::function<void(const Image&)>& cleanup_function);
+  // Total size of the frames decoded and not yet freed, and of the textures of
+  // those uploaded to video memory. Safe to call from any thread.
+  uint64_t buffer_bytes() const;
+  uint64_t texture_bytes() const;
+  const FramePool& frame_pool() const;
 
 private:
-  mutable std::mutex _swap_mutex;
-  mutable std::mutex _old_mutex;
+  // A decoded frame, tagged with the generation of the animation it belongs
+  // to. An empty image marks the end of the animation. Animations too long to
+  // fit in the buffer never end, but mark the first frame played backwards
+  // after reaching their last one.
+  struct Frame {
+    uint32_t generation;
+    Image image;
+    bool turn;
+  };
+
+  // Fixed-size ring of frames from exactly one producer thread to exactly one
+  // consumer thread.
+  class Queue
+  {
+  public:
+    Queue(std::size_t capacity);
+
+    // Producer only.
+    bool full() const;
+    void push(Frame&& frame);
+    // Consumer only. Returns null if the queue is empty; the frame stays
+    // valid until popped.
+    Frame* front();
+    void pop();
+
+  private:
+    std::vector<Frame> _slots;
+    std::atomic<std::size_t> _head;
+    std::atomic<std::size_t> _tail;
+  };
+
+  // The generation is bumped by the rendering thread when the animation is
+  // replaced, so that the decode thread loads a new one and any frames still
+  // queued from the old one are dropped.
   struct Animation {
-    std::unique_ptr<Streamer> streamer;
+    Animation(std::size_t buffer_size);
+    Queue queue;
+    std::atomic<uint32_t> generation;
+    // One frame is kept for every stride frames, which needn't be a whole
+    // number; set by the decode thread on loading.
+    std::atomic<float> stride;
+
+    // Frames ready to play; rendering thread only.
     std::vector<Image> buffer;
+    std::vector<bool> turn;
     std::size_t begin = 0;
     std::size_t size = 0;
     bool end = false;
+
+    // Decode thread only. Frames are numbered as the streamer gives them out,
+    // except for last, which counts only those kept.
+    std::unique_ptr<Streamer> streamer;
+    bool loaded = false;
+    uint32_t loaded_generation = 0;
+    bool decoded_end = false;
+    std::size_t position = 0;
+    std::size_t last = 0;
+    std::size_t pushed = 0;
+    bool backwards = false;
+    bool turned = false;
+    // Frames of the run being played backwards, in forwards order, and how
+    // many more are still to be decoded.
+    std::vector<Image> run;
+    std::size_t run_left = 0;
   };
+
+  static const std::size_t queue_size = 8;
+
+  std::unique_ptr<Streamer> load();
+  // Moves decoded frames into the buffers and retired frames into the queue
+  // back to the decode thread.
+  void take_frames();
+  void retire(Image&& image);
+  void wake();
+  void run_thread();
+  // Loads or decodes the next step of the animation, if there's room for it.
+  bool decode(Animation& animation);
+  bool decode_backwards(Animation& animation, uint32_t generation);
+  void push(Animation& animation, uint32_t generation, Image&& image);
+  // Skips the frames before the given kept one, returning false at the end.
+  bool skip_to(Animation& animation, std::size_t kept);
+  // Ends the animation, once it's all buffered or if decoding fails.
+  bool finish(Animation& animation, uint32_t generation);
+  void drop_run(Animation& animation);
+
   std::function<std::unique_ptr<Streamer>()> _load_function;
   const size_t _buffer_size;
+  FramePool _frame_pool;
+  std::atomic<uint64_t> _buffer_bytes;
+
   Animation _a;
   Animation _b;
   Animation* _current;
   Animation* _next;
+  // Tells the decode thread which animation to keep ahead of first.
+  std::atomic<bool> _b_current;
+
+  // Frames no longer needed, to be freed by the decode thread. Those that
+  // don't fit wait in _old_buffer.
+  Queue _retired;
   std::deque<Image> _old_buffer;
-  std::unique_ptr<Streamer> _old_streamer;
 
+  // Stride of animations loaded from now on: the number of frames the cursor
+  // moves per call at the last frame rate, if that's more than one.
+  std::atomic<float> _stride;
   float _update_counter = 0.f;
   std::size_t _index = 0;
   bool _backwards = false;
   bool _reached_end = false;
+
+  // Only held to check for work, never while decoding.
+  std::mutex _wake_mutex;
+  std::condition_variable _wake_condition;
+  bool _wake;
+  bool _running;
+  std::thread _thread;
 };
 
-#endif
\ No newline at end of file
+#endif
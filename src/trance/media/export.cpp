@@ -1,4 +1,5 @@
 #include <trance/media/export.h>
+#include <common/media/colour.h>
 #include <iostream>
 
 #pragma warning(push, 0)
@@ -135,25 +136,10 @@ bool WebmExporter::requires_yuv_input() const
 void WebmExporter::encode_frame(const uint8_t* data)
 {
   // Convert YUV to YUV420.
-  for (uint32_t y = 0; y < _settings.height; ++y) {
-    for (uint32_t x = 0; x < _settings.width; ++x) {
-      _img->planes[VPX_PLANE_Y][x + y * _img->stride[VPX_PLANE_Y]] =
-          data[4 * (x + y * _settings.width)];
-    }
-  }
-  for (uint32_t y = 0; y < _settings.height / 2; ++y) {
-    for (uint32_t x = 0; x < _settings.width / 2; ++x) {
-      auto c00 = 4 * (2 * x + 2 * y * _settings.width);
-      auto c01 = 4 * (2 * x + (1 + 2 * y) * _settings.width);
-      auto c10 = 4 * (1 + 2 * x + 2 * y * _settings.width);
-      auto c11 = 4 * (1 + 2 * x + (1 + 2 * y) * _settings.width);
-
-      _img->planes[VPX_PLANE_U][x + y * _img->stride[VPX_PLANE_U]] =
-          (data[1 + c00] + data[1 + c01] + data[1 + c10] + data[1 + c11]) / 4;
-      _img->planes[VPX_PLANE_V][x + y * _img->stride[VPX_PLANE_V]] =
-          (data[2 + c00] + data[2 + c01] + data[2 + c10] + data[2 + c11]) / 4;
-    }
-  }
+  pack_i420(data, _settings.width, _settings.height, _img->planes[VPX_PLANE_Y],
+            _img->stride[VPX_PLANE_Y], _img->planes[VPX_PLANE_U], _img->stride[VPX_PLANE_U],
+            _img->planes[VPX_PLANE_V], _img->stride[VPX_PLANE_V], (_settings.width + 1) / 2,
+            (_settings.height + 1) / 2);
   add_frame(_img);
 }
 
@@ -277,25 +263,10 @@ bool H264Exporter::requires_yuv_input() const
 
 void H264Exporter::encode_frame(const uint8_t* data)
 {
-  // Convert YUV to YUV420.
-  for (uint32_t y = 0; y < _settings.height; ++y) {
-    for (uint32_t x = 0; x < _settings.width; ++x) {
-      _pic.img.plane[0][x + y * _settings.width] = data[4 * (x + y * _settings.width)];
-    }
-  }
-  for (uint32_t y = 0; y < _settings.height / 2; ++y) {
-    for (uint32_t x = 0; x < _settings.width / 2; ++x) {
-      auto c00 = 4 * (2 * x + 2 * y * _settings.width);
-      auto c01 = 4 * (2 * x + (1 + 2 * y) * _settings.width);
-      auto c10 = 4 * (1 + 2 * x + 2 * y * _settings.width);
-      auto c11 = 4 * (1 + 2 * x + (1 + 2 * y) * _settings.width);
-
-      _pic.img.plane[1][x + y * _settings.width / 2] =
-          (data[1 + c00] + data[1 + c01] + data[1 + c10] + data[1 + c11]) / 4;
-      _pic.img.plane[2][x + y * _settings.width / 2] =
-          (data[2 + c00] + data[2 + c01] + data[2 + c10] + data[2 + c11]) / 4;
-    }
-  }
+  // Convert YUV to YUV420. x264 rounds the chroma planes' size down.
+  pack_i420(data, _settings.width, _settings.height, _pic.img.plane[0], _pic.img.i_stride[0],
+            _pic.img.plane[1], _pic.img.i_stride[1], _pic.img.plane[2], _pic.img.i_stride[2],
+            _settings.width / 2, _settings.height / 2);
   _pic.i_pts = _frame;
   add_frame(&_pic);
   _frame++;
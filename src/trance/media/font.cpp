@@ -135,7 +135,8 @@ Font::rectangle Font::compute_size(const std::string& text, bool large) const
 }
 
 FontCache::FontCache(const std::string& root_path, const trance_pb::Session& session,
-                     uint32_t large_char_size, uint32_t small_char_size, uint32_t font_cache_size)
+                     uint32_t large_char_size, uint32_t small_char_size, uint32_t font_cache_size,
+                     uint32_t preload_size)
 : _root_path{root_path}
 , _large_char_size{large_char_size}
 , _small_char_size{small_char_size}
@@ -157,7 +158,7 @@ FontCache::FontCache(const std::string& root_path, const trance_pb::Session& ses
     std::cout << ".";
     font.get_vertices(preload_chars, true);
     font.get_vertices(preload_chars, false);
-    if (++i >= font_cache_size) {
+    if (++i >= std::min(font_cache_size, preload_size)) {
       return;
     }
   }
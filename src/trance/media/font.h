@@ -48,12 +48,14 @@ private:
   std::unique_ptr<sf::Font> _font;
 };
 
-// An LRU cache for font objects.
+// An LRU cache for font objects. Up to preload_size fonts are loaded up front;
+// the rest are loaded when first used.
 class FontCache
 {
 public:
   FontCache(const std::string& root_path, const trance_pb::Session& session,
-            uint32_t large_char_size, uint32_t small_char_size, uint32_t font_cache_size);
+            uint32_t large_char_size, uint32_t small_char_size, uint32_t font_cache_size,
+            uint32_t preload_size);
   const Font& get_font(const std::string& font_path) const;
 
 private:
@@ -0,0 +1,236 @@
+#include <trance/media/image_cache.h>
+#include <common/mapped_file.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#pragma warning(push, 0)
+#include <SFML/Graphics.hpp>
+#pragma warning(pop)
+
+namespace
+{
+  const char ENTRY_MAGIC[4] = {'T', 'R', 'I', 'C'};
+  // Bump whenever decoding output changes, so that stale entries are ignored.
+  const uint32_t ENTRY_VERSION = 1;
+  // Pixel data starts at a multiple of this offset in the file.
+  const uint32_t ENTRY_ALIGNMENT = 64;
+  const std::string ENTRY_EXTENSION = ".img";
+
+  // Layout of a cache entry: this header, then the key, then RGBA pixels
+  // starting at data_offset.
+  struct EntryHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t key_size;
+    uint32_t data_offset;
+  };
+
+  uint64_t entry_bytes(uint32_t key_size, uint32_t width, uint32_t height)
+  {
+    uint64_t offset = sizeof(EntryHeader) + key_size;
+    offset = (offset + ENTRY_ALIGNMENT - 1) / ENTRY_ALIGNMENT * ENTRY_ALIGNMENT;
+    return offset + uint64_t(width) * height * 4;
+  }
+}
+
+ImageCache::ImageCache(const std::string& directory, uint64_t max_bytes)
+: _directory{directory}, _max_bytes{max_bytes}, _total_bytes{0}, _use_counter{0}
+{
+  std::error_code ec;
+  std::tr2::sys::create_directories(_directory, ec);
+
+  // Pick up entries from previous runs, ordered by modification time (which
+  // is updated on every use) so that eviction order is kept between runs.
+  typedef std::pair<std::tr2::sys::file_time_type, std::string> timed_entry;
+  std::vector<timed_entry> existing;
+  for (std::tr2::sys::directory_iterator it{_directory, ec}, end; !ec && it != end;
+       it.increment(ec)) {
+    if (!std::tr2::sys::is_regular_file(it->status())) {
+      continue;
+    }
+    auto path = it->path();
+    if (path.extension().string() != ENTRY_EXTENSION) {
+      // Leftover temporary file from an interrupted write.
+      std::tr2::sys::remove(path, ec);
+      ec.clear();
+      continue;
+    }
+    auto time = std::tr2::sys::last_write_time(path, ec);
+    if (!ec) {
+      existing.emplace_back(time, path.filename().string());
+    }
+    ec.clear();
+  }
+  std::sort(existing.begin(), existing.end());
+
+  for (const auto& pair : existing) {
+    auto path = std::tr2::sys::path{_directory} / pair.second;
+    auto bytes = std::tr2::sys::file_size(path, ec);
+    if (!ec) {
+      touch(pair.second, bytes);
+    }
+    ec.clear();
+  }
+  evict();
+}
+
+Image ImageCache::load(const std::string& path, uint32_t fit_width, uint32_t fit_height)
+{
+  std::error_code ec;
+  auto file_size = std::tr2::sys::file_size(path, ec);
+  auto file_time = ec ? std::tr2::sys::file_time_type{}
+                      : std::tr2::sys::last_write_time(path, ec);
+  if (ec) {
+    return load_image(path, fit_width, fit_height);
+  }
+
+  std::string key = path + "|" + std::to_string(file_size) + "|" +
+      std::to_string(file_time.time_since_epoch().count()) + "|" +
+      std::to_string(fit_width) + "x" + std::to_string(fit_height);
+  std::ostringstream name_stream;
+  name_stream << std::hex << std::setw(16) << std::setfill('0')
+              << uint64_t(std::hash<std::string>{}(key)) << ENTRY_EXTENSION;
+  auto name = name_stream.str();
+  auto entry_path = (std::tr2::sys::path{_directory} / name).string();
+
+  bool cached = false;
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    cached = _entries.count(name) != 0;
+  }
+  if (cached) {
+    auto image = read_entry(entry_path, key);
+    if (image) {
+      std::tr2::sys::last_write_time(entry_path, std::tr2::sys::file_time_type::clock::now(),
+                                     ec);
+      std::lock_guard<std::mutex> lock{_mutex};
+      auto it = _entries.find(name);
+      if (it != _entries.end()) {
+        touch(name, it->second.bytes);
+      }
+      std::cout << ".";
+      return image;
+    }
+  }
+
+  auto image = load_image(path, fit_width, fit_height);
+  if (image && write_entry(entry_path, key, image)) {
+    // Stamped as a use would be, since the time the file system gives a new
+    // file is coarser and can be behind an entry used just before.
+    std::tr2::sys::last_write_time(entry_path, std::tr2::sys::file_time_type::clock::now(), ec);
+    std::lock_guard<std::mutex> lock{_mutex};
+    touch(name, entry_bytes(uint32_t(key.size()), image.width(), image.height()));
+    evict();
+  }
+  return image;
+}
+
+Image ImageCache::read_entry(const std::string& entry_path, const std::string& key) const
+{
+  MappedFile file{entry_path};
+  if (!file || file.size() < sizeof(EntryHeader)) {
+    return {};
+  }
+  EntryHeader header;
+  memcpy(&header, file.data(), sizeof(header));
+  if (memcmp(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC)) ||
+      header.version != ENTRY_VERSION || header.key_size != key.size() ||
+      file.size() != entry_bytes(header.key_size, header.width, header.height) ||
+      memcmp(file.data() + sizeof(header), key.data(), key.size())) {
+    // Stale entry or a hash collision; it'll be overwritten.
+    return {};
+  }
+  return Image{header.width, header.height,
+               const_cast<unsigned char*>(file.data() + header.data_offset)};
+}
+
+bool ImageCache::write_entry(const std::string& entry_path, const std::string& key,
+                             const Image& image) const
+{
+  const auto& sf_image = image.get_sf_image();
+  if (!sf_image) {
+    return false;
+  }
+  EntryHeader header;
+  memcpy(header.magic, ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+  header.version = ENTRY_VERSION;
+  header.width = image.width();
+  header.height = image.height();
+  header.key_size = uint32_t(key.size());
+  header.data_offset = uint32_t(entry_bytes(header.key_size, 0, 0));
+
+  // Write to a temporary file first so that a partially-written entry is
+  // never picked up. It's named for the thread, since two threads loading the
+  // same image at once write the same entry.
+  std::ostringstream temp_stream;
+  temp_stream << entry_path << "." << std::this_thread::get_id() << ".tmp";
+  auto temp_path = temp_stream.str();
+  {
+    std::ofstream f{temp_path, std::ios::binary | std::ios::trunc};
+    std::vector<char> padding(header.data_offset - sizeof(header) - key.size(), 0);
+    f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    f.write(key.data(), key.size());
+    f.write(padding.data(), padding.size());
+    f.write(reinterpret_cast<const char*>(sf_image->getPixelsPtr()),
+            std::streamsize(uint64_t(header.width) * header.height * 4));
+    if (!f) {
+      std::cerr << "\ncouldn't write " << temp_path << std::endl;
+      f.close();
+      std::error_code ec;
+      std::tr2::sys::remove(temp_path, ec);
+      return false;
+    }
+  }
+  std::error_code ec;
+  std::tr2::sys::remove(entry_path, ec);
+  ec.clear();
+  std::tr2::sys::rename(temp_path, entry_path, ec);
+  if (ec) {
+    std::tr2::sys::remove(temp_path, ec);
+    return false;
+  }
+  return true;
+}
+
+void ImageCache::touch(const std::string& name, uint64_t bytes)
+{
+  auto it = _entries.find(name);
+  if (it != _entries.end()) {
+    _lru.erase(it->second.last_use);
+    _total_bytes -= it->second.bytes;
+  }
+  auto& entry = _entries[name];
+  entry.bytes = bytes;
+  entry.last_use = _use_counter++;
+  _lru[entry.last_use] = name;
+  _total_bytes += bytes;
+}
+
+void ImageCache::evict()
+{
+  std::error_code ec;
+  for (auto it = _lru.begin(); _total_bytes > _max_bytes && it != _lru.end();) {
+    // An entry that can't be deleted (say, because it's being read) still
+    // takes up space, so it's kept and tried again next time.
+    auto path = std::tr2::sys::path{_directory} / it->second;
+    std::tr2::sys::remove(path, ec);
+    if (ec && std::tr2::sys::exists(path, ec)) {
+      ++it;
+      continue;
+    }
+    ec.clear();
+    auto entry = _entries.find(it->second);
+    _total_bytes -= entry->second.bytes;
+    _entries.erase(entry);
+    it = _lru.erase(it);
+  }
+}
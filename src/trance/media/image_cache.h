@@ -0,0 +1,46 @@
+#ifndef TRANCE_SRC_TRANCE_MEDIA_IMAGE_CACHE_H
+#define TRANCE_SRC_TRANCE_MEDIA_IMAGE_CACHE_H
+#include <common/media/image.h>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Persistent on-disk cache of decoded images, so that later runs can map the
+// pixels straight back in rather than decoding the files again. Entries are
+// keyed by path, file size, modification time and the size the image was
+// decoded to fit, and the least-recently-used entries are deleted once the
+// cache grows past its size limit. Safe to use from multiple threads.
+class ImageCache
+{
+public:
+  ImageCache(const std::string& directory, uint64_t max_bytes);
+
+  // Returns the cached image, or loads it with load_image() and caches it.
+  Image load(const std::string& path, uint32_t fit_width, uint32_t fit_height);
+
+private:
+  struct Entry {
+    uint64_t bytes;
+    uint64_t last_use;
+  };
+
+  Image read_entry(const std::string& entry_path, const std::string& key) const;
+  bool write_entry(const std::string& entry_path, const std::string& key,
+                   const Image& image) const;
+  void touch(const std::string& name, uint64_t bytes);
+  void evict();
+
+  std::string _directory;
+  uint64_t _max_bytes;
+
+  std::mutex _mutex;
+  uint64_t _total_bytes;
+  uint64_t _use_counter;
+  std::unordered_map<std::string, Entry> _entries;
+  // Entry names by last use, oldest first.
+  std::map<uint64_t, std::string> _lru;
+};
+
+#endif
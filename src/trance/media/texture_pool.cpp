@@ -0,0 +1,137 @@
+#include <trance/media/texture_pool.h>
+#include <cstdlib>
+#include <cstring>
+
+#pragma warning(push, 0)
+#include <GL/glew.h>
+#include <SFML/Window/Context.hpp>
+#pragma warning(pop)
+
+namespace
+{
+  // The bundled GLEW only goes up to OpenGL 4.1, so glTexStorage2D (core since
+  // 4.2) is looked up directly. Null where it isn't available.
+  typedef void(GLAPIENTRY* TexStorage2D)(GLenum target, GLsizei levels, GLenum internal_format,
+                                         GLsizei width, GLsizei height);
+  TexStorage2D tex_storage_2d = nullptr;
+
+  TexStorage2D get_tex_storage_2d()
+  {
+    auto version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    auto dot = version ? std::strchr(version, '.') : nullptr;
+    auto major = version ? std::atoi(version) : 0;
+    auto minor = dot ? std::atoi(dot + 1) : 0;
+    bool supported = glewGetExtension("GL_ARB_texture_storage") ||
+        major > 4 || (major == 4 && minor >= 2);
+    return supported ? reinterpret_cast<TexStorage2D>(sf::Context::getFunction("glTexStorage2D"))
+                     : nullptr;
+  }
+
+  const uint64_t FORMAT_SHIFT = 62;
+  const uint64_t WIDTH_MASK = (uint64_t(1) << (FORMAT_SHIFT - 32)) - 1;
+
+  uint64_t bucket_key(uint32_t width, uint32_t height, PixelFormat format)
+  {
+    return uint64_t(format) << FORMAT_SHIFT | uint64_t(width) << 32 | height;
+  }
+
+  uint64_t bucket_bytes(uint64_t key)
+  {
+    auto format = PixelFormat(key >> FORMAT_SHIFT);
+    return ((key >> 32) & WIDTH_MASK) * (key & 0xffffffff) * (format == PixelFormat::I420 ? 1 : 4);
+  }
+}
+
+TexturePool::TexturePool(uint64_t max_free_bytes)
+: _max_free_bytes{max_free_bytes}
+, _free_bytes{0}
+, _release_counter{0}
+, _hits{0}
+, _allocations{0}
+{
+  tex_storage_2d = get_tex_storage_2d();
+}
+
+TexturePool::~TexturePool()
+{
+  for (const auto& pair : _buckets) {
+    for (const auto& entry : pair.second) {
+      glDeleteTextures(1, &entry.texture);
+    }
+  }
+}
+
+uint32_t TexturePool::allocate(uint32_t width, uint32_t height, PixelFormat format)
+{
+  ++_allocations;
+  auto it = _buckets.find(bucket_key(width, height, format));
+  if (it != _buckets.end() && !it->second.empty()) {
+    auto texture = it->second.back().texture;
+    it->second.pop_back();
+    _free_bytes -= bucket_bytes(it->first);
+    ++_hits;
+    return texture;
+  }
+
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  auto gl_format = Image::gl_format(format);
+  if (tex_storage_2d) {
+    tex_storage_2d(GL_TEXTURE_2D, 1, gl_format == GL_LUMINANCE ? GL_LUMINANCE8 : GL_RGBA8, width,
+                   height);
+  } else {
+    glTexImage2D(GL_TEXTURE_2D, 0, gl_format, width, height, 0, gl_format, GL_UNSIGNED_BYTE,
+                 nullptr);
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, Image::gl_filter(format));
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, Image::gl_filter(format));
+  return texture;
+}
+
+void TexturePool::release(uint32_t texture, uint32_t width, uint32_t height,
+                          PixelFormat format)
+{
+  auto key = bucket_key(width, height, format);
+  if (bucket_bytes(key) > _max_free_bytes) {
+    glDeleteTextures(1, &texture);
+    return;
+  }
+  _buckets[key].push_back({texture, _release_counter++});
+  _free_bytes += bucket_bytes(key);
+  evict();
+}
+
+uint64_t TexturePool::hits() const
+{
+  return _hits;
+}
+
+uint64_t TexturePool::allocations() const
+{
+  return _allocations;
+}
+
+void TexturePool::evict()
+{
+  while (_free_bytes > _max_free_bytes) {
+    // Each bucket is in release order, so the oldest texture overall is at
+    // the front of one of them.
+    auto oldest = _buckets.end();
+    for (auto it = _buckets.begin(); it != _buckets.end(); ++it) {
+      if (!it->second.empty() &&
+          (oldest == _buckets.end() ||
+           it->second.front().released < oldest->second.front().released)) {
+        oldest = it;
+      }
+    }
+    glDeleteTextures(1, &oldest->second.front().texture);
+    oldest->second.erase(oldest->second.begin());
+    _free_bytes -= bucket_bytes(oldest->first);
+    if (oldest->second.empty()) {
+      _buckets.erase(oldest);
+    }
+  }
+}
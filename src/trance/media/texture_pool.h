@@ -0,0 +1,46 @@
+#ifndef TRANCE_SRC_TRANCE_MEDIA_TEXTURE_POOL_H
+#define TRANCE_SRC_TRANCE_MEDIA_TEXTURE_POOL_H
+#include <common/media/image.h>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Keeps textures given back by Image in buckets by size and format, so that
+// they can be refilled for later images of the same size rather than deleted
+// and created again. Textures get immutable storage where glTexStorage2D is
+// available (OpenGL 4.2 or ARB_texture_storage). Once the free textures take
+// up more than max_free_bytes, those released longest ago are deleted.
+// Construct and call from OpenGL context thread only.
+class TexturePool : public TextureAllocator
+{
+public:
+  TexturePool(uint64_t max_free_bytes);
+  ~TexturePool() override;
+
+  uint32_t allocate(uint32_t width, uint32_t height, PixelFormat format) override;
+  void release(uint32_t texture, uint32_t width, uint32_t height,
+               PixelFormat format) override;
+
+  // Number of allocations served from the pool, and in total.
+  uint64_t hits() const;
+  uint64_t allocations() const;
+
+private:
+  struct Entry {
+    uint32_t texture;
+    uint64_t released;
+  };
+
+  void evict();
+
+  const uint64_t _max_free_bytes;
+  uint64_t _free_bytes;
+  uint64_t _release_counter;
+  uint64_t _hits;
+  uint64_t _allocations;
+  // Free textures by size and format (format in the top two bits, then width,
+  // then height), least recently released first.
+  std::unordered_map<uint64_t, std::vector<Entry>> _buckets;
+};
+
+#endif
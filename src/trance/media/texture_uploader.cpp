@@ -0,0 +1,324 @@
+#include <trance/media/texture_uploader.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#pragma warning(push, 0)
+#include <GL/glew.h>
+#include <SFML/Graphics.hpp>
+#pragma warning(pop)
+
+TextureUploader::TextureUploader(uint64_t frame_budget, bool use_thread)
+: _frame_budget{frame_budget}
+, _use_thread{use_thread}
+, _initialised{false}
+, _slots(slot_count)
+, _running{true}
+{
+  if (_use_thread) {
+    _thread = std::thread{[this] { run_thread(); }};
+  }
+}
+
+TextureUploader::~TextureUploader()
+{
+  if (_thread.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _running = false;
+    }
+    _queue_condition.notify_one();
+    _thread.join();
+  }
+  // Textures given out for uploads go back where they came from, while the
+  // rendering context is still there.
+  for (auto& queued : _queue) {
+    if (queued.fence) {
+      glDeleteSync(static_cast<GLsync>(queued.fence));
+    }
+    if (queued.texture) {
+      Image::release_texture(queued.texture, queued.image.texture_width(),
+                             queued.image.texture_height(), queued.image.format());
+    }
+  }
+  for (auto& unused : _unused) {
+    Image::release_texture(unused.texture, unused.width, unused.height, unused.format);
+  }
+  for (auto& uploaded : _uploaded) {
+    if (uploaded.fence) {
+      glDeleteSync(static_cast<GLsync>(uploaded.fence));
+    }
+    Image::release_texture(uploaded.texture, uploaded.image.texture_width(),
+                           uploaded.image.texture_height(), uploaded.image.format());
+  }
+  for (auto& slot : _slots) {
+    if (slot.fence) {
+      glDeleteSync(static_cast<GLsync>(slot.fence));
+    }
+    if (slot.data) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    if (slot.buffer) {
+      glDeleteBuffers(1, &slot.buffer);
+    }
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+bool TextureUploader::use_thread() const
+{
+  return _use_thread;
+}
+
+void TextureUploader::enqueue(const Image& image)
+{
+  // The upload thread is woken once the image has a texture.
+  std::lock_guard<std::mutex> lock{_mutex};
+  if (!image || image.texture() || !image.get_pixels() || image.upload_cancelled() ||
+      (!_use_thread && _queue.size() >= max_queue_size) || is_queued(image)) {
+    return;
+  }
+  _queue.push_back({image, 0, nullptr});
+}
+
+void TextureUploader::update(const std::function<void(const Image&)>& function)
+{
+  if (_use_thread) {
+    update_thread(function);
+  } else {
+    update_slots(function);
+  }
+}
+
+void TextureUploader::async_update()
+{
+  while (!_use_thread) {
+    Slot* slot = nullptr;
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      for (auto& s : _slots) {
+        if (s.state == SlotState::MAPPED) {
+          slot = &s;
+          break;
+        }
+      }
+      if (!slot) {
+        return;
+      }
+      slot->state = SlotState::COPYING;
+    }
+    // The rendering thread leaves COPYING slots alone, so the copy can happen
+    // without holding the lock.
+    memcpy(slot->data, slot->image.get_pixels(), std::size_t(slot->image.byte_size()));
+    std::lock_guard<std::mutex> lock{_mutex};
+    slot->state = SlotState::FILLED;
+  }
+}
+
+bool TextureUploader::is_queued(const Image& image) const
+{
+  // Copies of an image share the same pixels until they're purged.
+  for (const auto& queued : _queue) {
+    if (queued.image.get_pixel_data() == image.get_pixel_data()) {
+      return true;
+    }
+  }
+  for (const auto& slot : _slots) {
+    if (slot.image.get_pixel_data() == image.get_pixel_data()) {
+      return true;
+    }
+  }
+  for (const auto& uploaded : _uploaded) {
+    if (uploaded.image.get_pixel_data() == image.get_pixel_data()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TextureUploader::update_slots(const std::function<void(const Image&)>& function)
+{
+  // Buffers are created lazily so that they belong to the rendering thread's
+  // context.
+  if (!_initialised) {
+    for (auto& slot : _slots) {
+      glGenBuffers(1, &slot.buffer);
+    }
+    _initialised = true;
+  }
+
+  std::lock_guard<std::mutex> lock{_mutex};
+  uint64_t uploaded = 0;
+  for (auto& slot : _slots) {
+    if (slot.state == SlotState::IN_FLIGHT) {
+      if (slot.fence) {
+        auto result = glClientWaitSync(static_cast<GLsync>(slot.fence), 0, 0);
+        if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) {
+          continue;
+        }
+        glDeleteSync(static_cast<GLsync>(slot.fence));
+        slot.fence = nullptr;
+      }
+      slot.state = SlotState::FREE;
+    }
+
+    // Always start at least one transfer per frame, however large.
+    if (slot.state == SlotState::FILLED &&
+        (!uploaded || uploaded + slot.image.byte_size() <= _frame_budget)) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+      slot.data = nullptr;
+
+      // The image may have been uploaded synchronously in the meantime.
+      if (!slot.image.texture()) {
+        // Allocate storage with no buffer bound (otherwise the null pointer
+        // would be taken as an offset into the buffer), then transfer from it.
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        auto texture = Image::create_texture(slot.image.texture_width(),
+                                             slot.image.texture_height(), slot.image.format());
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        slot.image.fill_texture(nullptr);
+        // Drawing with the texture straight away is fine, since OpenGL orders
+        // the draw after the transfer. The fence only guards reuse of the
+        // buffer.
+        slot.image.set_texture(texture);
+        uploaded += slot.image.byte_size();
+        std::cout << ":";
+      }
+      if (GLEW_ARB_sync) {
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      }
+      function(slot.image);
+      slot.image = {};
+      slot.state = SlotState::IN_FLIGHT;
+    }
+
+    while (slot.state == SlotState::FREE && !_queue.empty()) {
+      auto image = _queue.front().image;
+      _queue.pop_front();
+      if (image.texture() || image.upload_cancelled()) {
+        continue;
+      }
+      // Orphan the previous storage so that mapping doesn't wait on any
+      // transfer still reading from it.
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, image.byte_size(), nullptr, GL_STREAM_DRAW);
+      slot.data = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+      if (!slot.data) {
+        // Left for a synchronous upload when the image is first used.
+        continue;
+      }
+      slot.image = image;
+      slot.state = SlotState::MAPPED;
+    }
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void TextureUploader::update_thread(const std::function<void(const Image&)>& function)
+{
+  std::lock_guard<std::mutex> lock{_mutex};
+  // Those cancelled before being given a texture can go straight away; the
+  // upload thread drops the rest.
+  _queue.erase(std::remove_if(_queue.begin(), _queue.end(),
+                              [](const Queued& queued) {
+                                return !queued.texture && queued.image.upload_cancelled();
+                              }),
+               _queue.end());
+  // Only the first few are given textures, so as not to hold on to video
+  // memory well ahead of the uploads.
+  bool given = false;
+  for (std::size_t i = 0; i < _queue.size() && i < max_queue_size; ++i) {
+    auto& queued = _queue[i];
+    if (!queued.texture) {
+      queued.texture = Image::create_texture(queued.image.texture_width(),
+                                             queued.image.texture_height(),
+                                             queued.image.format());
+      // The texture may have come back from an image drawn moments ago.
+      if (GLEW_ARB_sync) {
+        queued.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      }
+      given = true;
+    }
+  }
+  if (given) {
+    // Makes the new textures and fences visible to the upload thread's
+    // context.
+    glFlush();
+    _queue_condition.notify_one();
+  }
+  for (const auto& unused : _unused) {
+    Image::release_texture(unused.texture, unused.width, unused.height, unused.format);
+  }
+  _unused.clear();
+
+  for (auto it = _uploaded.begin(); it != _uploaded.end();) {
+    if (it->fence) {
+      auto result = glClientWaitSync(static_cast<GLsync>(it->fence), 0, 0);
+      if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) {
+        ++it;
+        continue;
+      }
+      glDeleteSync(static_cast<GLsync>(it->fence));
+    }
+    // If the image was uploaded synchronously in the meantime, this texture
+    // is deleted instead.
+    it->image.set_texture(it->texture);
+    function(it->image);
+    it = _uploaded.erase(it);
+  }
+}
+
+void TextureUploader::run_thread()
+{
+  // SFML shares every context it creates with the others, so textures made
+  // here can be used by the rendering thread.
+  sf::Context context;
+  while (true) {
+    Image image;
+    GLuint texture;
+    {
+      std::unique_lock<std::mutex> lock{_mutex};
+      _queue_condition.wait(
+          lock, [&] { return !_running || (!_queue.empty() && _queue.front().texture); });
+      if (!_running) {
+        return;
+      }
+      image = std::move(_queue.front().image);
+      texture = _queue.front().texture;
+      auto fence = static_cast<GLsync>(_queue.front().fence);
+      _queue.pop_front();
+      if (fence) {
+        // Only orders the upload after the rendering thread's use of the
+        // texture; nothing waits here.
+        glWaitSync(fence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(fence);
+      }
+      // Unloaded while still in the queue.
+      if (image.upload_cancelled()) {
+        _unused.push_back(
+            {texture, image.texture_width(), image.texture_height(), image.format()});
+        continue;
+      }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    image.fill_texture(image.get_pixels());
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // The fence must be flushed to be visible from the rendering context.
+    // Without sync objects, just wait for the upload to finish here.
+    void* fence = nullptr;
+    if (GLEW_ARB_sync) {
+      fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      glFlush();
+    } else {
+      glFinish();
+    }
+    std::cout << ":";
+    std::lock_guard<std::mutex> lock{_mutex};
+    _uploaded.push_back({image, texture, fence});
+  }
+}
@@ -0,0 +1,119 @@
+#ifndef TRANCE_SRC_TRANCE_MEDIA_TEXTURE_UPLOADER_H
+#define TRANCE_SRC_TRANCE_MEDIA_TEXTURE_UPLOADER_H
+#include <common/media/image.h>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Uploads images to video memory through a small ring of pixel buffer
+// objects, so that the rendering thread doesn't stall copying pixels in
+// glTexImage2D. The rendering thread maps a buffer for each queued image, the
+// async thread copies the pixels into it, and the rendering thread then
+// starts the transfer into a new texture, up to a byte budget per frame. Each
+// buffer is reused once the fence placed after its transfer has signalled.
+//
+// Alternatively, with use_thread set, images are uploaded entirely on a
+// dedicated thread with its own OpenGL context shared with the rendering
+// context, and handed to the rendering thread once their fence signals. The
+// textures they're uploaded into are still taken from the texture allocator
+// by the rendering thread, so that frames of animations reuse those of
+// frames gone before rather than each creating a new one.
+class TextureUploader
+{
+public:
+  TextureUploader(uint64_t frame_budget, bool use_thread);
+  ~TextureUploader();
+  TextureUploader(const TextureUploader&) = delete;
+  TextureUploader& operator=(const TextureUploader&) = delete;
+
+  // Whether uploads happen on a dedicated thread, in which case enqueue() can
+  // be called from any thread and the queue isn't limited in size.
+  bool use_thread() const;
+  // Called from the main (rendering) thread. Queues the image for upload if
+  // it has no texture yet and isn't queued already. Images whose upload is
+  // cancelled (see Image::cancel_upload) while queued are dropped.
+  void enqueue(const Image& image);
+  // Called from the main (rendering) thread once per frame. The function is
+  // called with each image whose transfer has been started, after which its
+  // pixels are no longer needed.
+  void update(const std::function<void(const Image&)>& function);
+
+  // Called from async update thread to copy pixels into mapped buffers.
+  void async_update();
+
+private:
+  static const std::size_t slot_count = 4;
+  static const std::size_t max_queue_size = 8;
+
+  enum class SlotState {
+    // Not mapped; available for the next queued image.
+    FREE,
+    // Mapped and waiting for the async thread to copy the pixels in.
+    MAPPED,
+    // Pixels being copied in by the async thread.
+    COPYING,
+    // Pixels copied in; waiting for the transfer to be started.
+    FILLED,
+    // Transfer started; waiting for the fence before reuse.
+    IN_FLIGHT,
+  };
+
+  struct Slot {
+    uint32_t buffer = 0;
+    void* data = nullptr;
+    // GLsync object, or null if sync objects aren't supported.
+    void* fence = nullptr;
+    Image image;
+    SlotState state = SlotState::FREE;
+  };
+
+  // Image waiting to be uploaded. With use_thread set, the rendering thread
+  // gives it a texture, and a fence after whatever it last did with the
+  // texture, before the upload thread takes it.
+  struct Queued {
+    Image image;
+    uint32_t texture;
+    void* fence;
+  };
+
+  // Texture given out for an image unloaded before it could be uploaded,
+  // waiting to go back to the allocator.
+  struct Unused {
+    uint32_t texture;
+    uint32_t width;
+    uint32_t height;
+    PixelFormat format;
+  };
+
+  // Texture uploaded on the upload thread, waiting for its fence.
+  struct Uploaded {
+    Image image;
+    uint32_t texture;
+    void* fence;
+  };
+
+  bool is_queued(const Image& image) const;
+  void update_slots(const std::function<void(const Image&)>& function);
+  void update_thread(const std::function<void(const Image&)>& function);
+  void run_thread();
+
+  const uint64_t _frame_budget;
+  const bool _use_thread;
+  bool _initialised;
+  std::mutex _mutex;
+  std::vector<Slot> _slots;
+  std::deque<Queued> _queue;
+
+  bool _running;
+  std::condition_variable _queue_condition;
+  std::vector<Unused> _unused;
+  std::vector<Uploaded> _uploaded;
+  std::thread _thread;
+};
+
+#endif
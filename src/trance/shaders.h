@@ -66,6 +66,74 @@ void main()
 }
 )";
 
+const std::string new_i420_fragment = R"(
+// Active texture for this draw: the Y plane, with the U and V planes side by side beneath it.
+uniform sampler2D texture;
+// Size of the whole texture, of the Y plane, and of each of the U and V planes, in texels.
+uniform vec2 texture_size;
+uniform vec2 luma_size;
+uniform vec2 chroma_size;
+// Conversion to RGB for the video's colour space: rgb = yuv_matrix * (yuv - yuv_offset).
+uniform mat3 yuv_matrix;
+uniform vec3 yuv_offset;
+// Input texture coordinate.
+varying vec2 out_texture_coord;
+// Input alpha value.
+varying vec4 out_colour;
+
+// Samples the plane with the given origin and size, staying half a texel inside it so that
+// filtering never blends in a neighbouring plane.
+float plane(vec2 origin, vec2 size)
+{
+  vec2 coord = clamp(out_texture_coord * size, vec2(.5), size - .5);
+  return texture2D(texture, (origin + coord) / texture_size).r;
+}
+
+void main()
+{
+  vec3 yuv = vec3(plane(vec2(0.), luma_size),
+                  plane(vec2(0., luma_size.y), chroma_size),
+                  plane(vec2(chroma_size.x, luma_size.y), chroma_size));
+  vec3 rgb = clamp(yuv_matrix * (yuv - yuv_offset), 0., 1.);
+  gl_FragColor = out_colour * vec4(rgb, 1.);
+}
+)";
+
+const std::string new_indexed_fragment = R"(
+// Active texture for this draw: four palette indices per texel, with the palette of 256 RGBA
+// colours in the rows beneath. Not filtered, so each texel is fetched exactly.
+uniform sampler2D texture;
+// Size of the whole texture in texels, and of the image in pixels.
+uniform vec2 texture_size;
+uniform vec2 image_size;
+// Input texture coordinate.
+varying vec2 out_texture_coord;
+// Input alpha value.
+varying vec4 out_colour;
+
+// Looks up the colour of the pixel at the given whole-number position.
+vec4 pixel(vec2 p)
+{
+  p = clamp(p, vec2(0.), image_size - 1.);
+  vec4 texel = texture2D(texture, (vec2(floor(p.x / 4.), p.y) + .5) / texture_size);
+  float index = dot(texel, vec4(equal(vec4(mod(p.x, 4.)), vec4(0., 1., 2., 3.))));
+  index = floor(index * 255. + .5);
+  vec2 entry = vec2(mod(index, texture_size.x), image_size.y + floor(index / texture_size.x));
+  return texture2D(texture, (entry + .5) / texture_size);
+}
+
+void main()
+{
+  // Filters the colours rather than the indices, which would blend unrelated colours.
+  vec2 p = out_texture_coord * image_size - .5;
+  vec2 f = fract(p);
+  p = floor(p);
+  vec4 colour = mix(mix(pixel(p), pixel(p + vec2(1., 0.)), f.x),
+                    mix(pixel(p + vec2(0., 1.)), pixel(p + vec2(1., 1.)), f.x), f.y);
+  gl_FragColor = out_colour * colour;
+}
+)";
+
 const std::string spiral_vertex = R"(
 // Position in [-1, 1] X [-1, 1].
 attribute vec2 device_position;
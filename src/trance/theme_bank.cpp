@@ -1,5 +1,6 @@
 #include <trance/theme_bank.h>
 #include <common/util.h>
+#include <algorithm>
 #include <iostream>
 
 #pragma warning(push, 0)
@@ -9,13 +10,35 @@
 #pragma warning(pop)
 
 ThemeBank::ThemeBank(const std::string& root_path, const trance_pb::Session& session,
-                     const trance_pb::System& system, const trance_pb::Program& program)
+                     const trance_pb::System& system, const trance_pb::Program& program,
+                     uint32_t image_width, uint32_t image_height,
+                     const std::string& image_cache_path)
 : _root_path{root_path}
-, _image_cache_size{system.image_cache_size()}
+, _memory_budget{uint64_t(system.image_memory_budget()) << 20}
+, _video_memory_budget{uint64_t(system.video_memory_budget()) << 20}
+, _animation_texture_bytes{0}
+, _image_width{image_width}
+, _image_height{image_height}
+, _animation_decode_threads{system.animation_decode_threads()
+                                ? system.animation_decode_threads()
+                                : std::max(1u, std::thread::hardware_concurrency() / 2)}
+, _animation_frame_parallel{system.animation_frame_parallel()}
 , _swaps_to_match_theme{0}
 , _updates{0}
 , _cooldown{switch_cooldown}
+, _decoding_count{0}
 {
+  auto decode_threads = system.image_decode_threads()
+      ? system.image_decode_threads()
+      : std::max(1u, std::thread::hardware_concurrency());
+  _decode_pool.reset(new ThreadPool{decode_threads});
+  _uploader.reset(new TextureUploader{uint64_t(system.image_upload_budget()) << 20,
+                                      system.image_upload_thread()});
+  if (!image_cache_path.empty()) {
+    _image_cache.reset(
+        new ImageCache{image_cache_path, uint64_t(system.image_disk_cache_size()) << 20});
+  }
+
   // Find all images in all themes and set up data for each.
   std::unordered_set<std::string> all_image_paths;
   std::unordered_set<std::string> all_animation_paths;
@@ -25,7 +48,7 @@ ThemeBank::ThemeBank(const std::string& root_path, const trance_pb::Session& ses
     all_animation_paths.insert(theme.animation_path().begin(), theme.animation_path().end());
   }
   for (const auto& path : all_image_paths) {
-    _all_images.push_back({path, 0, {}});
+    _all_images.push_back({path, 0, {}, false, {}});
   }
   _all_animations.insert(_all_animations.begin(), all_animation_paths.begin(),
                          all_animation_paths.end());
@@ -43,12 +66,14 @@ ThemeBank::ThemeBank(const std::string& root_path, const trance_pb::Session& ses
                                        false,
                                        {},
                                        0,
+                                       0,
+                                       0,
                                        {},
                                        {_all_images.size()},
                                        {_all_images.size()},
                                        {_all_animations.size()},
                                        {theme.font_path().begin(), theme.font_path().end()},
-                                       {theme.text_line().begin(), theme.text_line().end()},
+                                       {},
                                        {},
                                        {static_cast<std::size_t>(theme.text_line().size())}});
     ThemeInfo& theme_info = *_themes.back();
@@ -65,26 +90,41 @@ ThemeBank::ThemeBank(const std::string& root_path, const trance_pb::Session& ses
         _themes.back()->animation_shuffler.modify(i, 1);
       }
     }
-    for (std::size_t i = 0; i < _themes.back()->text_lines.size(); ++i) {
-      _themes.back()->text_lookup[_themes.back()->text_lines[i]].push_back(i);
+    theme_info.text_lines.reserve(theme.text_line().size());
+    theme_info.text_order.reserve(theme.text_line().size());
+    for (const auto& text : theme.text_line()) {
+      theme_info.text_order.push_back(uint32_t(theme_info.text_lines.size()));
+      // Lines repeated or shared between themes are only stored once.
+      theme_info.text_lines.push_back(_texts.intern(text));
     }
+    std::stable_sort(theme_info.text_order.begin(), theme_info.text_order.end(),
+                     [&](uint32_t a, uint32_t b) {
+                       return theme_info.text_lines[a] < theme_info.text_lines[b];
+                     });
   }
+  _texts.finish();
 
   // Set the initially-enabled themes.
   for (std::size_t i = 0; i < _active_themes.size(); ++i) {
     _active_themes[i] = nullptr;
   }
   set_program(program);
-  // Choose the initial active themes and load them up.
+  // Choose the initial active themes and load them up. Starting progressively,
+  // async_update loads the rest straight away.
+  bool progressive = system.progressive_start();
   for (std::size_t i = 0; i < _active_themes.size(); ++i) {
     advance_theme();
     if (i) {
       auto& theme = *_active_themes.back().load();
-      while (!all_loaded()) {
+      while (!startup_ready(theme, i, progressive)) {
         do_reconcile(theme);
+        do_collect(true);
       }
     }
   }
+  if (progressive) {
+    _cooldown = 0;
+  }
 
   _streamer.reset(new AsyncStreamer{[this] { return do_load_animation(false); },
                                     system.animation_buffer_size()});
@@ -92,6 +132,12 @@ ThemeBank::ThemeBank(const std::string& root_path, const trance_pb::Session& ses
                                         system.animation_buffer_size()});
 }
 
+ThemeBank::~ThemeBank()
+{
+  _streamer.reset();
+  _alt_streamer.reset();
+}
+
 const std::string& ThemeBank::get_root_path() const
 {
   return _root_path;
@@ -120,7 +166,7 @@ void ThemeBank::set_program(const trance_pb::Program& program)
   for (uint32_t i = 1; i < _active_themes.size(); ++i) {
     auto theme = _active_themes[i].load();
     if (theme && !theme->enabled) {
-      _swaps_to_match_theme = std::max(_swaps_to_match_theme, i);
+      _swaps_to_match_theme = std::max(_swaps_to_match_theme.load(), i);
     }
   }
   if (!_pinned_theme.empty()) {
@@ -132,9 +178,38 @@ void ThemeBank::set_program(const trance_pb::Program& program)
       }
     }
     if (count < 2) {
-      _swaps_to_match_theme = std::max(_swaps_to_match_theme, 3u);
+      _swaps_to_match_theme = std::max(_swaps_to_match_theme.load(), 3u);
     }
   }
+  // Don't hold up the new program's themes for the last switch's cooldown.
+  if (_swaps_to_match_theme) {
+    _cooldown = 0;
+  }
+}
+
+void ThemeBank::set_next_program(const trance_pb::Program* program)
+{
+  std::vector<std::pair<uint32_t, ThemeInfo*>> weighted;
+  if (program) {
+    for (const auto& theme : program->enabled_theme()) {
+      auto it = _theme_map.find(theme.theme_name());
+      if (it == _theme_map.end() || (!theme.random_weight() && !theme.pinned())) {
+        continue;
+      }
+      // The pinned theme is certain to be shown, so it comes first.
+      auto weight = theme.pinned() ? UINT32_MAX : theme.random_weight();
+      weighted.emplace_back(weight, _themes[it->second].get());
+    }
+  }
+  std::stable_sort(weighted.begin(), weighted.end(),
+                   [](const std::pair<uint32_t, ThemeInfo*>& a,
+                      const std::pair<uint32_t, ThemeInfo*>& b) { return a.first > b.first; });
+
+  std::lock_guard<std::mutex> lock{_prefetch_mutex};
+  _prefetch_themes.clear();
+  for (const auto& pair : weighted) {
+    _prefetch_themes.push_back(pair.second);
+  }
 }
 
 void ThemeBank::advance_frames()
@@ -154,7 +229,7 @@ Image ThemeBank::get_image(bool alternate)
   Image image;
   {
     std::lock_guard<std::mutex> lock{theme.load_mutex};
-    index = theme.image_shuffler.next();
+    index = theme.image_shuffler.next(_last_images);
     if (!_all_images[index].image) {
       return {};
     }
@@ -162,13 +237,6 @@ Image ThemeBank::get_image(bool alternate)
     image = *_all_images[index].image;
   }
   _last_images.push_back(index);
-  for (auto& other_theme : _themes) {
-    std::lock_guard<std::mutex> lock{other_theme->load_mutex};
-    other_theme->image_shuffler.decrease(_last_images.back());
-    if (_last_images.size() > last_image_count) {
-      other_theme->image_shuffler.increase(_last_images.front());
-    }
-  }
   if (_last_images.size() > last_image_count) {
     _last_images.erase(_last_images.begin());
   }
@@ -182,33 +250,33 @@ Image ThemeBank::get_animation(bool alternate)
   });
 }
 
-const std::string& ThemeBank::get_text(bool alternate, bool exclusive)
+uint32_t ThemeBank::get_text(bool alternate, bool exclusive)
 {
   auto& theme = *_active_themes[alternate ? 2 : 1].load();
   if (theme.text_lines.empty()) {
-    const static std::string none;
-    return none;
-  }
-  if (!exclusive) {
-    return theme.text_lines[theme.text_shuffler.next()];
-  }
-  auto text = theme.text_lines[theme.text_shuffler.next()];
-  for (auto& other_theme : _themes) {
-    auto it = other_theme->text_lookup.find(text);
-    if (it != other_theme->text_lookup.end()) {
-      for (auto index : it->second) {
-        other_theme->text_shuffler.decrease(index);
-      }
-    }
-    it = other_theme->text_lookup.find(_last_text);
-    if (!_last_text.empty() && it != other_theme->text_lookup.end()) {
-      for (auto index : it->second) {
-        other_theme->text_shuffler.increase(index);
-      }
-    }
-  }
-  _last_text = text;
-  return _last_text;
+    return 0;
+  }
+  // Lines with the same text as the last exclusive one are passed over.
+  std::vector<std::size_t> last_lines;
+  if (_last_text) {
+    auto begin = std::lower_bound(
+        theme.text_order.begin(), theme.text_order.end(), _last_text,
+        [&](uint32_t index, uint32_t id) { return theme.text_lines[index] < id; });
+    auto end = std::upper_bound(
+        begin, theme.text_order.end(), _last_text,
+        [&](uint32_t id, uint32_t index) { return id < theme.text_lines[index]; });
+    last_lines.assign(begin, end);
+  }
+  auto text = theme.text_lines[theme.text_shuffler.next(last_lines)];
+  if (exclusive) {
+    _last_text = text;
+  }
+  return text;
+}
+
+std::string ThemeBank::get_text(uint32_t id) const
+{
+  return _texts.get(id);
 }
 
 const std::string& ThemeBank::get_font(bool alternate)
@@ -229,11 +297,20 @@ void ThemeBank::maybe_upload_next()
     std::lock_guard<std::mutex> lock{theme.load_mutex};
     auto index = theme.image_shuffler.next();
     if (_all_images[index].image) {
-      do_video_upload(*_all_images[index].image);
+      _uploader->enqueue(*_all_images[index].image);
     }
   }
-  _streamer->maybe_upload_next([&](const Image& image) { do_video_upload(image); });
-  _alt_streamer->maybe_upload_next([&](const Image& image) { do_video_upload(image); });
+  _streamer->maybe_upload_next([&](const Image& image) { _uploader->enqueue(image); });
+  _alt_streamer->maybe_upload_next([&](const Image& image) { _uploader->enqueue(image); });
+}
+
+void ThemeBank::update_uploads()
+{
+  _uploader->update([&](const Image& image) {
+    _purge_mutex.lock();
+    _purgeable_images.push_back(image.get_pixel_data());
+    _purge_mutex.unlock();
+  });
 }
 
 void ThemeBank::change_animation(bool alternate)
@@ -250,11 +327,13 @@ bool ThemeBank::change_themes()
   if (!all_loaded() || !all_unloaded()) {
     return false;
   }
-  _cooldown = switch_cooldown;
   advance_theme();
   if (_swaps_to_match_theme) {
     --_swaps_to_match_theme;
   }
+  // Switches to match a new program follow each other as soon as the themes
+  // are ready; the cooldown starts after the last of them.
+  _cooldown = _swaps_to_match_theme ? 0 : switch_cooldown;
   return true;
 }
 
@@ -263,36 +342,22 @@ bool ThemeBank::swaps_to_match_theme() const
   return _swaps_to_match_theme;
 }
 
-uint32_t ThemeBank::cache_per_theme() const
-{
-  std::size_t enabled_themes = 0;
-  for (const auto& theme : _themes) {
-    if (theme->enabled) {
-      ++enabled_themes;
-    }
-  }
-  return enabled_themes == 0
-      ? 0
-      : _image_cache_size / uint32_t(std::min<std::size_t>(3, enabled_themes));
-}
-
 void ThemeBank::async_update()
 {
   do_purge();
+  _uploader->async_update();
   if (_cooldown) {
     --_cooldown;
     return;
   }
 
   ++_updates;
-
-  auto callback = [&](const Image& image) {
-    _purge_mutex.lock();
-    _purgeable_images.push_back(image.get_sf_image());
-    _purge_mutex.unlock();
-  };
-  _streamer->async_update(callback);
-  _alt_streamer->async_update(callback);
+  do_collect(false);
+  // Only ever grows, so that theme budgets don't shift as frames come and go.
+  auto animation_texture_bytes = _streamer->texture_bytes() + _alt_streamer->texture_bytes();
+  if (animation_texture_bytes > _animation_texture_bytes) {
+    _animation_texture_bytes = animation_texture_bytes;
+  }
   // Swap some images from the active themes in and out every so often.
   if (_updates == 128) {
     do_swap(1);
@@ -304,12 +369,27 @@ void ThemeBank::async_update()
     if (!all_unloaded()) {
       do_unload(*_active_themes.front().load());
     }
+    // Clear the way for a new program's themes all at once.
+    while (_swaps_to_match_theme && !all_unloaded()) {
+      do_unload(*_active_themes.front().load());
+    }
     if (!all_loaded()) {
-      do_load(*_active_themes.back().load());
+      do_reconcile(*_active_themes.back().load());
     }
+    do_prefetch();
   }
 }
 
+uint64_t ThemeBank::animation_frames_reused() const
+{
+  return _streamer->frame_pool().hits() + _alt_streamer->frame_pool().hits();
+}
+
+uint64_t ThemeBank::animation_frames() const
+{
+  return _streamer->frame_pool().allocations() + _alt_streamer->frame_pool().allocations();
+}
+
 void ThemeBank::advance_theme()
 {
   std::size_t random_theme_index = 0;
@@ -354,7 +434,20 @@ void ThemeBank::advance_theme()
 bool ThemeBank::all_loaded() const
 {
   const auto& next_theme = *_active_themes.back().load();
-  return next_theme.loaded_size >= next_theme.size || next_theme.loaded_size >= cache_per_theme();
+  // However full memory is, the theme needs an image to show.
+  return next_theme.decoded_size >= next_theme.size ||
+      (next_theme.decoded_size && next_theme.decoded_size == next_theme.loaded_size &&
+       (theme_full(next_theme) || memory_full() || video_memory_full()));
+}
+
+bool ThemeBank::startup_ready(const ThemeInfo& theme, std::size_t i, bool progressive) const
+{
+  if (all_loaded()) {
+    return true;
+  }
+  // The themes shown first only wait for one image each, and the next theme
+  // for none.
+  return progressive && (theme.decoded_size || 1 + i == _active_themes.size());
 }
 
 bool ThemeBank::all_unloaded() const
@@ -369,6 +462,69 @@ bool ThemeBank::all_unloaded() const
   return !prev_theme.loaded_size || count > 1;
 }
 
+uint64_t ThemeBank::theme_budget() const
+{
+  std::size_t enabled_themes = 0;
+  for (const auto& theme : _themes) {
+    if (theme->enabled) {
+      ++enabled_themes;
+    }
+  }
+  uint64_t animation_bytes = _animation_texture_bytes;
+  return enabled_themes == 0 || animation_bytes >= _video_memory_budget
+      ? 0
+      : (_video_memory_budget - animation_bytes) / std::min<std::size_t>(3, enabled_themes);
+}
+
+bool ThemeBank::theme_full(const ThemeInfo& theme) const
+{
+  // Images still decoding are assumed to be of average size; before any have
+  // been decoded, assume they'll fill the screen.
+  std::size_t decoded_size = theme.decoded_size;
+  std::size_t loaded_size = theme.loaded_size;
+  std::size_t decoding_size = loaded_size > decoded_size ? loaded_size - decoded_size : 0;
+  uint64_t texture_bytes = theme.texture_bytes;
+  uint64_t average_bytes = decoded_size
+      ? texture_bytes / decoded_size
+      : std::max<uint64_t>(1, uint64_t(_image_width) * _image_height * 4);
+  // Always allow at least one image.
+  return loaded_size &&
+      texture_bytes + (decoding_size + 1) * average_bytes > theme_budget();
+}
+
+bool ThemeBank::memory_full() const
+{
+  return Image::memory_bytes() >= _memory_budget;
+}
+
+bool ThemeBank::video_memory_full() const
+{
+  return Image::video_memory_bytes() >= _video_memory_budget;
+}
+
+bool ThemeBank::prefetch_full() const
+{
+  // Leave room for the active themes to fill their own budgets first, which
+  // their images pass through RAM to do.
+  uint64_t reserved = 0;
+  auto budget = theme_budget();
+  for (std::size_t i = 1; i < _active_themes.size(); ++i) {
+    uint64_t texture_bytes = _active_themes[i].load()->texture_bytes;
+    reserved += std::max(texture_bytes, budget) - texture_bytes;
+  }
+  return Image::memory_bytes() + reserved >= _memory_budget || video_memory_full();
+}
+
+bool ThemeBank::is_active(const ThemeInfo& theme) const
+{
+  for (const auto& active_theme : _active_themes) {
+    if (active_theme.load() == &theme) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void ThemeBank::do_swap(std::size_t active_theme_index)
 {
   auto& theme = *_active_themes[active_theme_index].load();
@@ -381,77 +537,220 @@ void ThemeBank::do_swap(std::size_t active_theme_index)
 
 void ThemeBank::do_reconcile(ThemeInfo& theme)
 {
-  if (theme.loaded_size < cache_per_theme()) {
-    do_load(theme);
-  }
-  if (theme.loaded_size > cache_per_theme()) {
-    do_unload(theme);
+  // Submit as many loads as the decode pool can usefully take on. The first
+  // image is loaded regardless, so that the theme has something to show.
+  while (!theme_full(theme) && (!theme.loaded_size || (!memory_full() && !video_memory_full())) &&
+         !decode_pool_full() && do_load(theme))
+    ;
+  // Free up the most memory at once when over budget.
+  if (theme.decoded_size > 1 && theme.texture_bytes > theme_budget()) {
+    do_unload(theme, true);
   }
 }
 
-void ThemeBank::do_load(ThemeInfo& theme)
+bool ThemeBank::do_load(ThemeInfo& theme)
 {
   if (theme.loaded_size >= theme.size) {
-    return;
+    return false;
   }
   auto index = theme.load_shuffler.next();
   theme.load_shuffler.decrease(index);
   theme.loaded_index.emplace_back(index);
+  ++theme.loaded_size;
 
   auto& image = _all_images[index];
   // Could store spare capacity due to duplicated images and load more. Might
   // get a bit confusing though.
-  if (!image.use_count++) {
-    image.image.reset(new Image{load_image(_root_path + "/" + image.path)});
-  }
-  // Don't try to load again if it failed.
-  if (!*image.image) {
-    for (auto& other_theme : _themes) {
-      other_theme->load_shuffler.modify(index, -static_cast<int32_t>(last_image_count));
-    }
-  }
-  {
+  ++image.use_count;
+  if (image.image) {
     std::lock_guard<std::mutex> lock{theme.load_mutex};
     theme.image_shuffler.increase(index);
+    theme.texture_bytes += image.image->byte_size();
+    ++theme.decoded_size;
+    return true;
   }
-  ++theme.loaded_size;
+  image.waiting_themes.push_back(&theme);
+  if (!image.decoding) {
+    do_decode(index);
+  }
+  return true;
 }
 
-void ThemeBank::do_unload(ThemeInfo& theme)
+void ThemeBank::do_unload(ThemeInfo& theme, bool largest)
 {
   if (!theme.loaded_size) {
     return;
   }
-  auto index = theme.loaded_index.front();
+  auto position = theme.loaded_index.begin();
+  if (largest) {
+    uint64_t largest_bytes = 0;
+    for (auto it = theme.loaded_index.begin(); it != theme.loaded_index.end(); ++it) {
+      const auto& image = _all_images[*it].image;
+      if (image && image->byte_size() > largest_bytes) {
+        largest_bytes = image->byte_size();
+        position = it;
+      }
+    }
+  }
+  auto index = *position;
   theme.load_shuffler.increase(index);
-  theme.loaded_index.erase(theme.loaded_index.begin());
+  theme.loaded_index.erase(position);
 
-  {
+  auto& image = _all_images[index];
+  auto it = std::find(image.waiting_themes.begin(), image.waiting_themes.end(), &theme);
+  if (it != image.waiting_themes.end()) {
+    // Still decoding; nothing to remove from the image shuffler yet.
+    image.waiting_themes.erase(it);
+  } else {
     std::lock_guard<std::mutex> lock{theme.load_mutex};
     theme.image_shuffler.decrease(index);
+    theme.texture_bytes -= image.image ? image.image->byte_size() : 0;
+    --theme.decoded_size;
   }
-  auto& image = _all_images[index];
-  if (!--image.use_count) {
+  if (!--image.use_count && image.image) {
+    image.image->cancel_upload();
     _purge_mutex.lock();
-    _purgeable_images.push_back(image.image->get_sf_image());
+    _purgeable_images.push_back(image.image->get_pixel_data());
     _purge_mutex.unlock();
     image.image.reset();
   }
   --theme.loaded_size;
 }
 
+void ThemeBank::do_decode(std::size_t index)
+{
+  auto& image = _all_images[index];
+  image.decoding = true;
+  ++_decoding_count;
+
+  auto path = _root_path + "/" + image.path;
+  _decode_pool->submit([this, index, path] {
+    DecodedImage result{index, {}, false};
+    try {
+      result.image = _image_cache ? _image_cache->load(path, _image_width, _image_height)
+                                  : load_image(path, _image_width, _image_height);
+    } catch (std::bad_alloc&) {
+      result.out_of_memory = true;
+    }
+    std::lock_guard<std::mutex> lock{_decoded_mutex};
+    _decoded.emplace_back(std::move(result));
+    _decoded_condition.notify_one();
+  });
+}
+
+void ThemeBank::do_collect(bool wait)
+{
+  std::vector<DecodedImage> decoded;
+  {
+    std::unique_lock<std::mutex> lock{_decoded_mutex};
+    if (wait && _decoding_count) {
+      _decoded_condition.wait(lock, [&] { return !_decoded.empty(); });
+    }
+    decoded.swap(_decoded);
+  }
+
+  for (auto& result : decoded) {
+    --_decoding_count;
+    // Rethrow on the async thread so that we report running out of memory.
+    if (result.out_of_memory) {
+      throw std::bad_alloc{};
+    }
+    auto& image = _all_images[result.index];
+    image.decoding = false;
+    // Unloaded again before it finished decoding.
+    if (!image.use_count) {
+      continue;
+    }
+    // Don't try to load again if it failed.
+    if (!result.image) {
+      for (auto& other_theme : _themes) {
+        other_theme->load_shuffler.modify(result.index, -static_cast<int32_t>(last_image_count));
+      }
+    }
+    for (auto theme : image.waiting_themes) {
+      std::lock_guard<std::mutex> lock{theme->load_mutex};
+      if (!image.image) {
+        image.image.reset(new Image{result.image});
+      }
+      theme->image_shuffler.increase(result.index);
+      theme->texture_bytes += image.image->byte_size();
+      ++theme->decoded_size;
+    }
+    image.waiting_themes.clear();
+    // With a separate upload thread, textures can be made straight away
+    // rather than when the images are first drawn.
+    if (image.image && _uploader->use_thread()) {
+      _uploader->enqueue(*image.image);
+    }
+  }
+}
+
+void ThemeBank::do_prefetch()
+{
+  std::vector<ThemeInfo*> themes;
+  {
+    std::lock_guard<std::mutex> lock{_prefetch_mutex};
+    themes = _prefetch_themes;
+  }
+  for (auto it = _prefetched_themes.begin(); it != _prefetched_themes.end();) {
+    auto& theme = **it;
+    if (is_active(theme)) {
+      // Loaded and unloaded like any other active theme from here on.
+      it = _prefetched_themes.erase(it);
+    } else if (std::find(themes.begin(), themes.end(), &theme) == themes.end()) {
+      while (theme.loaded_size) {
+        do_unload(theme);
+      }
+      it = _prefetched_themes.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  // Active themes, including the one being switched away from, are loaded and
+  // unloaded as usual.
+  for (auto* theme : themes) {
+    if (is_active(*theme)) {
+      continue;
+    }
+    if (std::find(_prefetched_themes.begin(), _prefetched_themes.end(), theme) ==
+        _prefetched_themes.end()) {
+      _prefetched_themes.push_back(theme);
+    }
+    while (!theme_full(*theme) && !prefetch_full() && !decode_pool_full() && do_load(*theme))
+      ;
+    if (prefetch_full() || decode_pool_full()) {
+      return;
+    }
+  }
+}
+
+bool ThemeBank::decode_pool_full() const
+{
+  // Keep a couple of jobs queued per thread so that no thread sits idle
+  // between async updates.
+  return _decoding_count >= 2 * _decode_pool->size();
+}
+
 std::unique_ptr<Streamer> ThemeBank::do_load_animation(bool alternate)
 {
   auto& theme = *_active_themes[alternate ? 2 : 1].load();
-  auto index = theme.animation_shuffler.next();
+  std::size_t index;
+  {
+    std::lock_guard<std::mutex> lock{_animation_mutex};
+    index = theme.animation_shuffler.next();
+  }
   if (index >= _all_animations.size()) {
     return {};
   }
 
-  auto streamer = load_animation(_root_path + "/" + _all_animations[index]);
+  auto streamer =
+      load_animation(_root_path + "/" + _all_animations[index], _animation_decode_threads,
+                     _animation_frame_parallel, _image_width, _image_height);
   int32_t amount = -1;
   if (!streamer->success()) {
     // Don't try to load again if it failed.
+    std::lock_guard<std::mutex> lock{_animation_mutex};
     for (auto& other_theme : _themes) {
       other_theme->animation_shuffler.modify(index, -5);
     }
@@ -470,9 +769,9 @@ void ThemeBank::do_video_upload(const Image& image) const
     // Swap the sf::Image pointer so we can delete it on the async thread (see
     // do_purge() below).
     _purge_mutex.lock();
-    _purgeable_images.push_back(image.get_sf_image());
+    _purgeable_images.push_back(image.get_pixel_data());
     _purge_mutex.unlock();
-    image.clear_sf_image();
+    image.clear_pixels();
   }
 }
 
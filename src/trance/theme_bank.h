@@ -3,8 +3,12 @@
 #include <common/media/image.h>
 #include <common/util.h>
 #include <trance/media/async_streamer.h>
+#include <trance/media/image_cache.h>
+#include <trance/media/texture_uploader.h>
+#include <trance/thread_pool.h>
 #include <array>
 #include <atomic>
+#include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -23,18 +27,40 @@ namespace trance_pb
   class Theme;
 }
 
-// ThemeBank keeps two Themes active at all times with a number of images
-// in memory each so that a variety of these images can be displayed with no
-// load delay. It also asynchronously loads a third theme into memory so that
-// the active themes can be swapped out.
+// ThemeBank keeps two Themes active at all times, with as many of their images
+// in memory as the budgets below allow, so that a variety of images can be
+// displayed with no load delay. It also loads a third theme in the background
+// so that the active themes can be swapped out.
+//
+// Two budgets from the system settings limit what's held: image_memory_budget
+// bytes of decoded pixels in RAM, and video_memory_budget bytes of textures.
+// What's left of the latter after the most the animations' frames have used at
+// once is split into a share for each enabled theme, but no more than three
+// shares: one each for the active themes and the one loading next.
+//
+// Image files are decoded in parallel on a pool of worker threads, at the
+// reduced size that still covers an area of image_width x image_height when
+// the format allows it; animation frames are likewise downscaled as they're
+// decoded. Decoded images are kept in an on-disk cache at image_cache_path, if
+// given. If enabled in the system settings, they're also uploaded to video
+// memory as soon as they're decoded, on a separate thread with its own OpenGL
+// context.
 class ThemeBank
 {
 public:
   ThemeBank(const std::string& root_path, const trance_pb::Session& session,
-            const trance_pb::System& system, const trance_pb::Program& program);
+            const trance_pb::System& system, const trance_pb::Program& program,
+            uint32_t image_width = 0, uint32_t image_height = 0,
+            const std::string& image_cache_path = {});
+  // Stops the animation decode threads before the themes they load from.
+  ~ThemeBank();
 
   const std::string& get_root_path() const;
   void set_program(const trance_pb::Program& program);
+  // Program expected to come next in the playlist, or null. Images of the
+  // themes it enables are loaded ahead with whatever memory the active themes
+  // leave spare, so that switching to them needn't wait on decoding.
+  void set_next_program(const trance_pb::Program* program);
 
   // Advance animation frames.
   void advance_frames();
@@ -44,16 +70,23 @@ public:
   // images from RAM to video memory on-demand.
   Image get_image(bool alternate);
   Image get_animation(bool alternate);
-  const std::string& get_text(bool alternate, bool exclusive);
+  // Text lines are stored once for the whole session and handed out by ID;
+  // get_text(id) gets the line itself. The empty line is always ID 0.
+  uint32_t get_text(bool alternate, bool exclusive);
+  std::string get_text(uint32_t id) const;
   const std::string& get_font(bool alternate);
 
-  // Call to upload a random image from the next theme which has been loaded
-  // into RAM but not video memory.
+  // Call to queue a random image from the next theme which has been loaded
+  // into RAM but not video memory for upload in the background.
   //
-  // This has to happen on the main rendering thread since OpenGL contexts
-  // are single-threaded by default, but this function call can be timed to
-  // mitigate the upload cost of switching active themes.
+  // Unless a separate upload thread is enabled, this has to happen on the
+  // main rendering thread since OpenGL contexts are single-threaded by
+  // default, but this function call can be timed to mitigate the upload cost
+  // of switching active themes.
   void maybe_upload_next();
+  // Called once per frame from the main (rendering) thread to continue
+  // queued uploads.
+  void update_uploads();
 
   // Allow an animation to change this frame.
   void change_animation(bool alternate);
@@ -65,8 +98,11 @@ public:
   // Called from separate update thread to perform async loading/unloading.
   void async_update();
 
+  // Number of animation frames decoded into recycled buffers, and in total.
+  uint64_t animation_frames_reused() const;
+  uint64_t animation_frames() const;
+
 private:
-  uint32_t cache_per_theme() const;
   static const std::size_t switch_cooldown = 500;
   static const std::size_t last_image_count = 8;
 
@@ -78,8 +114,14 @@ private:
     bool enabled;
     // Used for synchronizing image loads.
     std::mutex load_mutex;
-    // Used for synchronizing theme changes.
+    // Number of images this theme has caused to be loaded, including those
+    // still being decoded. Used for synchronizing theme changes.
     std::atomic<std::size_t> loaded_size;
+    // Number of those images which have finished decoding.
+    std::atomic<std::size_t> decoded_size;
+    // Total size of the decoded images' textures, which each takes up in video
+    // memory once uploaded to be shown.
+    std::atomic<uint64_t> texture_bytes;
     // Indexes of images that this theme has caused to be loaded.
     std::vector<std::size_t> loaded_index;
     // Shuffler for loading images; maps onto all_images.
@@ -90,10 +132,10 @@ private:
     Shuffler animation_shuffler;
     // All font paths for this theme.
     std::vector<std::string> font_paths;
-    // All texts for this theme.
-    std::vector<std::string> text_lines;
-    // Lookup from text to index.
-    std::unordered_map<std::string, std::vector<std::size_t>> text_lookup;
+    // IDs of all texts for this theme.
+    std::vector<uint32_t> text_lines;
+    // Indexes into text_lines ordered by ID, for finding a text's lines.
+    std::vector<uint32_t> text_order;
     // Shuffler for choosing text lines. Maps on to text_lines above.
     Shuffler text_shuffler;
   };
@@ -104,18 +146,53 @@ private:
     // Reference count; corresponds to ThemeInfo::loaded_index.
     uint32_t use_count;
     std::unique_ptr<Image> image;
+    // Whether the image has been submitted to the decode pool and the result
+    // not yet collected.
+    bool decoding;
+    // Themes which loaded this image while it was decoding, and which pick it
+    // up once it arrives.
+    std::vector<ThemeInfo*> waiting_themes;
+  };
+
+  // Result of a job on the decode pool.
+  struct DecodedImage {
+    std::size_t index;
+    Image image;
+    bool out_of_memory;
   };
 
   void advance_theme();
   bool all_loaded() const;
+  // Whether the constructor can stop loading the theme it put in the given
+  // slot of the active themes.
+  bool startup_ready(const ThemeInfo& theme, std::size_t i, bool progressive) const;
   bool all_unloaded() const;
+  // Each enabled theme's share of the video memory budget.
+  uint64_t theme_budget() const;
+  // Whether another image's texture wouldn't fit in the theme's budget.
+  bool theme_full(const ThemeInfo& theme) const;
+  // Whether pixels in RAM are using up the image memory budget, and textures
+  // the video memory budget.
+  bool memory_full() const;
+  bool video_memory_full() const;
+  // Whether images in RAM are using up what the active themes leave of it.
+  bool prefetch_full() const;
+  bool is_active(const ThemeInfo& theme) const;
 
   // Called from the async_update thread and can load images from files
   // into RAM as necessary.
   void do_swap(std::size_t active_theme_index);
   void do_reconcile(ThemeInfo& theme);
-  void do_load(ThemeInfo& theme);
-  void do_unload(ThemeInfo& theme);
+  bool do_load(ThemeInfo& theme);
+  // Unloads the image loaded longest ago, or the largest one.
+  void do_unload(ThemeInfo& theme, bool largest = false);
+  void do_decode(std::size_t index);
+  void do_collect(bool wait);
+  // Loads the next program's themes ahead, and unloads those loaded ahead
+  // that are neither wanted any more nor active.
+  void do_prefetch();
+  bool decode_pool_full() const;
+  // Called from the animation decode threads.
   std::unique_ptr<Streamer> do_load_animation(bool alternate);
   void do_video_upload(const Image& image) const;
   void do_purge();
@@ -123,14 +200,21 @@ private:
   const std::string _root_path;
   // Data for all images.
   std::vector<ImageInfo> _all_images;
+  // The last few images shown, passed over when choosing the next one from any
+  // theme. Rendering thread only.
   std::vector<std::size_t> _last_images;
   std::vector<std::string> _all_animations;
-  std::string _last_text;
+  // Likewise for the ID of the last text shown exclusively.
+  uint32_t _last_text = 0;
+  // All distinct text lines in the session.
+  TextArena _texts;
 
   std::unique_ptr<AsyncStreamer> _streamer;
   std::unique_ptr<AsyncStreamer> _alt_streamer;
-  bool _animation_theme_changed = false;
-  bool _alt_animation_theme_changed = false;
+  // Guards choosing animations, which both decode threads do.
+  std::mutex _animation_mutex;
+  std::atomic<bool> _animation_theme_changed{false};
+  std::atomic<bool> _alt_animation_theme_changed{false};
   bool _change_animation = false;
   bool _alt_change_animation = false;
 
@@ -142,15 +226,37 @@ private:
   std::vector<std::unique_ptr<ThemeInfo>> _themes;
   // Currently-active themes in queue.
   std::array<std::atomic<ThemeInfo*>, 4> _active_themes;
+  // Themes of the next program, most likely first; guarded by the mutex.
+  std::mutex _prefetch_mutex;
+  std::vector<ThemeInfo*> _prefetch_themes;
+  // Themes loaded ahead so far. Async thread only.
+  std::vector<ThemeInfo*> _prefetched_themes;
 
-  const uint32_t _image_cache_size;
-  uint32_t _swaps_to_match_theme;
+  const uint64_t _memory_budget;
+  const uint64_t _video_memory_budget;
+  // Most video memory the animations' frames have used at once.
+  std::atomic<uint64_t> _animation_texture_bytes;
+  const uint32_t _image_width;
+  const uint32_t _image_height;
+  const uint32_t _animation_decode_threads;
+  const bool _animation_frame_parallel;
+  std::atomic<uint32_t> _swaps_to_match_theme;
   uint32_t _updates;
   uint32_t _global_fps;
   std::atomic<uint32_t> _cooldown;
 
   mutable std::mutex _purge_mutex;
-  mutable std::vector<std::shared_ptr<sf::Image>> _purgeable_images;
+  mutable std::vector<std::shared_ptr<const void>> _purgeable_images;
+
+  // Images are decoded on the pool and handed back to the async thread
+  // through _decoded.
+  std::size_t _decoding_count;
+  std::mutex _decoded_mutex;
+  std::condition_variable _decoded_condition;
+  std::vector<DecodedImage> _decoded;
+  std::unique_ptr<ImageCache> _image_cache;
+  std::unique_ptr<TextureUploader> _uploader;
+  std::unique_ptr<ThreadPool> _decode_pool;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,52 @@
+#include <trance/thread_pool.h>
+
+ThreadPool::ThreadPool(std::size_t threads) : _stop{false}
+{
+  for (std::size_t i = 0; i < threads; ++i) {
+    _threads.emplace_back([this] { run(); });
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _stop = true;
+    _jobs.clear();
+  }
+  _condition.notify_all();
+  for (auto& thread : _threads) {
+    thread.join();
+  }
+}
+
+std::size_t ThreadPool::size() const
+{
+  return _threads.size();
+}
+
+void ThreadPool::submit(const std::function<void()>& job)
+{
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _jobs.push_back(job);
+  }
+  _condition.notify_one();
+}
+
+void ThreadPool::run()
+{
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock{_mutex};
+      _condition.wait(lock, [&] { return _stop || !_jobs.empty(); });
+      if (_stop) {
+        return;
+      }
+      job = std::move(_jobs.front());
+      _jobs.pop_front();
+    }
+    job();
+  }
+}
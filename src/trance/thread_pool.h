@@ -0,0 +1,33 @@
+#ifndef TRANCE_SRC_TRANCE_THREAD_POOL_H
+#define TRANCE_SRC_TRANCE_THREAD_POOL_H
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads which run submitted jobs in order. Jobs that
+// are still queued when the pool is destroyed are dropped; jobs which have
+// already started are allowed to finish.
+class ThreadPool
+{
+public:
+  ThreadPool(std::size_t threads);
+  ~ThreadPool();
+
+  std::size_t size() const;
+  void submit(const std::function<void()>& job);
+
+private:
+  void run();
+
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  std::deque<std::function<void()>> _jobs;
+  std::vector<std::thread> _threads;
+  bool _stop;
+};
+
+#endif
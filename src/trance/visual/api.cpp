@@ -18,25 +18,6 @@ namespace
     return sf::Color(sf::Uint8(colour.r() * 255), sf::Uint8(colour.g() * 255),
                      sf::Uint8(colour.b() * 255), sf::Uint8(colour.a() * 255));
   }
-
-  std::vector<std::string> SplitText(const std::string& text, bool split_words)
-  {
-    std::vector<std::string> result;
-    std::string s = text;
-    while (!s.empty()) {
-      auto of = split_words ? " \t\r\n" : "\r\n";
-      auto p = s.find_first_of(of);
-      auto q = s.substr(0, p != std::string::npos ? p : s.size());
-      if (!q.empty()) {
-        result.push_back(q);
-      }
-      s = s.substr(p != std::string::npos ? 1 + p : s.size());
-    }
-    if (result.empty()) {
-      result.emplace_back();
-    }
-    return result;
-  }
 }
 
 VisualApiImpl::VisualApiImpl(Director& director, ThemeBank& themes,
@@ -45,13 +26,16 @@ VisualApiImpl::VisualApiImpl(Director& director, ThemeBank& themes,
 : _director{director}
 , _themes{themes}
 , _font_cache{_themes.get_root_path(), session, height_pixels / 3, height_pixels / 12,
-              system.font_cache_size()}
+              system.font_cache_size(),
+              system.progressive_start() ? 1u : system.font_cache_size()}
 , _switch_themes{0}
 , _spiral{0}
 , _spiral_type{0}
 , _spiral_width{60}
+, _small_subtext{0}
 , _small_subtext_x{0}
 , _small_subtext_y{0}
+, _current_text{0}
 {
   change_font(true);
   change_spiral();
@@ -117,16 +101,17 @@ void VisualApiImpl::change_text(SplitType split_type, bool alternate)
   bool split_word = split_type == SPLIT_WORD || split_type == SPLIT_WORD_GAPS;
   bool once_only = split_type == SPLIT_ONCE_ONLY;
 
-  if (_current_text.empty() && once_only) {
+  if (_current_text_parts.empty() && once_only) {
     return;
   }
-  if (!_current_text.empty()) {
-    _current_text.erase(_current_text.begin());
-    if (!_current_text.empty() || gaps || once_only) {
+  if (!_current_text_parts.empty()) {
+    _current_text_parts.erase(_current_text_parts.begin());
+    if (!_current_text_parts.empty() || gaps || once_only) {
       return;
     }
   }
-  _current_text = SplitText(_themes.get_text(alternate, true), split_word);
+  _current_text = _themes.get_text(alternate, true);
+  _current_text_parts = split_text(_themes.get_text(_current_text), split_word);
 }
 
 void VisualApiImpl::change_subtext(bool alternate)
@@ -134,23 +119,17 @@ void VisualApiImpl::change_subtext(bool alternate)
   static const uint32_t count = 16;
   _subtext.clear();
   for (uint32_t i = 0; i < 16; ++i) {
-    auto s = _themes.get_text(alternate, false);
-    for (auto& c : s) {
-      if (c == '\n') {
-        c = ' ';
-      }
-    }
-    if (!s.empty()) {
-      _subtext.push_back(s);
+    auto text = _themes.get_text(alternate, false);
+    if (text) {
+      _subtext.push_back(text);
     }
   }
 }
 
 void VisualApiImpl::change_small_subtext(bool force, bool alternate)
 {
-  if (force || _small_subtext.empty()) {
+  if (force || !_small_subtext) {
     _small_subtext = _themes.get_text(alternate, false);
-    std::replace(_small_subtext.begin(), _small_subtext.end(), '\n', ' ');
     float x = _small_subtext_x;
     float y = _small_subtext_y;
     while (std::abs(x - _small_subtext_x) < 1.f / 8) {
@@ -162,7 +141,7 @@ void VisualApiImpl::change_small_subtext(bool force, bool alternate)
     _small_subtext_x = x;
     _small_subtext_y = y;
   } else {
-    _small_subtext.clear();
+    _small_subtext = 0;
   }
 }
 
@@ -205,10 +184,12 @@ void VisualApiImpl::render_image(const Image& image, float alpha, float zoom_ori
 void VisualApiImpl::render_text(float zoom_origin, float zoom, float shadow_zoom_origin,
                                 float shadow_zoom) const
 {
-  if (_current_font.empty() || _current_text.empty() || _current_text.front().empty()) {
+  if (_current_font.empty() || _current_text_parts.empty() ||
+      !_current_text_parts.front().second) {
     return;
   }
-  const auto& text = _current_text.front();
+  const auto& part = _current_text_parts.front();
+  auto text = _themes.get_text(_current_text).substr(part.first, part.second);
   const auto& program = _director.program();
   const auto& font = _font_cache.get_font(_current_font);
 
@@ -244,7 +225,9 @@ void VisualApiImpl::render_subtext(float alpha, float zoom_origin) const
     text.clear();
     size_t iterations = 0;
     do {
-      text += " " + _subtext[n];
+      auto line = _themes.get_text(_subtext[n]);
+      std::replace(line.begin(), line.end(), '\n', ' ');
+      text += " " + line;
       n = (n + 1) % _subtext.size();
       size = _director.text_size(font, text, false);
       ++iterations;
@@ -279,13 +262,15 @@ void VisualApiImpl::render_subtext(float alpha, float zoom_origin) const
 
 void VisualApiImpl::render_small_subtext(float alpha, float zoom_origin) const
 {
-  if (_current_subfont.empty() || _small_subtext.empty()) {
+  if (_current_subfont.empty() || !_small_subtext) {
     return;
   }
   const auto& program = _director.program();
   const auto& font = _font_cache.get_font(_current_subfont);
+  auto text = _themes.get_text(_small_subtext);
+  std::replace(text.begin(), text.end(), '\n', ' ');
 
-  auto size = _director.text_size(font, _small_subtext, false);
+  auto size = _director.text_size(font, text, false);
   if (!size.x || !size.y) {
     return;
   }
@@ -294,7 +279,7 @@ void VisualApiImpl::render_small_subtext(float alpha, float zoom_origin) const
 
   auto colour = colour2sf(_director.program().shadow_text_colour());
   colour.a = uint8_t(colour.a * alpha);
-  _director.render_text(font, _small_subtext, false, colour, scale,
+  _director.render_text(font, text, false, colour, scale,
                         {_small_subtext_x / 2, _small_subtext_y / 2}, zoom_origin,
                         zoom_intensity(zoom_origin, zoom_origin));
 }
@@ -101,12 +101,16 @@ private:
   uint32_t _spiral_width;
   std::string _current_font;
   std::string _current_subfont;
-  std::vector<std::string> _subtext;
-  std::string _small_subtext;
+  // Texts are held by their IDs in the theme bank.
+  std::vector<uint32_t> _subtext;
+  uint32_t _small_subtext;
   float _small_subtext_x;
   float _small_subtext_y;
 
-  std::vector<std::string> _current_text;
+  // The text being shown, and the position and length of each of its parts
+  // still to show in turn.
+  uint32_t _current_text;
+  std::vector<std::pair<std::size_t, std::size_t>> _current_text_parts;
 };
 
 #endif
\ No newline at end of file